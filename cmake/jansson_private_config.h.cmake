@@ -2,18 +2,25 @@
 #cmakedefine HAVE_FCNTL_H 1
 #cmakedefine HAVE_SCHED_H 1
 #cmakedefine HAVE_UNISTD_H 1
+#cmakedefine HAVE_SYS_MMAN_H 1
 #cmakedefine HAVE_SYS_PARAM_H 1
 #cmakedefine HAVE_SYS_STAT_H 1
 #cmakedefine HAVE_SYS_TIME_H 1
 #cmakedefine HAVE_SYS_TYPES_H 1
+#cmakedefine HAVE_SYS_UIO_H 1
 #cmakedefine HAVE_STDINT_H 1
 
 #cmakedefine HAVE_CLOSE 1
 #cmakedefine HAVE_GETPID 1
 #cmakedefine HAVE_GETTIMEOFDAY 1
+#cmakedefine HAVE_MADVISE 1
+#cmakedefine HAVE_MMAP 1
 #cmakedefine HAVE_OPEN 1
 #cmakedefine HAVE_READ 1
 #cmakedefine HAVE_SCHED_YIELD 1
+#cmakedefine HAVE_WRITEV 1
+
+#cmakedefine HAVE_PTHREAD 1
 
 #cmakedefine HAVE_SYNC_BUILTINS 1
 #cmakedefine HAVE_ATOMIC_BUILTINS 1
@@ -60,3 +67,7 @@
 #endif
 
 #define INITIAL_HASHTABLE_ORDER @JANSSON_INITIAL_HASHTABLE_ORDER@
+
+#define LOAD_BUFFER_SIZE @JANSSON_LOAD_BUFFER_SIZE@
+
+#define DUMP_BUFFER_SIZE @JANSSON_DUMP_BUFFER_SIZE@
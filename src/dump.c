@@ -11,7 +11,7 @@
 
 #include "jansson_private.h"
 
-#include <assert.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -19,18 +19,35 @@
 #include <unistd.h>
 #endif
 
+#ifdef HAVE_PTHREAD
+#define DUMP_THREADS 1
+#include <pthread.h>
+#endif
+
+#if defined(HAVE_UNISTD_H) && defined(HAVE_SYS_UIO_H) && defined(HAVE_WRITEV)
+#define DUMP_WRITEV 1
+#include <sys/uio.h>
+#endif
+
 #include "jansson.h"
+#include "scan.h"
 #include "strbuffer.h"
 #include "utf.h"
 
-#define MAX_INTEGER_STR_LENGTH 25
-#define MAX_REAL_STR_LENGTH    25
+#define MAX_REAL_STR_LENGTH 25
+
+#ifndef DUMP_BUFFER_SIZE
+#define DUMP_BUFFER_SIZE 4096
+#endif
+
+/* Size of the buffer where runs of integers in arrays are formatted */
+#define INTEGER_RUN_SIZE 512
 
 #define FLAGS_TO_INDENT(f)    ((f) & 0x1F)
 #define FLAGS_TO_PRECISION(f) (((f) >> 11) & 0x1F)
 
 struct buffer {
-    const size_t size;
+    size_t size;
     size_t used;
     char *data;
 };
@@ -59,11 +76,160 @@ static int dump_to_file(const char *buffer, size_t size, void *data) {
 static int dump_to_fd(const char *buffer, size_t size, void *data) {
 #ifdef HAVE_UNISTD_H
     int *dest = (int *)data;
-    if (write(*dest, buffer, size) == (ssize_t)size)
-        return 0;
-#endif
+
+    /* pipes and sockets may take only part of a large write, and a
+       signal may interrupt it */
+    while (size > 0) {
+        ssize_t written;
+
+        do
+            written = write(*dest, buffer, size);
+        while (written < 0 && errno == EINTR);
+
+        if (written <= 0)
+            return -1;
+        buffer += written;
+        size -= (size_t)written;
+    }
+    return 0;
+#else
     return -1;
+#endif
+}
+
+/* The encoder writes its output in many small pieces. They're
+   collected here and passed on to the actual callback in chunks of
+   DUMP_BUFFER_SIZE bytes. */
+struct stage {
+    json_dump_callback_t dump;
+    void *data;
+    size_t used;
+    size_t length; /* of all the output so far */
+    char buffer[DUMP_BUFFER_SIZE];
+};
+
+static int dump_to_stage(const char *buffer, size_t size, void *data) {
+    struct stage *stage = (struct stage *)data;
+
+    stage->length += size;
+    if (stage->used + size > sizeof(stage->buffer)) {
+        if (stage->used && stage->dump(stage->buffer, stage->used, stage->data))
+            return -1;
+        stage->used = 0;
+
+        /* pass large pieces on as is instead of copying them */
+        if (size > sizeof(stage->buffer))
+            return stage->dump(buffer, size, stage->data);
+    }
+
+    memcpy(stage->buffer + stage->used, buffer, size);
+    stage->used += size;
+    return 0;
+}
+
+#ifdef DUMP_WRITEV
+/* json_dumpfd() output. Pieces of at least GATHER_MIN bytes are
+   referenced where they are instead of copied, and the rest are
+   collected to buffer. All of them are written with writev(), up to
+   GATHER_IOVECS pieces at a time.
+
+   Only string values and object keys are passed in pieces this long,
+   and they stay alive until the dump is done. The temporary buffers of
+   the encoder are shorter. The output of containers with caching
+   enabled may be freed before that, so dump_transient() doesn't let it
+   stay referenced. The streaming writer can't use this, as its strings
+   are the caller's. */
+#define GATHER_MIN    1024
+#define GATHER_IOVECS 64
+#ifndef GATHER_PENDING
+#define GATHER_PENDING (256 * 1024)
+#endif
+
+#if INTEGER_RUN_SIZE >= GATHER_MIN
+#error "Runs of integers would be referenced after they're gone"
+#endif
+
+struct gather {
+    int fd;
+    int count;      /* of iov entries in use */
+    size_t pending; /* bytes referenced by iov */
+    size_t used;
+    struct iovec iov[GATHER_IOVECS];
+    char buffer[DUMP_BUFFER_SIZE];
+};
+
+static int gather_flush(struct gather *gather) {
+    struct iovec *iov = gather->iov;
+    int count = gather->count;
+
+    while (count > 0) {
+        ssize_t written;
+
+        do
+            written = writev(gather->fd, iov, count);
+        while (written < 0 && errno == EINTR);
+
+        if (written <= 0)
+            return -1;
+
+        /* pipes and sockets may take only part of it */
+        while (count > 0 && (size_t)written >= iov->iov_len) {
+            written -= (ssize_t)iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= (size_t)written;
+        }
+    }
+
+    gather->count = 0;
+    gather->pending = 0;
+    gather->used = 0;
+    return 0;
+}
+
+static int dump_to_gather(const char *buffer, size_t size, void *data) {
+    struct gather *gather = (struct gather *)data;
+    struct iovec *last = gather->count ? &gather->iov[gather->count - 1] : NULL;
+    int append;
+
+    if (size >= GATHER_MIN) {
+        if (gather->count == GATHER_IOVECS && gather_flush(gather))
+            return -1;
+
+        gather->iov[gather->count].iov_base = (void *)buffer;
+        gather->iov[gather->count].iov_len = size;
+        gather->count++;
+
+        /* write long strings while they're still in the cache */
+        gather->pending += size;
+        return gather->pending >= GATHER_PENDING ? gather_flush(gather) : 0;
+    }
+
+    /* continue the last piece if it's the end of buffer */
+    append = last &&
+             (char *)last->iov_base + last->iov_len == gather->buffer + gather->used;
+    if (gather->used + size > sizeof(gather->buffer) ||
+        (!append && gather->count == GATHER_IOVECS)) {
+        if (gather_flush(gather))
+            return -1;
+        append = 0;
+    }
+
+    memcpy(gather->buffer + gather->used, buffer, size);
+    if (append) {
+        gather->iov[gather->count - 1].iov_len += size;
+    } else {
+        gather->iov[gather->count].iov_base = gather->buffer + gather->used;
+        gather->iov[gather->count].iov_len = size;
+        gather->count++;
+    }
+    gather->used += size;
+    return 0;
 }
+#endif
 
 /* 32 spaces (the maximum indentation size) */
 static const char whitespace[] = "                                ";
@@ -91,132 +257,414 @@ static int dump_indent(size_t flags, int depth, int space, json_dump_callback_t
     return 0;
 }
 
+/* For the ASCII characters that may need escaping, the character
+   after the backslash in their escape sequence, or 'u' if they're
+   escaped as \u00XX */
+static const char escape_table[0x80] = {
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+    0,   0,   '"', 0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   '/',
+    0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+    0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+    0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   '\\', 0,  0,   0,
+    0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+    0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0};
+
+static const char hex_digits[] = "0123456789ABCDEF";
+
+static char *write_unicode_escape(char *seq, int32_t code_unit) {
+    seq[0] = '\\';
+    seq[1] = 'u';
+    seq[2] = hex_digits[(code_unit >> 12) & 0xF];
+    seq[3] = hex_digits[(code_unit >> 8) & 0xF];
+    seq[4] = hex_digits[(code_unit >> 4) & 0xF];
+    seq[5] = hex_digits[code_unit & 0xF];
+    return seq + 6;
+}
+
+/* Write the escape sequence of codepoint to seq, and return its
+   length */
+static int escape_codepoint(int32_t codepoint, char *seq) {
+    /* ASCII, mostly two character escapes */
+    if (codepoint < 0x80) {
+        char c = escape_table[codepoint];
+        if (c != 'u') {
+            seq[0] = '\\';
+            seq[1] = c;
+            return 2;
+        }
+    }
+
+    /* codepoint is in BMP */
+    if (codepoint < 0x10000) {
+        write_unicode_escape(seq, codepoint);
+        return 6;
+    }
+
+    /* not in BMP -> construct a UTF-16 surrogate pair */
+    codepoint -= 0x10000;
+    seq = write_unicode_escape(seq, 0xD800 | ((codepoint & 0xffc00) >> 10));
+    write_unicode_escape(seq, 0xDC00 | (codepoint & 0x003ff));
+    return 12;
+}
+
+/* Return a pointer to the first character in [pos, lim) that has to
+   be escaped, or lim if there's none. Returns NULL on invalid UTF-8. */
+static const char *find_escape(const char *pos, const char *lim, size_t flags) {
+    while (1) {
+        const char *run = pos, *end;
+
+        /* skip the bytes that are written as is, many at a time */
+        pos = jsonp_scan_string(pos, lim);
+        if (flags & JSON_ESCAPE_SLASH) {
+            const char *slash = memchr(run, '/', pos - run);
+            if (slash)
+                return slash;
+        }
+        if (pos == lim || (unsigned char)*pos < 0x80)
+            return pos;
+
+        /* non-ASCII, validated even if it's not escaped */
+        end = utf8_iterate(pos, lim - pos, NULL);
+        if (!end)
+            return NULL;
+        if (flags & JSON_ENSURE_ASCII)
+            return pos;
+        pos = end;
+    }
+}
+
+/* Write the escape sequence of the character at pos, found by
+   find_escape(), to seq and its length to *length. Returns a pointer
+   past the character. */
+static const char *escape_char(const char *pos, const char *lim, char *seq, int *length) {
+    int32_t codepoint = (unsigned char)*pos;
+    const char *end = pos + 1;
+
+    if (codepoint >= 0x80)
+        end = utf8_iterate(pos, lim - pos, &codepoint);
+
+    *length = escape_codepoint(codepoint, seq);
+    return end;
+}
+
 static int dump_string(const char *str, size_t len, json_dump_callback_t dump, void *data,
                        size_t flags) {
-    const char *pos, *end, *lim;
-    int32_t codepoint = 0;
+    const char *pos, *lim = str + len;
 
     if (dump("\"", 1, data))
         return -1;
 
-    end = pos = str;
-    lim = str + len;
     while (1) {
-        const char *text;
-        char seq[13];
+        char seq[12];
         int length;
 
-        while (end < lim) {
-            end = utf8_iterate(pos, lim - pos, &codepoint);
-            if (!end)
+        pos = find_escape(str, lim, flags);
+        if (!pos)
+            return -1;
+
+        if (pos != str) {
+            if (dump(str, pos - str, data))
                 return -1;
+        }
 
-            /* mandatory escape or control char */
-            if (codepoint == '\\' || codepoint == '"' || codepoint < 0x20)
-                break;
+        if (pos == lim)
+            break;
 
-            /* slash */
-            if ((flags & JSON_ESCAPE_SLASH) && codepoint == '/')
-                break;
+        str = escape_char(pos, lim, seq, &length);
+        if (dump(seq, length, data))
+            return -1;
+    }
 
-            /* non-ASCII */
-            if ((flags & JSON_ENSURE_ASCII) && codepoint > 0x7F)
-                break;
+    return dump("\"", 1, data);
+}
 
-            pos = end;
-        }
+/* The pairs of an object sorted by key, for JSON_SORT_KEYS */
+static struct hashtable_pair **sorted_pairs(const json_t *json) {
+    return hashtable_sorted(&json_to_object(json)->hashtable);
+}
 
-        if (pos != str) {
-            if (dump(str, pos - str, data))
+/* Writes what dump_indent() writes between array elements to buffer.
+   Returns its length, or 0 if it doesn't fit. */
+static size_t make_separator(size_t flags, int depth, char *buffer, size_t size) {
+    size_t length = 1, n_spaces = (size_t)depth * FLAGS_TO_INDENT(flags);
+
+    buffer[0] = ',';
+    if (FLAGS_TO_INDENT(flags) > 0) {
+        if (n_spaces + 2 > size)
+            return 0;
+        buffer[length++] = '\n';
+        memset(buffer + length, ' ', n_spaces);
+        length += n_spaces;
+    } else if (!(flags & JSON_COMPACT)) {
+        buffer[length++] = ' ';
+    }
+    return length;
+}
+
+/* Dumps the integers of array from *index on, and the separators
+   after them, in one go. Stops at the first element that is not an
+   integer, and sets *index to it. */
+static int dump_integers(const json_t *array, size_t *index, const char *separator,
+                         size_t separator_length, json_dump_callback_t dump,
+                         void *data) {
+    char buffer[INTEGER_RUN_SIZE];
+    size_t i = *index, n = json_array_size(array), used = 0;
+
+    for (; i < n; i++) {
+        json_t *value = json_array_get(array, i);
+        if (!json_is_integer(value))
+            break;
+
+        if (used + JSONP_MAX_INTEGER_LENGTH + separator_length > sizeof(buffer)) {
+            if (dump(buffer, used, data))
                 return -1;
+            used = 0;
         }
 
-        if (end == pos)
-            break;
+        used += (size_t)jsonp_inttostr(buffer + used, json_integer_value(value));
+        if (i < n - 1) {
+            memcpy(buffer + used, separator, separator_length);
+            used += separator_length;
+        }
+    }
 
-        /* handle \, /, ", and control codes */
-        length = 2;
-        switch (codepoint) {
-            case '\\':
-                text = "\\\\";
-                break;
-            case '\"':
-                text = "\\\"";
-                break;
-            case '\b':
-                text = "\\b";
-                break;
-            case '\f':
-                text = "\\f";
-                break;
-            case '\n':
-                text = "\\n";
-                break;
-            case '\r':
-                text = "\\r";
-                break;
-            case '\t':
-                text = "\\t";
-                break;
-            case '/':
-                text = "\\/";
-                break;
-            default: {
-                /* codepoint is in BMP */
-                if (codepoint < 0x10000) {
-                    snprintf(seq, sizeof(seq), "\\u%04X", (unsigned int)codepoint);
-                    length = 6;
-                }
+    *index = i;
+    return used ? dump(buffer, used, data) : 0;
+}
 
-                /* not in BMP -> construct a UTF-16 surrogate pair */
-                else {
-                    int32_t first, last;
+/*** output cache ***/
 
-                    codepoint -= 0x10000;
-                    first = 0xD800 | ((codepoint & 0xffc00) >> 10);
-                    last = 0xDC00 | (codepoint & 0x003ff);
+/* Internal flag: dump a container even if its output is cached */
+#define DUMP_NO_CACHE ((size_t)1 << 30)
 
-                    snprintf(seq, sizeof(seq), "\\u%04X\\u%04X", (unsigned int)first,
-                             (unsigned int)last);
-                    length = 12;
-                }
+/* The output of a container for one set of flags and depth */
+struct cached_output {
+    struct cached_output *next; /* on the retired list */
+    size_t flags;
+    int depth;
+    size_t epoch; /* jsonp_value_epoch when the output was made */
+    size_t length;
+    char *bytes;
+};
 
-                text = seq;
-                break;
-            }
-        }
+/* Dumps may read and replace the output from several threads at the
+   same time. A replaced output is freed right away only if no other
+   dump is using the cache, otherwise it's retired until then or until
+   the container changes. */
+struct dump_cache {
+    struct cached_output *output;  /* latest output, or NULL */
+    struct cached_output *retired; /* replaced outputs that may be in use */
+    size_t users;                  /* dumps using the cache right now */
+};
 
-        if (dump(text, length, data))
-            return -1;
+#if defined(HAVE_ATOMIC_BUILTINS)
+#define cache_load(ptr_)    __atomic_load_n(ptr_, __ATOMIC_SEQ_CST)
+#define cache_add(ptr_, n_) __atomic_add_fetch(ptr_, n_, __ATOMIC_SEQ_CST)
+#define cache_sub(ptr_, n_) __atomic_sub_fetch(ptr_, n_, __ATOMIC_SEQ_CST)
+#elif defined(HAVE_SYNC_BUILTINS)
+#define cache_load(ptr_)    __sync_val_compare_and_swap(ptr_, 0, 0)
+#define cache_add(ptr_, n_) __sync_add_and_fetch(ptr_, n_)
+#define cache_sub(ptr_, n_) __sync_sub_and_fetch(ptr_, n_)
+#else
+#define cache_load(ptr_)    (*(ptr_))
+#define cache_add(ptr_, n_) (*(ptr_) += (n_))
+#define cache_sub(ptr_, n_) (*(ptr_) -= (n_))
+#endif
+
+static struct cached_output *swap_output(struct cached_output **ptr,
+                                         struct cached_output *output) {
+#if defined(HAVE_ATOMIC_BUILTINS)
+    return __atomic_exchange_n(ptr, output, __ATOMIC_SEQ_CST);
+#else
+    struct cached_output *old;
+
+#if defined(HAVE_SYNC_BUILTINS)
+    do {
+        old = *ptr;
+    } while (!__sync_bool_compare_and_swap(ptr, old, output));
+#else
+    old = *ptr;
+    *ptr = output;
+#endif
+    return old;
+#endif
+}
+
+static void retire_output(struct dump_cache *cache, struct cached_output *output) {
+#if defined(HAVE_ATOMIC_BUILTINS)
+    output->next = __atomic_load_n(&cache->retired, __ATOMIC_SEQ_CST);
+    while (!__atomic_compare_exchange_n(&cache->retired, &output->next, output, 0,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+        ;
+#elif defined(HAVE_SYNC_BUILTINS)
+    do {
+        output->next = cache->retired;
+    } while (!__sync_bool_compare_and_swap(&cache->retired, output->next, output));
+#else
+    output->next = cache->retired;
+    cache->retired = output;
+#endif
+}
 
-        str = pos = end;
+static void free_outputs(struct cached_output *output) {
+    while (output) {
+        struct cached_output *next = output->next;
+        jsonp_free(output->bytes);
+        jsonp_free(output);
+        output = next;
     }
+}
 
-    return dump("\"", 1, data);
+/* Make the output in buffer the cached output, taking its value */
+static void store_output(struct dump_cache *cache, size_t flags, int depth,
+                         size_t epoch, strbuffer_t *buffer) {
+    struct cached_output *output, *old;
+
+    output = jsonp_malloc(sizeof(struct cached_output));
+    if (!output)
+        return;
+
+    output->next = NULL;
+    output->flags = flags;
+    output->depth = depth;
+    output->epoch = epoch;
+    output->length = buffer->length;
+    output->bytes = strbuffer_steal_value(buffer);
+
+    cache_add(&cache->users, 1);
+    old = swap_output(&cache->output, output);
+    if (old) {
+        if (cache_load(&cache->users) == 1) {
+            free_outputs(old);
+            free_outputs(swap_output(&cache->retired, NULL));
+        } else {
+            retire_output(cache, old);
+        }
+    }
+    cache_sub(&cache->users, 1);
 }
 
-struct key_len {
-    const char *key;
-    int len;
-};
+void jsonp_dump_cache_clear(struct dump_cache *cache) {
+    free_outputs(cache->output);
+    free_outputs(cache->retired);
+    cache->output = NULL;
+    cache->retired = NULL;
+}
+
+void jsonp_dump_cache_free(struct dump_cache *cache) {
+    if (!cache)
+        return;
+
+    jsonp_dump_cache_clear(cache);
+    jsonp_free(cache);
+    cache_sub(&jsonp_dump_caches, 1);
+}
+
+static int do_dump(const json_t *json, size_t flags, int depth, loop_check_t *parents,
+                   json_dump_callback_t dump, void *data);
+
+/* Passes output that may be freed when this returns to dump. The
+   json_dumpfd() writer would reference long output until it's
+   flushed, so short output is passed to it in pieces that it copies,
+   and long output is written right away. */
+static int dump_transient(const char *buffer, size_t size, json_dump_callback_t dump,
+                          void *data) {
+#ifdef DUMP_WRITEV
+    if (dump == dump_to_gather) {
+        if (size >= DUMP_BUFFER_SIZE) {
+            if (dump(buffer, size, data))
+                return -1;
+            return gather_flush((struct gather *)data);
+        }
+
+        while (size >= GATHER_MIN) {
+            if (dump(buffer, GATHER_MIN - 1, data))
+                return -1;
+            buffer += GATHER_MIN - 1;
+            size -= GATHER_MIN - 1;
+        }
+    }
+#endif
+    return size ? dump(buffer, size, data) : 0;
+}
 
-static int compare_keys(const void *key1, const void *key2) {
-    const struct key_len *k1 = key1;
-    const struct key_len *k2 = key2;
-    const size_t min_size = k1->len < k2->len ? k1->len : k2->len;
-    int res = memcmp(k1->key, k2->key, min_size);
+/* Dumps a container with caching enabled. The cached output is used
+   if it's for the same flags and depth, and the container is dumped
+   and its output cached otherwise. */
+static int dump_cached(const json_t *json, jsonp_tracking_t *tracking, size_t flags,
+                       int depth, loop_check_t *parents, json_dump_callback_t dump,
+                       void *data) {
+    struct dump_cache *cache = tracking->cache;
+    struct cached_output *output;
+    size_t epoch = jsonp_value_epoch;
+    strbuffer_t buffer;
+    int res;
 
-    if (res)
+    /* detect circular references */
+    if (jsonp_loop_check(parents, json))
+        return -1;
+    jsonp_loop_leave(parents);
+
+    cache_add(&cache->users, 1);
+    output = cache_load(&cache->output);
+    if (output && output->flags == flags && output->depth == depth &&
+        output->epoch == epoch) {
+        res = dump_transient(output->bytes, output->length, dump, data);
+        cache_sub(&cache->users, 1);
         return res;
+    }
+    cache_sub(&cache->users, 1);
+
+    if (strbuffer_init(&buffer))
+        return -1;
+
+    res = do_dump(json, flags | DUMP_NO_CACHE, depth, parents, dump_to_strbuffer,
+                  &buffer);
+    if (!res)
+        res = dump_transient(strbuffer_value(&buffer), buffer.length, dump, data);
+
+    /* Changes below an untracked container may not clear the cache */
+    if (!res && !tracking->untracked)
+        store_output(cache, flags, depth, epoch, &buffer);
+
+    strbuffer_close(&buffer);
+    return res;
+}
+
+int json_dump_cache_enable(json_t *json) {
+    jsonp_tracking_t *tracking = jsonp_tracking(json);
+
+    if (!tracking)
+        return -1;
+
+    if (!tracking->cache) {
+        tracking->cache = jsonp_malloc(sizeof(struct dump_cache));
+        if (!tracking->cache)
+            return -1;
+
+        tracking->cache->output = NULL;
+        tracking->cache->retired = NULL;
+        tracking->cache->users = 0;
+        cache_add(&jsonp_dump_caches, 1);
+    }
+    return 0;
+}
+
+void json_dump_cache_disable(json_t *json) {
+    jsonp_tracking_t *tracking = jsonp_tracking(json);
 
-    return k1->len - k2->len;
+    if (!tracking)
+        return;
+
+    jsonp_dump_cache_free(tracking->cache);
+    tracking->cache = NULL;
 }
 
-static int do_dump(const json_t *json, size_t flags, int depth, hashtable_t *parents,
+static int do_dump(const json_t *json, size_t flags, int depth, loop_check_t *parents,
                    json_dump_callback_t dump, void *data) {
     int embed = flags & JSON_EMBED;
-
-    flags &= ~JSON_EMBED;
+    jsonp_tracking_t *tracking;
 
     if (!json)
         return -1;
@@ -224,6 +672,14 @@ static int do_dump(const json_t *json, size_t flags, int depth, hashtable_t *par
     if (depth >= JSON_PARSER_MAX_DEPTH)
         return -1;
 
+    tracking = jsonp_tracking(json);
+    if (flags & DUMP_NO_CACHE)
+        flags &= ~DUMP_NO_CACHE;
+    else if (tracking && tracking->cache)
+        return dump_cached(json, tracking, flags, depth, parents, dump, data);
+
+    flags &= ~JSON_EMBED;
+
     switch (json_typeof(json)) {
         case JSON_NULL:
             return dump("null", 4, data);
@@ -235,13 +691,8 @@ static int do_dump(const json_t *json, size_t flags, int depth, hashtable_t *par
             return dump("false", 5, data);
 
         case JSON_INTEGER: {
-            char buffer[MAX_INTEGER_STR_LENGTH];
-            int size;
-
-            size = snprintf(buffer, MAX_INTEGER_STR_LENGTH, "%" JSON_INTEGER_FORMAT,
-                            json_integer_value(json));
-            if (size < 0 || size >= MAX_INTEGER_STR_LENGTH)
-                return -1;
+            char buffer[JSONP_MAX_INTEGER_LENGTH];
+            int size = jsonp_inttostr(buffer, json_integer_value(json));
 
             return dump(buffer, size, data);
         }
@@ -263,16 +714,20 @@ static int do_dump(const json_t *json, size_t flags, int depth, hashtable_t *par
             return dump_string(json_string_value(json), json_string_length(json), dump,
                                data, flags);
 
+        case JSON_RAW:
+            /* already encoded */
+            if (json_raw_length(json) == 0)
+                return 0;
+            return dump(json_raw_value(json), json_raw_length(json), data);
+
         case JSON_ARRAY: {
             size_t n;
             size_t i;
-            /* Space for "0x", double the sizeof a pointer for the hex and a
-             * terminator. */
-            char key[2 + (sizeof(json) * 2) + 1];
-            size_t key_len;
+            char separator[64];
+            size_t separator_length;
 
             /* detect circular references */
-            if (jsonp_loop_check(parents, json, key, sizeof(key), &key_len))
+            if (jsonp_loop_check(parents, json))
                 return -1;
 
             n = json_array_size(json);
@@ -280,27 +735,38 @@ static int do_dump(const json_t *json, size_t flags, int depth, hashtable_t *par
             if (!embed && dump("[", 1, data))
                 return -1;
             if (n == 0) {
-                hashtable_del(parents, key, key_len);
+                jsonp_loop_leave(parents);
                 return embed ? 0 : dump("]", 1, data);
             }
             if (dump_indent(flags, depth + 1, 0, dump, data))
                 return -1;
 
-            for (i = 0; i < n - 1; ++i) {
-                if (do_dump(json_array_get(json, i), flags, depth + 1, parents, dump,
-                            data))
+            separator_length =
+                make_separator(flags, depth + 1, separator, sizeof(separator));
+
+            for (i = 0; i < n;) {
+                json_t *value = json_array_get(json, i);
+
+                /* numeric arrays are common, format their runs of
+                   integers without going through dump for each */
+                if (json_is_integer(value) && separator_length) {
+                    if (dump_integers(json, &i, separator, separator_length, dump, data))
+                        return -1;
+                    continue;
+                }
+
+                if (do_dump(value, flags, depth + 1, parents, dump, data))
                     return -1;
 
-                if (dump(",", 1, data) || dump_indent(flags, depth + 1, 1, dump, data))
+                if (++i < n &&
+                    (dump(",", 1, data) || dump_indent(flags, depth + 1, 1, dump, data)))
                     return -1;
             }
 
-            if (do_dump(json_array_get(json, i), flags, depth + 1, parents, dump, data))
-                return -1;
             if (dump_indent(flags, depth, 0, dump, data))
                 return -1;
 
-            hashtable_del(parents, key, key_len);
+            jsonp_loop_leave(parents);
             return embed ? 0 : dump("]", 1, data);
         }
 
@@ -308,8 +774,6 @@ static int do_dump(const json_t *json, size_t flags, int depth, hashtable_t *par
             void *iter;
             const char *separator;
             int separator_length;
-            char loop_key[LOOP_KEY_LEN];
-            size_t loop_key_len;
 
             if (flags & JSON_COMPACT) {
                 separator = ":";
@@ -320,8 +784,7 @@ static int do_dump(const json_t *json, size_t flags, int depth, hashtable_t *par
             }
 
             /* detect circular references */
-            if (jsonp_loop_check(parents, json, loop_key, sizeof(loop_key),
-                                 &loop_key_len))
+            if (jsonp_loop_check(parents, json))
                 return -1;
 
             if (!embed && dump("{", 1, data))
@@ -329,65 +792,39 @@ static int do_dump(const json_t *json, size_t flags, int depth, hashtable_t *par
 
             iter = json_object_iter((json_t *)json);
             if (!iter) {
-                hashtable_del(parents, loop_key, loop_key_len);
+                jsonp_loop_leave(parents);
                 return embed ? 0 : dump("}", 1, data);
             }
             if (dump_indent(flags, depth + 1, 0, dump, data))
                 return -1;
 
             if (flags & JSON_SORT_KEYS) {
-                struct key_len *keys;
+                /* The sorted order is kept in the object until its keys
+                   change */
+                struct hashtable_pair **pairs = sorted_pairs(json);
                 size_t size, i;
 
-                size = json_object_size(json);
-                keys = jsonp_malloc(size * sizeof(struct key_len));
-                if (!keys)
+                if (!pairs)
                     return -1;
 
-                i = 0;
-                while (iter) {
-                    struct key_len *keylen = &keys[i];
-
-                    keylen->key = json_object_iter_key(iter);
-                    keylen->len = json_object_iter_key_len(iter);
-
-                    iter = json_object_iter_next((json_t *)json, iter);
-                    i++;
-                }
-                assert(i == size);
-
-                qsort(keys, size, sizeof(struct key_len), compare_keys);
-
+                size = json_object_size(json);
                 for (i = 0; i < size; i++) {
-                    const struct key_len *key;
-                    json_t *value;
-
-                    key = &keys[i];
-                    value = json_object_getn(json, key->key, key->len);
-                    assert(value);
+                    const struct hashtable_pair *pair = pairs[i];
 
-                    dump_string(key->key, key->len, dump, data, flags);
+                    dump_string(pair->key, pair->key_len, dump, data, flags);
                     if (dump(separator, separator_length, data) ||
-                        do_dump(value, flags, depth + 1, parents, dump, data)) {
-                        jsonp_free(keys);
+                        do_dump(pair->value, flags, depth + 1, parents, dump, data))
                         return -1;
-                    }
 
                     if (i < size - 1) {
                         if (dump(",", 1, data) ||
-                            dump_indent(flags, depth + 1, 1, dump, data)) {
-                            jsonp_free(keys);
+                            dump_indent(flags, depth + 1, 1, dump, data))
                             return -1;
-                        }
                     } else {
-                        if (dump_indent(flags, depth, 0, dump, data)) {
-                            jsonp_free(keys);
+                        if (dump_indent(flags, depth, 0, dump, data))
                             return -1;
-                        }
                     }
                 }
-
-                jsonp_free(keys);
             } else {
                 /* Don't sort keys */
 
@@ -415,7 +852,7 @@ static int do_dump(const json_t *json, size_t flags, int depth, hashtable_t *par
                 }
             }
 
-            hashtable_del(parents, loop_key, loop_key_len);
+            jsonp_loop_leave(parents);
             return embed ? 0 : dump("}", 1, data);
         }
 
@@ -425,75 +862,1294 @@ static int do_dump(const json_t *json, size_t flags, int depth, hashtable_t *par
     }
 }
 
-char *json_dumps(const json_t *json, size_t flags) {
-    strbuffer_t strbuff;
-    char *result;
+/* Length of the output of dump_indent() */
+static size_t indent_size(size_t flags, int depth, int space) {
+    if (FLAGS_TO_INDENT(flags) > 0)
+        return 1 + (size_t)depth * FLAGS_TO_INDENT(flags);
+    return space && !(flags & JSON_COMPACT);
+}
 
-    if (strbuffer_init(&strbuff))
-        return NULL;
+static size_t integer_size(json_int_t value) {
+    uint64_t n = value < 0 ? 0 - (uint64_t)value : (uint64_t)value;
+    size_t size = value < 0 ? 2 : 1;
 
-    if (json_dump_callback(json, dump_to_strbuffer, (void *)&strbuff, flags))
-        result = NULL;
-    else {
-        char *new_result;
-        result = strbuffer_steal_value(&strbuff);
-        // technically the resizing is not needed.
-        new_result = jsonp_realloc(result, strbuff.size, strbuff.length + 1);
-        if (new_result) { // when realloc fails we just use the original pointer
-            result = new_result;
-        }
+    while (n >= 10000) {
+        n /= 10000;
+        size += 4;
     }
-
-    strbuffer_close(&strbuff);
-    return result;
+    return size + (n >= 10) + (n >= 100) + (n >= 1000);
 }
 
-size_t json_dumpb(const json_t *json, char *buffer, size_t size, size_t flags) {
-    struct buffer buf = {size, 0, buffer};
+/* Add the length of the output of dump_string() to *size */
+static int string_size(const char *str, size_t len, size_t flags, size_t *size) {
+    const char *pos = str, *lim = str + len;
 
-    if (json_dump_callback(json, dump_to_buffer, (void *)&buf, flags))
-        return 0;
+    *size += 2 + len;
 
-    return buf.used;
-}
+    while (1) {
+        const char *end;
+        char seq[12];
+        int length;
 
-int json_dumpf(const json_t *json, FILE *output, size_t flags) {
-    return json_dump_callback(json, dump_to_file, (void *)output, flags);
-}
+        pos = find_escape(pos, lim, flags);
+        if (!pos)
+            return -1;
 
-int json_dumpfd(const json_t *json, int output, size_t flags) {
-    return json_dump_callback(json, dump_to_fd, (void *)&output, flags);
+        if (pos == lim)
+            return 0;
+
+        end = escape_char(pos, lim, seq, &length);
+        *size += (size_t)length - (size_t)(end - pos);
+        pos = end;
+    }
 }
 
-int json_dump_file(const json_t *json, const char *path, size_t flags) {
-    int result;
+/* Add the length of the output of do_dump() to *size. Only reals are
+   formatted to find out their length. */
+static int do_size(const json_t *json, size_t flags, int depth, loop_check_t *parents,
+                   size_t *size) {
+    int embed = flags & JSON_EMBED;
 
-    FILE *output = fopen(path, "w");
-    if (!output)
-        return -1;
+    flags &= ~JSON_EMBED;
 
-    result = json_dumpf(json, output, flags);
+    if (!json)
+        return -1;
 
-    if (fclose(output) != 0)
+    if (depth >= JSON_PARSER_MAX_DEPTH)
         return -1;
 
-    return result;
-}
+    switch (json_typeof(json)) {
+        case JSON_NULL:
+        case JSON_TRUE:
+            *size += 4;
+            return 0;
 
-int json_dump_callback(const json_t *json, json_dump_callback_t callback, void *data,
-                       size_t flags) {
+        case JSON_FALSE:
+            *size += 5;
+            return 0;
+
+        case JSON_INTEGER:
+            *size += integer_size(json_integer_value(json));
+            return 0;
+
+        case JSON_REAL: {
+            char buffer[MAX_REAL_STR_LENGTH];
+            int length;
+
+            length = jsonp_dtostr(buffer, MAX_REAL_STR_LENGTH, json_real_value(json),
+                                  FLAGS_TO_PRECISION(flags));
+            if (length < 0)
+                return -1;
+
+            *size += (size_t)length;
+            return 0;
+        }
+
+        case JSON_RAW:
+            *size += json_raw_length(json);
+            return 0;
+
+        case JSON_STRING:
+            return string_size(json_string_value(json), json_string_length(json), flags,
+                               size);
+
+        case JSON_ARRAY: {
+            size_t i, n = json_array_size(json);
+
+            if (jsonp_loop_check(parents, json))
+                return -1;
+
+            if (!embed)
+                *size += 2;
+
+            if (n > 0) {
+                *size += indent_size(flags, depth + 1, 0) + indent_size(flags, depth, 0) +
+                         (n - 1) * (1 + indent_size(flags, depth + 1, 1));
+
+                for (i = 0; i < n; i++) {
+                    if (do_size(json_array_get(json, i), flags, depth + 1, parents, size))
+                        return -1;
+                }
+            }
+
+            jsonp_loop_leave(parents);
+            return 0;
+        }
+
+        case JSON_OBJECT: {
+            size_t n = json_object_size(json);
+            void *iter;
+
+            if (jsonp_loop_check(parents, json))
+                return -1;
+
+            if (!embed)
+                *size += 2;
+
+            /* the order of the keys doesn't matter */
+            if (n > 0) {
+                *size += indent_size(flags, depth + 1, 0) + indent_size(flags, depth, 0) +
+                         (n - 1) * (1 + indent_size(flags, depth + 1, 1)) +
+                         n * (flags & JSON_COMPACT ? 1 : 2);
+
+                iter = json_object_iter((json_t *)json);
+                while (iter) {
+                    if (string_size(json_object_iter_key(iter),
+                                    json_object_iter_key_len(iter), flags, size) ||
+                        do_size(json_object_iter_value(iter), flags, depth + 1, parents,
+                                size))
+                        return -1;
+
+                    iter = json_object_iter_next((json_t *)json, iter);
+                }
+            }
+
+            jsonp_loop_leave(parents);
+            return 0;
+        }
+
+        default:
+            /* not reached */
+            return -1;
+    }
+}
+
+char *json_dumps(const json_t *json, size_t flags) {
+    strbuffer_t strbuff;
+    char *result;
+
+    if (strbuffer_init(&strbuff))
+        return NULL;
+
+    if (json_dump_callback(json, dump_to_strbuffer, (void *)&strbuff, flags))
+        result = NULL;
+    else {
+        char *new_result;
+        result = strbuffer_steal_value(&strbuff);
+        // technically the resizing is not needed.
+        new_result = jsonp_realloc(result, strbuff.size, strbuff.length + 1);
+        if (new_result) { // when realloc fails we just use the original pointer
+            result = new_result;
+        }
+    }
+
+    strbuffer_close(&strbuff);
+    return result;
+}
+
+size_t json_dump_size(const json_t *json, size_t flags) {
+    size_t size = 0;
+    int res;
+    loop_check_t parents;
+
+    if (!(flags & JSON_ENCODE_ANY)) {
+        if (!json_is_array(json) && !json_is_object(json))
+            return 0;
+    }
+
+    jsonp_loop_init(&parents);
+    res = do_size(json, flags, 0, &parents, &size);
+    jsonp_loop_close(&parents);
+
+    return res ? 0 : size;
+}
+
+size_t json_dumpb(const json_t *json, char *buffer, size_t size, size_t flags) {
+    struct buffer buf = {size, 0, buffer};
+
+    /* only the size is wanted */
+    if (size == 0)
+        return json_dump_size(json, flags);
+
+    if (json_dump_callback(json, dump_to_buffer, (void *)&buf, flags))
+        return 0;
+
+    return buf.used;
+}
+
+int json_dumpf(const json_t *json, FILE *output, size_t flags) {
+    return json_dump_callback(json, dump_to_file, (void *)output, flags);
+}
+
+int json_dumpfd(const json_t *json, int output, size_t flags) {
+#ifdef DUMP_WRITEV
+    struct gather gather;
+    loop_check_t parents;
     int res;
-    hashtable_t parents_set;
 
     if (!(flags & JSON_ENCODE_ANY)) {
         if (!json_is_array(json) && !json_is_object(json))
             return -1;
     }
 
-    if (hashtable_init(&parents_set))
+    gather.fd = output;
+    gather.count = 0;
+    gather.pending = 0;
+    gather.used = 0;
+
+    jsonp_loop_init(&parents);
+    res = do_dump(json, flags, 0, &parents, dump_to_gather, &gather);
+    jsonp_loop_close(&parents);
+
+    return res ? -1 : gather_flush(&gather);
+#else
+    return json_dump_callback(json, dump_to_fd, (void *)&output, flags);
+#endif
+}
+
+int json_dump_file(const json_t *json, const char *path, size_t flags) {
+    int result;
+
+    FILE *output = fopen(path, "w");
+    if (!output)
+        return -1;
+
+    result = json_dumpf(json, output, flags);
+
+    if (fclose(output) != 0)
         return -1;
-    res = do_dump(json, flags, 0, &parents_set, callback, data);
-    hashtable_close(&parents_set);
+
+    return result;
+}
+
+int json_dump_callback(const json_t *json, json_dump_callback_t callback, void *data,
+                       size_t flags) {
+    int res;
+    loop_check_t parents;
+
+    if (!(flags & JSON_ENCODE_ANY)) {
+        if (!json_is_array(json) && !json_is_object(json))
+            return -1;
+    }
+
+    jsonp_loop_init(&parents);
+    if (callback == dump_to_buffer || callback == dump_to_strbuffer) {
+        /* these already collect the output in memory, staging would
+           only add a copy */
+        res = do_dump(json, flags, 0, &parents, callback, data);
+    } else {
+        struct stage stage;
+
+        stage.dump = callback;
+        stage.data = data;
+        stage.used = 0;
+        stage.length = 0;
+        res = do_dump(json, flags, 0, &parents, dump_to_stage, &stage);
+        if (!res && stage.used)
+            res = callback(stage.buffer, stage.used, data);
+    }
+    jsonp_loop_close(&parents);
 
     return res;
 }
+
+/*** parallel encoding ***/
+
+/* The elements of the top level array or object are dumped in chunks
+   of at most this many elements */
+#ifndef DUMP_CHUNK_ITEMS
+#define DUMP_CHUNK_ITEMS 1024
+#endif
+
+typedef struct {
+    size_t start; /* first element */
+    size_t end;   /* one past the last element */
+    strbuffer_t output;
+    int failed;
+    int ready;
+} dump_chunk_t;
+
+typedef struct {
+    const json_t *json;
+    size_t flags;
+    int embed;
+    void **iters;         /* elements of an object in output order, or NULL */
+    size_t size;          /* number of elements */
+    size_t chunk_items;   /* number of elements in a chunk */
+    size_t count;         /* number of chunks */
+    size_t taken;         /* number of chunks taken for dumping */
+    size_t delivered;     /* number of chunks passed to the callback */
+    dump_chunk_t *chunks; /* ring of chunks taken but not delivered */
+    size_t window;        /* number of entries in chunks */
+    int stop;
+#ifdef DUMP_THREADS
+    pthread_mutex_t mutex;
+    pthread_cond_t cond; /* signaled when any of the above changes */
+#endif
+} parallel_t;
+
+/* Take the next chunk for dumping. With threads, the mutex must be
+   held. */
+static dump_chunk_t *parallel_take(parallel_t *parallel) {
+    dump_chunk_t *chunk = &parallel->chunks[parallel->taken % parallel->window];
+
+    chunk->start = parallel->taken * parallel->chunk_items;
+    chunk->end = chunk->start + parallel->chunk_items;
+    if (chunk->end > parallel->size)
+        chunk->end = parallel->size;
+    chunk->failed = 0;
+    chunk->ready = 0;
+
+    parallel->taken++;
+    return chunk;
+}
+
+/* Dump a range of elements, with the same brackets, separators and
+   indentation that do_dump() writes around them */
+static void parallel_dump(parallel_t *parallel, dump_chunk_t *chunk) {
+    const json_t *json = parallel->json;
+    size_t flags = parallel->flags, i;
+    const char *separator = flags & JSON_COMPACT ? ":" : ": ";
+    json_dump_callback_t dump = dump_to_strbuffer;
+    void *data = &chunk->output;
+    loop_check_t parents;
+    int res = 0;
+
+    if (strbuffer_init(&chunk->output)) {
+        chunk->failed = 1;
+        return;
+    }
+
+    /* the other chunks are inside the same container */
+    jsonp_loop_init(&parents);
+    if (jsonp_loop_check(&parents, json))
+        res = -1;
+
+    for (i = chunk->start; i < chunk->end && !res; i++) {
+        if (i == 0) {
+            if (!parallel->embed)
+                res = dump(json_is_array(json) ? "[" : "{", 1, data);
+            res = res || dump_indent(flags, 1, 0, dump, data);
+        } else {
+            res = dump(",", 1, data) || dump_indent(flags, 1, 1, dump, data);
+        }
+
+        if (res)
+            break;
+
+        if (parallel->iters) {
+            void *iter = parallel->iters[i];
+            res = dump_string(json_object_iter_key(iter), json_object_iter_key_len(iter),
+                              dump, data, flags) ||
+                  dump(separator, strlen(separator), data) ||
+                  do_dump(json_object_iter_value(iter), flags, 1, &parents, dump, data);
+        } else {
+            res = do_dump(json_array_get(json, i), flags, 1, &parents, dump, data);
+        }
+    }
+
+    if (!res && chunk->end == parallel->size) {
+        res = dump_indent(flags, 0, 0, dump, data);
+        if (!res && !parallel->embed)
+            res = dump(json_is_array(json) ? "]" : "}", 1, data);
+    }
+
+    jsonp_loop_close(&parents);
+    chunk->failed = res != 0;
+}
+
+#ifdef DUMP_THREADS
+static void *parallel_worker(void *arg) {
+    parallel_t *parallel = (parallel_t *)arg;
+
+    pthread_mutex_lock(&parallel->mutex);
+    while (!parallel->stop && parallel->taken < parallel->count) {
+        dump_chunk_t *chunk;
+
+        if (parallel->taken - parallel->delivered == parallel->window) {
+            /* Don't dump too far ahead of the callback */
+            pthread_cond_wait(&parallel->cond, &parallel->mutex);
+            continue;
+        }
+
+        chunk = parallel_take(parallel);
+        pthread_mutex_unlock(&parallel->mutex);
+
+        parallel_dump(parallel, chunk);
+
+        pthread_mutex_lock(&parallel->mutex);
+        chunk->ready = 1;
+        pthread_cond_broadcast(&parallel->cond);
+    }
+    pthread_mutex_unlock(&parallel->mutex);
+    return NULL;
+}
+#endif
+
+/* Collect the elements of an object in output order */
+static void **parallel_iters(const json_t *json, size_t flags) {
+    void **iters = jsonp_malloc(json_object_size(json) * sizeof(void *));
+    size_t i;
+
+    if (!iters)
+        return NULL;
+
+    if (flags & JSON_SORT_KEYS) {
+        struct hashtable_pair **pairs = sorted_pairs(json);
+        if (!pairs) {
+            jsonp_free(iters);
+            return NULL;
+        }
+        for (i = 0; i < json_object_size(json); i++)
+            iters[i] = json_object_key_to_iter(pairs[i]->key);
+    } else {
+        void *iter = json_object_iter((json_t *)json);
+        for (i = 0; iter; i++) {
+            iters[i] = iter;
+            iter = json_object_iter_next((json_t *)json, iter);
+        }
+    }
+    return iters;
+}
+
+int json_dump_callback_parallel(const json_t *json, json_dump_callback_t callback,
+                                void *data, size_t flags, size_t threads) {
+    parallel_t work;
+    size_t i;
+    int failed = 0;
+#ifdef DUMP_THREADS
+    pthread_t *workers = NULL;
+    size_t started = 0;
+#endif
+
+    if (!callback)
+        return -1;
+
+    if (threads == 0)
+        threads = jsonp_cpu_count();
+
+    work.size = json_is_array(json)    ? json_array_size(json)
+                : json_is_object(json) ? json_object_size(json)
+                                       : 0;
+    if (threads > work.size)
+        threads = work.size;
+
+#ifndef DUMP_THREADS
+    threads = 1;
+#endif
+    if (threads <= 1)
+        return json_dump_callback(json, callback, data, flags);
+
+    /* Several chunks per thread spread the work evenly, but the chunks
+       are kept small enough not to take much memory */
+    work.chunk_items = work.size / (threads * 8);
+    if (work.chunk_items > DUMP_CHUNK_ITEMS)
+        work.chunk_items = DUMP_CHUNK_ITEMS;
+    if (work.chunk_items == 0)
+        work.chunk_items = 1;
+    work.count = (work.size + work.chunk_items - 1) / work.chunk_items;
+
+    work.json = json;
+    work.flags = flags & ~JSON_EMBED;
+    work.embed = (flags & JSON_EMBED) != 0;
+    work.iters = NULL;
+    work.taken = 0;
+    work.delivered = 0;
+    work.window = 2 * threads;
+    work.stop = 0;
+
+    if (json_is_object(json)) {
+        work.iters = parallel_iters(json, flags);
+        if (!work.iters)
+            return -1;
+    }
+
+    work.chunks = jsonp_malloc(work.window * sizeof(dump_chunk_t));
+    if (!work.chunks) {
+        jsonp_free(work.iters);
+        return -1;
+    }
+
+#ifdef DUMP_THREADS
+    workers = jsonp_malloc(threads * sizeof(pthread_t));
+    if (workers && pthread_mutex_init(&work.mutex, NULL) == 0) {
+        if (pthread_cond_init(&work.cond, NULL) == 0) {
+            while (started < threads &&
+                   pthread_create(&workers[started], NULL, parallel_worker, &work) == 0)
+                started++;
+            if (!started)
+                pthread_cond_destroy(&work.cond);
+        }
+        if (!started)
+            pthread_mutex_destroy(&work.mutex);
+    }
+#define parallel_lock()   (started ? (void)pthread_mutex_lock(&work.mutex) : (void)0)
+#define parallel_unlock() (started ? (void)pthread_mutex_unlock(&work.mutex) : (void)0)
+#define parallel_wait()   (void)pthread_cond_wait(&work.cond, &work.mutex)
+#define parallel_wake()   (started ? (void)pthread_cond_broadcast(&work.cond) : (void)0)
+#define parallel_workers  started
+#else
+#define parallel_lock()   (void)0
+#define parallel_unlock() (void)0
+#define parallel_wait()   (void)0
+#define parallel_wake()   (void)0
+#define parallel_workers  0
+#endif
+
+    /* Pass the chunks to callback in order. Without worker threads,
+       dump them here. */
+    parallel_lock();
+    while (work.delivered < work.count) {
+        dump_chunk_t *chunk;
+
+        if (work.delivered == work.taken && !parallel_workers) {
+            chunk = parallel_take(&work);
+            parallel_dump(&work, chunk);
+            chunk->ready = 1;
+        }
+
+        chunk = &work.chunks[work.delivered % work.window];
+        if (work.delivered == work.taken || !chunk->ready) {
+            parallel_wait();
+            continue;
+        }
+
+        parallel_unlock();
+        failed = chunk->failed ||
+                 callback(chunk->output.value, chunk->output.length, data) != 0;
+        strbuffer_close(&chunk->output);
+        parallel_lock();
+
+        work.delivered++;
+        parallel_wake();
+        if (failed)
+            break;
+    }
+    work.stop = 1;
+    parallel_wake();
+    parallel_unlock();
+
+#ifdef DUMP_THREADS
+    if (started) {
+        for (i = 0; i < started; i++)
+            pthread_join(workers[i], NULL);
+        pthread_cond_destroy(&work.cond);
+        pthread_mutex_destroy(&work.mutex);
+    }
+    jsonp_free(workers);
+#endif
+#undef parallel_lock
+#undef parallel_unlock
+#undef parallel_wait
+#undef parallel_wake
+#undef parallel_workers
+
+    /* Chunks that were dumped after an error */
+    for (i = work.delivered; i < work.taken; i++)
+        strbuffer_close(&work.chunks[i % work.window].output);
+    jsonp_free(work.chunks);
+    jsonp_free(work.iters);
+
+    return failed ? -1 : 0;
+}
+
+/*** resumable encoding ***/
+
+enum {
+    DUMPER_VALUE,   /* dump dumper->value */
+    DUMPER_STRING,  /* continue the string at dumper->pos */
+    DUMPER_KEY,     /* a key was dumped, dump the separator */
+    DUMPER_NEXT,    /* a value was dumped, go to the next one */
+    DUMPER_ELEMENT, /* dump the next element of the innermost container */
+    DUMPER_CLOSE,   /* close the innermost container */
+    DUMPER_DONE,
+    DUMPER_ERROR
+};
+
+/* An array or object that is being dumped */
+struct dumper_frame {
+    const json_t *json;
+    size_t index;                  /* of the next array element or sorted key */
+    size_t size;                   /* of the array, or the number of sorted keys */
+    void *iter;                    /* next item of an object whose keys aren't sorted */
+    struct hashtable_pair **pairs; /* sorted pairs of an object, or NULL */
+};
+
+struct json_dumper {
+    json_t *json;
+    size_t flags;
+    int state;
+    int after_string; /* state after the string being dumped */
+    const json_t *value;
+
+    /* Output that hasn't been written yet: piece_length bytes at piece
+       followed by spaces spaces */
+    const char *piece;
+    size_t piece_length;
+    size_t spaces;
+
+    /* rest of the string being dumped */
+    const char *pos;
+    const char *lim;
+
+    /* containers being dumped, innermost last */
+    struct dumper_frame *stack;
+    size_t depth;
+    size_t stack_size;
+
+    char scratch[MAX_REAL_STR_LENGTH];
+};
+
+static void dumper_set_piece(json_dumper_t *dumper, const char *piece, size_t length) {
+    dumper->piece = piece;
+    dumper->piece_length = length;
+}
+
+static void dumper_start_string(json_dumper_t *dumper, const char *str, size_t len,
+                                int after_string) {
+    dumper_set_piece(dumper, "\"", 1);
+    dumper->pos = str;
+    dumper->lim = str + len;
+    dumper->after_string = after_string;
+    dumper->state = DUMPER_STRING;
+}
+
+static int dumper_push(json_dumper_t *dumper, const json_t *json, size_t flags) {
+    struct dumper_frame *frame;
+    size_t i, length = 0;
+
+    /* detect circular references */
+    for (i = 0; i < dumper->depth; i++) {
+        if (dumper->stack[i].json == json)
+            return -1;
+    }
+
+    if (dumper->depth == dumper->stack_size) {
+        size_t new_size = dumper->stack_size * 2;
+        struct dumper_frame *new_stack =
+            jsonp_realloc(dumper->stack, dumper->stack_size * sizeof(struct dumper_frame),
+                          new_size * sizeof(struct dumper_frame));
+        if (!new_stack)
+            return -1;
+
+        dumper->stack = new_stack;
+        dumper->stack_size = new_size;
+    }
+
+    frame = &dumper->stack[dumper->depth++];
+    frame->json = json;
+    frame->index = 0;
+    frame->iter = NULL;
+    frame->pairs = NULL;
+
+    if (json_is_array(json)) {
+        frame->size = json_array_size(json);
+    } else {
+        frame->size = json_object_size(json);
+        if (flags & JSON_SORT_KEYS) {
+            frame->pairs = sorted_pairs(json);
+            if (!frame->pairs)
+                return -1;
+        } else {
+            frame->iter = json_object_iter((json_t *)json);
+        }
+    }
+
+    /* the opening bracket and the indentation of the first item */
+    if (!(dumper->depth == 1 && (dumper->flags & JSON_EMBED)))
+        dumper->scratch[length++] = json_is_array(json) ? '[' : '{';
+
+    if (frame->size == 0) {
+        dumper->state = DUMPER_CLOSE;
+    } else {
+        if (FLAGS_TO_INDENT(flags) > 0) {
+            dumper->scratch[length++] = '\n';
+            dumper->spaces = dumper->depth * FLAGS_TO_INDENT(flags);
+        }
+        dumper->state = DUMPER_ELEMENT;
+    }
+
+    dumper_set_piece(dumper, dumper->scratch, length);
+    return 0;
+}
+
+static int dumper_value(json_dumper_t *dumper, size_t flags) {
+    const json_t *json = dumper->value;
+
+    if (!json || dumper->depth >= JSON_PARSER_MAX_DEPTH)
+        return -1;
+
+    dumper->state = DUMPER_NEXT;
+
+    switch (json_typeof(json)) {
+        case JSON_NULL:
+            dumper_set_piece(dumper, "null", 4);
+            return 0;
+
+        case JSON_TRUE:
+            dumper_set_piece(dumper, "true", 4);
+            return 0;
+
+        case JSON_FALSE:
+            dumper_set_piece(dumper, "false", 5);
+            return 0;
+
+        case JSON_INTEGER:
+            dumper_set_piece(dumper, dumper->scratch,
+                             jsonp_inttostr(dumper->scratch, json_integer_value(json)));
+            return 0;
+
+        case JSON_REAL: {
+            int size = jsonp_dtostr(dumper->scratch, MAX_REAL_STR_LENGTH,
+                                    json_real_value(json), FLAGS_TO_PRECISION(flags));
+            if (size < 0)
+                return -1;
+
+            dumper_set_piece(dumper, dumper->scratch, size);
+            return 0;
+        }
+
+        case JSON_STRING:
+            dumper_start_string(dumper, json_string_value(json), json_string_length(json),
+                                DUMPER_NEXT);
+            return 0;
+
+        case JSON_RAW:
+            dumper_set_piece(dumper, json_raw_value(json), json_raw_length(json));
+            return 0;
+
+        case JSON_ARRAY:
+        case JSON_OBJECT:
+            return dumper_push(dumper, json, flags);
+
+        default:
+            /* not reached */
+            return -1;
+    }
+}
+
+static int dumper_string(json_dumper_t *dumper, size_t flags) {
+    const char *pos;
+    int length;
+
+    if (dumper->pos == dumper->lim) {
+        dumper_set_piece(dumper, "\"", 1);
+        dumper->state = dumper->after_string;
+        return 0;
+    }
+
+    pos = find_escape(dumper->pos, dumper->lim, flags);
+    if (!pos)
+        return -1;
+
+    if (pos != dumper->pos) {
+        /* written straight from the string */
+        dumper_set_piece(dumper, dumper->pos, pos - dumper->pos);
+        dumper->pos = pos;
+        return 0;
+    }
+
+    dumper->pos = escape_char(pos, dumper->lim, dumper->scratch, &length);
+    dumper_set_piece(dumper, dumper->scratch, length);
+    return 0;
+}
+
+static void dumper_element(json_dumper_t *dumper, struct dumper_frame *frame) {
+    const char *key;
+    size_t key_len;
+
+    if (json_is_array(frame->json)) {
+        dumper->value = json_array_get(frame->json, frame->index++);
+        dumper->state = DUMPER_VALUE;
+        return;
+    }
+
+    if (frame->pairs) {
+        const struct hashtable_pair *pair = frame->pairs[frame->index++];
+        key = pair->key;
+        key_len = pair->key_len;
+        dumper->value = pair->value;
+    } else {
+        key = json_object_iter_key(frame->iter);
+        key_len = json_object_iter_key_len(frame->iter);
+        dumper->value = json_object_iter_value(frame->iter);
+        frame->iter = json_object_iter_next((json_t *)frame->json, frame->iter);
+    }
+
+    dumper_start_string(dumper, key, key_len, DUMPER_KEY);
+}
+
+/* Set the next piece of output */
+static int dumper_step(json_dumper_t *dumper) {
+    size_t flags = dumper->flags & ~JSON_EMBED;
+    struct dumper_frame *frame = dumper->depth ? &dumper->stack[dumper->depth - 1] : NULL;
+    size_t length = 0;
+
+    switch (dumper->state) {
+        case DUMPER_VALUE:
+            return dumper_value(dumper, flags);
+
+        case DUMPER_STRING:
+            return dumper_string(dumper, flags);
+
+        case DUMPER_KEY:
+            if (flags & JSON_COMPACT)
+                dumper_set_piece(dumper, ":", 1);
+            else
+                dumper_set_piece(dumper, ": ", 2);
+            dumper->state = DUMPER_VALUE;
+            return 0;
+
+        case DUMPER_NEXT:
+            if (!frame) {
+                dumper->state = DUMPER_DONE;
+                return 0;
+            }
+
+            if ((frame->pairs || json_is_array(frame->json)) ? frame->index < frame->size
+                                                            : frame->iter != NULL) {
+                /* separator and the indentation of the next item */
+                dumper->scratch[length++] = ',';
+                if (FLAGS_TO_INDENT(flags) > 0) {
+                    dumper->scratch[length++] = '\n';
+                    dumper->spaces = dumper->depth * FLAGS_TO_INDENT(flags);
+                } else if (!(flags & JSON_COMPACT)) {
+                    dumper->scratch[length++] = ' ';
+                }
+                dumper->state = DUMPER_ELEMENT;
+            } else {
+                /* indentation of the closing bracket */
+                if (FLAGS_TO_INDENT(flags) > 0) {
+                    dumper->scratch[length++] = '\n';
+                    dumper->spaces = (dumper->depth - 1) * FLAGS_TO_INDENT(flags);
+                }
+                dumper->state = DUMPER_CLOSE;
+            }
+            dumper_set_piece(dumper, dumper->scratch, length);
+            return 0;
+
+        case DUMPER_ELEMENT:
+            dumper_element(dumper, frame);
+            return 0;
+
+        case DUMPER_CLOSE:
+            if (!(dumper->depth == 1 && (dumper->flags & JSON_EMBED)))
+                dumper_set_piece(dumper, json_is_array(frame->json) ? "]" : "}", 1);
+
+            dumper->depth--;
+            dumper->state = DUMPER_NEXT;
+            return 0;
+
+        default:
+            return -1;
+    }
+}
+
+json_dumper_t *json_dumper_new(const json_t *json, size_t flags) {
+    json_dumper_t *dumper;
+
+    if (!json)
+        return NULL;
+
+    if (!(flags & JSON_ENCODE_ANY)) {
+        if (!json_is_array(json) && !json_is_object(json))
+            return NULL;
+    }
+
+    dumper = jsonp_malloc(sizeof(json_dumper_t));
+    if (!dumper)
+        return NULL;
+
+    dumper->stack_size = 8;
+    dumper->stack = jsonp_malloc(dumper->stack_size * sizeof(struct dumper_frame));
+    if (!dumper->stack) {
+        jsonp_free(dumper);
+        return NULL;
+    }
+
+    dumper->json = json_incref((json_t *)json);
+    dumper->flags = flags;
+    dumper->state = DUMPER_VALUE;
+    dumper->value = json;
+    dumper->piece_length = 0;
+    dumper->spaces = 0;
+    dumper->depth = 0;
+    return dumper;
+}
+
+size_t json_dumper_next(json_dumper_t *dumper, char *buffer, size_t size) {
+    size_t used = 0;
+
+    if (!dumper || !buffer || !size)
+        return (size_t)-1;
+
+    while (used < size) {
+        size_t length;
+
+        if (dumper->piece_length == 0) {
+            if (dumper->spaces > 0) {
+                length = dumper->spaces < sizeof(whitespace) - 1 ? dumper->spaces
+                                                                 : sizeof(whitespace) - 1;
+                dumper_set_piece(dumper, whitespace, length);
+                dumper->spaces -= length;
+                continue;
+            }
+
+            if (dumper->state == DUMPER_DONE)
+                break;
+
+            if (dumper_step(dumper)) {
+                dumper->state = DUMPER_ERROR;
+                return (size_t)-1;
+            }
+            continue;
+        }
+
+        length = size - used < dumper->piece_length ? size - used : dumper->piece_length;
+        memcpy(buffer + used, dumper->piece, length);
+        dumper->piece += length;
+        dumper->piece_length -= length;
+        used += length;
+    }
+
+    return used;
+}
+
+void json_dumper_free(json_dumper_t *dumper) {
+    if (!dumper)
+        return;
+
+    jsonp_free(dumper->stack);
+    json_decref(dumper->json);
+    jsonp_free(dumper);
+}
+
+/*** streaming writer ***/
+
+/* State of an open container */
+#define WRITER_OBJECT 0x1 /* an object, not an array */
+#define WRITER_ITEMS  0x2 /* has items */
+#define WRITER_KEY    0x4 /* a key has been written, its value hasn't */
+
+struct json_writer {
+    size_t flags;
+    int error;
+    json_dump_callback_t dump;
+    void *data;
+
+    /* containers that are open, innermost last */
+    unsigned char *stack;
+    size_t depth;
+    size_t stack_size;
+
+    size_t values; /* top level values started */
+
+    struct buffer buffer; /* for json_writer_newb() */
+    int fd;               /* for json_writer_newfd() */
+    struct stage stage;   /* for the other sinks */
+};
+
+static json_writer_t *writer_new(size_t flags) {
+    json_writer_t *writer = jsonp_malloc(sizeof(json_writer_t));
+    if (!writer)
+        return NULL;
+
+    writer->stack_size = 8;
+    writer->stack = jsonp_malloc(writer->stack_size);
+    if (!writer->stack) {
+        jsonp_free(writer);
+        return NULL;
+    }
+
+    writer->flags = flags & ~JSON_EMBED;
+    writer->error = 0;
+    writer->depth = 0;
+    writer->values = 0;
+    return writer;
+}
+
+static json_writer_t *writer_new_staged(json_dump_callback_t callback, void *data,
+                                        size_t flags) {
+    json_writer_t *writer = writer_new(flags);
+    if (!writer)
+        return NULL;
+
+    writer->stage.dump = callback;
+    writer->stage.data = data;
+    writer->stage.used = 0;
+    writer->stage.length = 0;
+    writer->dump = dump_to_stage;
+    writer->data = &writer->stage;
+    return writer;
+}
+
+json_writer_t *json_writer_new_callback(json_dump_callback_t callback, void *data,
+                                        size_t flags) {
+    if (!callback)
+        return NULL;
+
+    return writer_new_staged(callback, data, flags);
+}
+
+json_writer_t *json_writer_newb(char *buffer, size_t size, size_t flags) {
+    json_writer_t *writer;
+
+    if (!buffer && size)
+        return NULL;
+
+    writer = writer_new(flags);
+    if (!writer)
+        return NULL;
+
+    writer->buffer.size = size;
+    writer->buffer.used = 0;
+    writer->buffer.data = buffer;
+    writer->dump = dump_to_buffer;
+    writer->data = &writer->buffer;
+    return writer;
+}
+
+json_writer_t *json_writer_newf(FILE *output, size_t flags) {
+    if (!output)
+        return NULL;
+
+    return writer_new_staged(dump_to_file, (void *)output, flags);
+}
+
+json_writer_t *json_writer_newfd(int output, size_t flags) {
+    json_writer_t *writer;
+
+    if (output < 0)
+        return NULL;
+
+    writer = writer_new_staged(dump_to_fd, NULL, flags);
+    if (!writer)
+        return NULL;
+
+    writer->fd = output;
+    writer->stage.data = &writer->fd;
+    return writer;
+}
+
+/* Write what goes before a value, and check that a value may be
+   written here */
+static int writer_begin_value(json_writer_t *writer, int container) {
+    unsigned char *state;
+
+    if (!writer || writer->error)
+        return -1;
+
+    if (writer->depth == 0) {
+        if (!container && !(writer->flags & JSON_ENCODE_ANY))
+            return -1;
+
+        /* several top level values are written one per line */
+        if (writer->values++ > 0)
+            return writer->dump("\n", 1, writer->data);
+        return 0;
+    }
+
+    state = &writer->stack[writer->depth - 1];
+    if (*state & WRITER_OBJECT) {
+        if (!(*state & WRITER_KEY))
+            return -1;
+        *state &= ~WRITER_KEY;
+        return 0;
+    }
+
+    if (*state & WRITER_ITEMS)
+        return writer->dump(",", 1, writer->data) ||
+               dump_indent(writer->flags, writer->depth, 1, writer->dump, writer->data);
+
+    *state |= WRITER_ITEMS;
+    return dump_indent(writer->flags, writer->depth, 0, writer->dump, writer->data);
+}
+
+/* Most functions write with this. After any error, the writer stays
+   failed. */
+#define writer_check(writer_, result_)                                                   \
+    do {                                                                                 \
+        if (result_) {                                                                   \
+            if (writer_)                                                                 \
+                (writer_)->error = 1;                                                    \
+            return -1;                                                                   \
+        }                                                                                \
+    } while (0)
+
+static int writer_begin(json_writer_t *writer, unsigned char state, const char *bracket) {
+    writer_check(writer, writer_begin_value(writer, 1));
+    writer_check(writer, writer->depth >= JSON_PARSER_MAX_DEPTH);
+
+    if (writer->depth == writer->stack_size) {
+        size_t new_size = writer->stack_size * 2;
+        unsigned char *new_stack =
+            jsonp_realloc(writer->stack, writer->stack_size, new_size);
+        writer_check(writer, !new_stack);
+
+        writer->stack = new_stack;
+        writer->stack_size = new_size;
+    }
+
+    writer->stack[writer->depth++] = state;
+    writer_check(writer, writer->dump(bracket, 1, writer->data));
+    return 0;
+}
+
+static int writer_end(json_writer_t *writer, unsigned char object, const char *bracket) {
+    unsigned char state;
+
+    writer_check(writer, !writer || writer->error || writer->depth == 0);
+
+    state = writer->stack[writer->depth - 1];
+    writer_check(writer, (state & WRITER_OBJECT) != object || (state & WRITER_KEY));
+
+    writer->depth--;
+    if (state & WRITER_ITEMS)
+        writer_check(writer, dump_indent(writer->flags, writer->depth, 0, writer->dump,
+                                         writer->data));
+    writer_check(writer, writer->dump(bracket, 1, writer->data));
+    return 0;
+}
+
+int json_writer_begin_object(json_writer_t *writer) {
+    return writer_begin(writer, WRITER_OBJECT, "{");
+}
+
+int json_writer_end_object(json_writer_t *writer) {
+    return writer_end(writer, WRITER_OBJECT, "}");
+}
+
+int json_writer_begin_array(json_writer_t *writer) {
+    return writer_begin(writer, 0, "[");
+}
+
+int json_writer_end_array(json_writer_t *writer) { return writer_end(writer, 0, "]"); }
+
+int json_writer_key(json_writer_t *writer, const char *key) {
+    writer_check(writer, !key);
+    return json_writer_keyn(writer, key, strlen(key));
+}
+
+int json_writer_keyn(json_writer_t *writer, const char *key, size_t len) {
+    unsigned char *state;
+
+    writer_check(writer, !writer || writer->error || !key || writer->depth == 0);
+
+    state = &writer->stack[writer->depth - 1];
+    writer_check(writer, !(*state & WRITER_OBJECT) || (*state & WRITER_KEY));
+
+    if (*state & WRITER_ITEMS)
+        writer_check(writer, writer->dump(",", 1, writer->data) ||
+                                 dump_indent(writer->flags, writer->depth, 1,
+                                             writer->dump, writer->data));
+    else
+        writer_check(writer, dump_indent(writer->flags, writer->depth, 0, writer->dump,
+                                         writer->data));
+    *state |= WRITER_ITEMS | WRITER_KEY;
+
+    writer_check(writer,
+                 dump_string(key, len, writer->dump, writer->data, writer->flags));
+    if (writer->flags & JSON_COMPACT)
+        writer_check(writer, writer->dump(":", 1, writer->data));
+    else
+        writer_check(writer, writer->dump(": ", 2, writer->data));
+    return 0;
+}
+
+int json_writer_string(json_writer_t *writer, const char *value) {
+    writer_check(writer, !value);
+    return json_writer_stringn(writer, value, strlen(value));
+}
+
+int json_writer_stringn(json_writer_t *writer, const char *value, size_t len) {
+    writer_check(writer, !value);
+    writer_check(writer, writer_begin_value(writer, 0));
+    writer_check(writer,
+                 dump_string(value, len, writer->dump, writer->data, writer->flags));
+    return 0;
+}
+
+int json_writer_integer(json_writer_t *writer, json_int_t value) {
+    char buffer[JSONP_MAX_INTEGER_LENGTH];
+    int size;
+
+    writer_check(writer, writer_begin_value(writer, 0));
+
+    size = jsonp_inttostr(buffer, value);
+    writer_check(writer, writer->dump(buffer, size, writer->data));
+    return 0;
+}
+
+int json_writer_real(json_writer_t *writer, double value) {
+    char buffer[MAX_REAL_STR_LENGTH];
+    int size;
+
+    /* NaN and infinity can't be represented in JSON */
+    writer_check(writer, value - value != 0.0);
+    writer_check(writer, writer_begin_value(writer, 0));
+
+    size = jsonp_dtostr(buffer, MAX_REAL_STR_LENGTH, value,
+                        FLAGS_TO_PRECISION(writer->flags));
+    writer_check(writer, size < 0);
+    writer_check(writer, writer->dump(buffer, size, writer->data));
+    return 0;
+}
+
+int json_writer_boolean(json_writer_t *writer, int value) {
+    writer_check(writer, writer_begin_value(writer, 0));
+    if (value)
+        writer_check(writer, writer->dump("true", 4, writer->data));
+    else
+        writer_check(writer, writer->dump("false", 5, writer->data));
+    return 0;
+}
+
+int json_writer_null(json_writer_t *writer) {
+    writer_check(writer, writer_begin_value(writer, 0));
+    writer_check(writer, writer->dump("null", 4, writer->data));
+    return 0;
+}
+
+int json_writer_value(json_writer_t *writer, const json_t *json) {
+    loop_check_t parents;
+    int res;
+
+    writer_check(writer, !json);
+    writer_check(writer,
+                 writer_begin_value(writer, json_is_array(json) || json_is_object(json)));
+
+    jsonp_loop_init(&parents);
+    res = do_dump(json, writer->flags, (int)writer->depth, &parents, writer->dump,
+                  writer->data);
+    jsonp_loop_close(&parents);
+
+    writer_check(writer, res);
+    return 0;
+}
+
+int json_writer_flush(json_writer_t *writer) {
+    writer_check(writer, !writer || writer->error);
+
+    if (writer->dump == dump_to_stage && writer->stage.used) {
+        writer_check(writer, writer->stage.dump(writer->stage.buffer, writer->stage.used,
+                                                writer->stage.data));
+        writer->stage.used = 0;
+    }
+    return 0;
+}
+
+int json_writer_finish(json_writer_t *writer) {
+    writer_check(writer, !writer || writer->error);
+
+    /* the output must be complete */
+    writer_check(writer, writer->depth > 0 || writer->values == 0);
+
+    return json_writer_flush(writer);
+}
+
+size_t json_writer_length(const json_writer_t *writer) {
+    if (!writer)
+        return 0;
+
+    if (writer->dump == dump_to_buffer)
+        return writer->buffer.used;
+    return writer->stage.length;
+}
+
+void json_writer_free(json_writer_t *writer) {
+    if (!writer)
+        return;
+
+    jsonp_free(writer->stack);
+    jsonp_free(writer);
+}
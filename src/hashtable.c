@@ -54,6 +54,12 @@ static JSON_INLINE void list_remove(list_t *list) {
     list->next->prev = list->prev;
 }
 
+/* The sorted pairs are discarded whenever a key is added or removed */
+static void forget_sorted(hashtable_t *hashtable) {
+    jsonp_free(hashtable->sorted);
+    hashtable->sorted = NULL;
+}
+
 static JSON_INLINE int bucket_is_empty(hashtable_t *hashtable, bucket_t *bucket) {
     return bucket->first == &hashtable->list && bucket->first == bucket->last;
 }
@@ -118,6 +124,7 @@ static int hashtable_do_del(hashtable_t *hashtable, const char *key, size_t key_
     list_remove(&pair->list);
     list_remove(&pair->ordered_list);
     json_decref(pair->value);
+    forget_sorted(hashtable);
 
     jsonp_free(pair);
     hashtable->size--;
@@ -176,6 +183,7 @@ int hashtable_init(hashtable_t *hashtable) {
 
     hashtable->size = 0;
     hashtable->order = INITIAL_HASHTABLE_ORDER;
+    hashtable->sorted = NULL;
     hashtable->buckets = jsonp_malloc(hashsize(hashtable->order) * sizeof(bucket_t));
     if (!hashtable->buckets)
         return -1;
@@ -193,6 +201,7 @@ int hashtable_init(hashtable_t *hashtable) {
 void hashtable_close(hashtable_t *hashtable) {
     hashtable_do_clear(hashtable);
     jsonp_free(hashtable->buckets);
+    jsonp_free(hashtable->sorted);
 }
 
 static pair_t *init_pair(json_t *value, const char *key, size_t key_len, size_t hash) {
@@ -226,6 +235,16 @@ static pair_t *init_pair(json_t *value, const char *key, size_t key_len, size_t
 
 int hashtable_set(hashtable_t *hashtable, const char *key, size_t key_len,
                   json_t *value) {
+    json_t **slot = hashtable_reserve(hashtable, key, key_len);
+    if (!slot)
+        return -1;
+
+    json_decref(*slot);
+    *slot = value;
+    return 0;
+}
+
+json_t **hashtable_reserve(hashtable_t *hashtable, const char *key, size_t key_len) {
     pair_t *pair;
     bucket_t *bucket;
     size_t hash, index;
@@ -233,28 +252,26 @@ int hashtable_set(hashtable_t *hashtable, const char *key, size_t key_len,
     /* rehash if the load ratio exceeds 1 */
     if (hashtable->size >= hashsize(hashtable->order))
         if (hashtable_do_rehash(hashtable))
-            return -1;
+            return NULL;
 
     hash = hash_str(key, key_len);
     index = hash & hashmask(hashtable->order);
     bucket = &hashtable->buckets[index];
     pair = hashtable_find_pair(hashtable, bucket, key, key_len, hash);
 
-    if (pair) {
-        json_decref(pair->value);
-        pair->value = value;
-    } else {
-        pair = init_pair(value, key, key_len, hash);
+    if (!pair) {
+        pair = init_pair(NULL, key, key_len, hash);
 
         if (!pair)
-            return -1;
+            return NULL;
 
         insert_to_bucket(hashtable, bucket, &pair->list);
         list_insert(&hashtable->ordered_list, &pair->ordered_list);
 
         hashtable->size++;
+        forget_sorted(hashtable);
     }
-    return 0;
+    return &pair->value;
 }
 
 void *hashtable_get(hashtable_t *hashtable, const char *key, size_t key_len) {
@@ -289,6 +306,139 @@ void hashtable_clear(hashtable_t *hashtable) {
     list_init(&hashtable->list);
     list_init(&hashtable->ordered_list);
     hashtable->size = 0;
+    forget_sorted(hashtable);
+}
+
+/* Ranges shorter than this are insertion sorted */
+#define SORT_THRESHOLD 16
+
+/* Compares keys whose first depth bytes are known to be equal */
+static int compare_pairs(const pair_t *pair1, const pair_t *pair2, size_t depth) {
+    size_t min_len = pair1->key_len < pair2->key_len ? pair1->key_len : pair2->key_len;
+    int res = memcmp(pair1->key + depth, pair2->key + depth, min_len - depth);
+
+    if (res)
+        return res;
+    return pair1->key_len < pair2->key_len ? -1 : pair1->key_len > pair2->key_len;
+}
+
+/* Radix byte of a key at depth. A key that ends before depth sorts
+   first. */
+#define key_byte(pair_, depth_)                                                          \
+    ((pair_)->key_len > (depth_) ? (unsigned char)(pair_)->key[depth_] + 1 : 0)
+
+/* Sorts n pairs whose keys share their first depth bytes, using tmp as
+   scratch space. MSD radix sort on one byte at a time. Only the smaller
+   buckets are sorted recursively, so the recursion is at most log2(n)
+   deep however long the keys are. */
+static void sort_pairs(pair_t **pairs, pair_t **tmp, size_t n, size_t depth) {
+    size_t count[257], start[257];
+
+    while (n >= SORT_THRESHOLD) {
+        size_t i, largest = 0;
+
+        memset(count, 0, sizeof(count));
+        for (i = 0; i < n; i++)
+            count[key_byte(pairs[i], depth)]++;
+
+        if (count[key_byte(pairs[0], depth)] == n) {
+            /* all keys have the same byte here */
+            depth++;
+            continue;
+        }
+
+        start[0] = 0;
+        for (i = 1; i < 257; i++)
+            start[i] = start[i - 1] + count[i - 1];
+        for (i = 0; i < n; i++)
+            tmp[start[key_byte(pairs[i], depth)]++] = pairs[i];
+        memcpy(pairs, tmp, n * sizeof(pair_t *));
+
+        /* Keys are unique, so at most one key ends here and bucket 0
+           needs no sorting. start[i] is now the end of bucket i. */
+        for (i = 1; i < 257; i++) {
+            if (count[i] > count[largest])
+                largest = i;
+        }
+        for (i = 1; i < 257; i++) {
+            if (i != largest && count[i] > 1)
+                sort_pairs(pairs + start[i] - count[i], tmp, count[i], depth + 1);
+        }
+
+        pairs += start[largest] - count[largest];
+        n = count[largest];
+        depth++;
+    }
+
+    if (n > 1) {
+        size_t i, j;
+
+        for (i = 1; i < n; i++) {
+            pair_t *pair = pairs[i];
+            for (j = i; j > 0 && compare_pairs(pairs[j - 1], pair, depth) > 0; j--)
+                pairs[j] = pairs[j - 1];
+            pairs[j] = pair;
+        }
+    }
+}
+
+#if defined(HAVE_ATOMIC_BUILTINS)
+#define load_sorted(hashtable_) __atomic_load_n(&(hashtable_)->sorted, __ATOMIC_ACQUIRE)
+#elif defined(HAVE_SYNC_BUILTINS)
+#define load_sorted(hashtable_)                                                          \
+    __sync_val_compare_and_swap(&(hashtable_)->sorted, NULL, NULL)
+#else
+#define load_sorted(hashtable_) ((hashtable_)->sorted)
+#endif
+
+pair_t **hashtable_sorted(hashtable_t *hashtable) {
+    pair_t **pairs, **tmp, **other;
+    list_t *list;
+    size_t i;
+
+    pairs = load_sorted(hashtable);
+    if (pairs)
+        return pairs;
+
+    /* one extra entry, so that an empty hashtable doesn't malloc(0) */
+    pairs = jsonp_malloc((hashtable->size + 1) * sizeof(pair_t *));
+    if (!pairs)
+        return NULL;
+
+    i = 0;
+    for (list = hashtable->ordered_list.next; list != &hashtable->ordered_list;
+         list = list->next)
+        pairs[i++] = ordered_list_to_pair(list);
+
+    if (hashtable->size >= SORT_THRESHOLD) {
+        tmp = jsonp_malloc(hashtable->size * sizeof(pair_t *));
+        if (!tmp) {
+            jsonp_free(pairs);
+            return NULL;
+        }
+        sort_pairs(pairs, tmp, hashtable->size, 0);
+        jsonp_free(tmp);
+    } else {
+        sort_pairs(pairs, NULL, hashtable->size, 0);
+    }
+
+    /* Another thread may have sorted the same keys meanwhile */
+#if defined(HAVE_ATOMIC_BUILTINS)
+    other = NULL;
+    if (__atomic_compare_exchange_n(&hashtable->sorted, &other, pairs, 0,
+                                    __ATOMIC_RELEASE, __ATOMIC_ACQUIRE))
+        other = NULL;
+#elif defined(HAVE_SYNC_BUILTINS)
+    other = __sync_val_compare_and_swap(&hashtable->sorted, NULL, pairs);
+#else
+    other = NULL;
+    hashtable->sorted = pairs;
+#endif
+    if (other) {
+        jsonp_free(pairs);
+        return other;
+    }
+    return pairs;
 }
 
 void *hashtable_iter(hashtable_t *hashtable) {
@@ -39,6 +39,7 @@ typedef struct hashtable {
     size_t order; /* hashtable has pow(2, order) buckets */
     struct hashtable_list list;
     struct hashtable_list ordered_list;
+    struct hashtable_pair **sorted; /* pairs sorted by key, or NULL */
 } hashtable_t;
 
 #define hashtable_key_to_iter(key_)                                                      \
@@ -82,6 +83,23 @@ void hashtable_close(hashtable_t *hashtable);
  */
 int hashtable_set(hashtable_t *hashtable, const char *key, size_t key_len, json_t *value);
 
+/**
+ * hashtable_reserve - Add a key whose value is set later
+ *
+ * @hashtable: The hashtable object
+ * @key: The key
+ * @key_len: The length of key
+ *
+ * Adds key to the hashtable if it's not there yet, and returns a
+ * pointer to its value. The value of a new key is NULL, and it must
+ * be set before the hashtable is used for anything else. This allows
+ * adding a key before its value exists, without keeping a copy of
+ * the key. The pointer is valid until the key is deleted.
+ *
+ * Returns NULL on failure (out of memory).
+ */
+json_t **hashtable_reserve(hashtable_t *hashtable, const char *key, size_t key_len);
+
 /**
  * hashtable_get - Get a value associated with a key
  *
@@ -113,6 +131,24 @@ int hashtable_del(hashtable_t *hashtable, const char *key, size_t key_len);
  */
 void hashtable_clear(hashtable_t *hashtable);
 
+/**
+ * hashtable_sorted - Return the pairs of a hashtable sorted by key
+ *
+ * @hashtable: The hashtable object
+ *
+ * Returns an array of hashtable->size pairs, sorted by key bytewise.
+ * A key that is a prefix of another key sorts first. The array is
+ * owned by the hashtable and kept until a key is added or removed, so
+ * calling this again for an unchanged set of keys is cheap. Changing
+ * the value of an existing key doesn't discard the array.
+ *
+ * With atomic builtins, this may be called from several threads at
+ * the same time, like the read-only functions.
+ *
+ * Returns NULL on failure (out of memory).
+ */
+struct hashtable_pair **hashtable_sorted(hashtable_t *hashtable);
+
 /**
  * hashtable_iter - Iterate over hashtable
  *
@@ -55,7 +55,8 @@ typedef enum {
     JSON_REAL,
     JSON_TRUE,
     JSON_FALSE,
-    JSON_NULL
+    JSON_NULL,
+    JSON_RAW
 } json_type;
 
 typedef struct json_t {
@@ -89,6 +90,7 @@ typedef long json_int_t;
 #define json_boolean_value    json_is_true
 #define json_is_boolean(json) (json_is_true(json) || json_is_false(json))
 #define json_is_null(json)    ((json) && json_typeof(json) == JSON_NULL)
+#define json_is_raw(json)     ((json) && json_typeof(json) == JSON_RAW)
 
 /* construction, destruction, reference counting */
 
@@ -104,6 +106,10 @@ json_t *json_true(void);
 json_t *json_false(void);
 #define json_boolean(val) ((val) ? json_true() : json_false())
 json_t *json_null(void);
+json_t *json_raw(const char *text);
+json_t *json_rawn(const char *text, size_t len);
+json_t *json_raw_nocheck(const char *text);
+json_t *json_rawn_nocheck(const char *text, size_t len);
 
 /* do not call JSON_INTERNAL_INCREF or JSON_INTERNAL_DECREF directly */
 #if JSON_HAVE_ATOMIC_BUILTINS
@@ -175,7 +181,8 @@ enum json_error_code {
     json_error_duplicate_key,
     json_error_numeric_overflow,
     json_error_item_not_found,
-    json_error_index_out_of_range
+    json_error_index_out_of_range,
+    json_error_aborted
 };
 
 static JSON_INLINE enum json_error_code json_error_code(const json_error_t *e) {
@@ -313,6 +320,8 @@ size_t json_string_length(const json_t *string);
 json_int_t json_integer_value(const json_t *integer);
 double json_real_value(const json_t *real);
 double json_number_value(const json_t *json);
+const char *json_raw_value(const json_t *raw);
+size_t json_raw_length(const json_t *raw);
 
 int json_string_set(json_t *string, const char *value);
 int json_string_setn(json_t *string, const char *value, size_t len);
@@ -371,11 +380,67 @@ json_t *json_loadf(FILE *input, size_t flags, json_error_t *error)
     JANSSON_ATTRS((warn_unused_result));
 json_t *json_loadfd(int input, size_t flags, json_error_t *error)
     JANSSON_ATTRS((warn_unused_result));
+json_t *json_loadfd_buffered(int input, size_t flags, char *buffer, size_t size,
+                             size_t *length, json_error_t *error)
+    JANSSON_ATTRS((warn_unused_result));
 json_t *json_load_file(const char *path, size_t flags, json_error_t *error)
     JANSSON_ATTRS((warn_unused_result));
 json_t *json_load_callback(json_load_callback_t callback, void *data, size_t flags,
                            json_error_t *error) JANSSON_ATTRS((warn_unused_result));
 
+typedef struct json_reader json_reader_t;
+
+json_reader_t *json_reader_newb(const char *buffer, size_t buflen, size_t flags)
+    JANSSON_ATTRS((warn_unused_result));
+json_reader_t *json_reader_newf(FILE *input, size_t flags)
+    JANSSON_ATTRS((warn_unused_result));
+json_reader_t *json_reader_newfd(int input, size_t flags)
+    JANSSON_ATTRS((warn_unused_result));
+json_reader_t *json_reader_new_callback(json_load_callback_t callback, void *arg,
+                                        size_t flags) JANSSON_ATTRS((warn_unused_result));
+json_t *json_reader_next(json_reader_t *reader, json_error_t *error)
+    JANSSON_ATTRS((warn_unused_result));
+int json_reader_eof(const json_reader_t *reader);
+void json_reader_free(json_reader_t *reader);
+
+typedef int (*json_lines_callback_t)(json_t *value, void *data);
+
+json_t *json_loadb_lines(const char *buffer, size_t buflen, size_t flags, size_t threads,
+                         json_error_t *error) JANSSON_ATTRS((warn_unused_result));
+int json_loadb_lines_callback(const char *buffer, size_t buflen, size_t flags,
+                              size_t threads, json_lines_callback_t callback, void *data,
+                              json_error_t *error);
+
+typedef struct json_parser json_parser_t;
+
+json_parser_t *json_parser_new(size_t flags) JANSSON_ATTRS((warn_unused_result));
+int json_parser_feed(json_parser_t *parser, const char *buffer, size_t buflen,
+                     json_error_t *error);
+json_t *json_parser_finish(json_parser_t *parser, json_error_t *error)
+    JANSSON_ATTRS((warn_unused_result));
+void json_parser_free(json_parser_t *parser);
+
+typedef struct json_sax_callbacks {
+    int (*start_object)(void *data);
+    int (*key)(const char *key, size_t length, void *data);
+    int (*end_object)(void *data);
+    int (*start_array)(void *data);
+    int (*end_array)(void *data);
+    int (*string)(const char *value, size_t length, void *data);
+    int (*integer)(json_int_t value, void *data);
+    int (*real)(double value, void *data);
+    int (*boolean)(int value, void *data);
+    int (*null)(void *data);
+} json_sax_callbacks_t;
+
+int json_sax_loadb(const char *buffer, size_t buflen, size_t flags,
+                   const json_sax_callbacks_t *callbacks, void *data, json_error_t *error);
+int json_sax_loadf(FILE *input, size_t flags, const json_sax_callbacks_t *callbacks,
+                   void *data, json_error_t *error);
+int json_sax_load_callback(json_load_callback_t callback, void *arg, size_t flags,
+                           const json_sax_callbacks_t *callbacks, void *data,
+                           json_error_t *error);
+
 /* encoding */
 
 #define JSON_MAX_INDENT        0x1F
@@ -393,11 +458,52 @@ typedef int (*json_dump_callback_t)(const char *buffer, size_t size, void *data)
 
 char *json_dumps(const json_t *json, size_t flags) JANSSON_ATTRS((warn_unused_result));
 size_t json_dumpb(const json_t *json, char *buffer, size_t size, size_t flags);
+size_t json_dump_size(const json_t *json, size_t flags);
 int json_dumpf(const json_t *json, FILE *output, size_t flags);
 int json_dumpfd(const json_t *json, int output, size_t flags);
 int json_dump_file(const json_t *json, const char *path, size_t flags);
 int json_dump_callback(const json_t *json, json_dump_callback_t callback, void *data,
                        size_t flags);
+int json_dump_callback_parallel(const json_t *json, json_dump_callback_t callback,
+                                void *data, size_t flags, size_t threads);
+
+int json_dump_cache_enable(json_t *json);
+void json_dump_cache_disable(json_t *json);
+
+typedef struct json_dumper json_dumper_t;
+
+json_dumper_t *json_dumper_new(const json_t *json, size_t flags)
+    JANSSON_ATTRS((warn_unused_result));
+size_t json_dumper_next(json_dumper_t *dumper, char *buffer, size_t size);
+void json_dumper_free(json_dumper_t *dumper);
+
+typedef struct json_writer json_writer_t;
+
+json_writer_t *json_writer_new_callback(json_dump_callback_t callback, void *data,
+                                        size_t flags) JANSSON_ATTRS((warn_unused_result));
+json_writer_t *json_writer_newb(char *buffer, size_t size, size_t flags)
+    JANSSON_ATTRS((warn_unused_result));
+json_writer_t *json_writer_newf(FILE *output, size_t flags)
+    JANSSON_ATTRS((warn_unused_result));
+json_writer_t *json_writer_newfd(int output, size_t flags)
+    JANSSON_ATTRS((warn_unused_result));
+int json_writer_begin_object(json_writer_t *writer);
+int json_writer_end_object(json_writer_t *writer);
+int json_writer_begin_array(json_writer_t *writer);
+int json_writer_end_array(json_writer_t *writer);
+int json_writer_key(json_writer_t *writer, const char *key);
+int json_writer_keyn(json_writer_t *writer, const char *key, size_t len);
+int json_writer_string(json_writer_t *writer, const char *value);
+int json_writer_stringn(json_writer_t *writer, const char *value, size_t len);
+int json_writer_integer(json_writer_t *writer, json_int_t value);
+int json_writer_real(json_writer_t *writer, double value);
+int json_writer_boolean(json_writer_t *writer, int value);
+int json_writer_null(json_writer_t *writer);
+int json_writer_value(json_writer_t *writer, const json_t *json);
+int json_writer_flush(json_writer_t *writer);
+int json_writer_finish(json_writer_t *writer);
+size_t json_writer_length(const json_writer_t *writer);
+void json_writer_free(json_writer_t *writer);
 
 /* custom memory allocation */
 
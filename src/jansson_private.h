@@ -34,9 +34,26 @@
 #endif
 #endif
 
+/* Arrays and objects know the container they were added to, so that
+   a change can discard the cached output of the containers above it,
+   see json_dump_cache_enable(). A container that is in several places
+   or in a loop gets a shared marker as its parent. Containers count
+   the values in them that are shared or untracked, and are untracked
+   and not cached while the count is nonzero. */
+struct dump_cache;
+typedef struct {
+    json_t *parent;
+    size_t places;       /* the number of places it's in */
+    json_t *holders[2];  /* the containers it's in, if it's in at most
+                            two and they are known */
+    size_t untracked;    /* values in it that are shared or untracked */
+    struct dump_cache *cache; /* NULL unless caching is enabled */
+} jsonp_tracking_t;
+
 typedef struct {
     json_t json;
     hashtable_t hashtable;
+    jsonp_tracking_t tracking;
 } json_object_t;
 
 typedef struct {
@@ -44,6 +61,7 @@ typedef struct {
     size_t size;
     size_t entries;
     json_t **table;
+    jsonp_tracking_t tracking;
 } json_array_t;
 
 typedef struct {
@@ -62,11 +80,45 @@ typedef struct {
     json_int_t value;
 } json_integer_t;
 
+typedef struct {
+    json_t json;
+    char *value;
+    size_t length;
+} json_raw_t;
+
 #define json_to_object(json_)  container_of(json_, json_object_t, json)
 #define json_to_array(json_)   container_of(json_, json_array_t, json)
 #define json_to_string(json_)  container_of(json_, json_string_t, json)
 #define json_to_real(json_)    container_of(json_, json_real_t, json)
 #define json_to_integer(json_) container_of(json_, json_integer_t, json)
+#define json_to_raw(json_)     container_of(json_, json_raw_t, json)
+
+static JSON_INLINE jsonp_tracking_t *jsonp_tracking(const json_t *json) {
+    if (json_is_object(json))
+        return &json_to_object(json)->tracking;
+    if (json_is_array(json))
+        return &json_to_array(json)->tracking;
+    return NULL;
+}
+
+/* Called after value has been added to container, and before it's
+   removed from container */
+void jsonp_adopt(json_t *container, json_t *value);
+void jsonp_disown(json_t *container, json_t *value);
+
+/* Incremented whenever a string, integer or real is changed in place.
+   Cached output is only valid for the epoch it was made in, as values
+   don't know the containers they're in. */
+extern volatile size_t jsonp_value_epoch;
+
+/* The number of arrays and objects with caching enabled. While there
+   are none, changes aren't passed up the parent chain. */
+extern volatile size_t jsonp_dump_caches;
+
+/* Discard the cached output of a container, or free its cache. The
+   container must not be used by other threads. */
+void jsonp_dump_cache_clear(struct dump_cache *cache);
+void jsonp_dump_cache_free(struct dump_cache *cache);
 
 /* Create a string by taking ownership of an existing buffer */
 json_t *jsonp_stringn_nocheck_own(const char *value, size_t len);
@@ -79,10 +131,16 @@ void jsonp_error_set(json_error_t *error, int line, int column, size_t position,
 void jsonp_error_vset(json_error_t *error, int line, int column, size_t position,
                       enum json_error_code code, const char *msg, va_list ap);
 
-/* Locale independent string<->double conversions */
-int jsonp_strtod(strbuffer_t *strbuffer, double *out);
+/* Locale independent string<->number conversions */
+int jsonp_strtod(const char *str, size_t length, double *out);
 int jsonp_dtostr(char *buffer, size_t size, double value, int prec);
 
+/* Writes the digits of value to buffer, which must have room for
+   JSONP_MAX_INTEGER_LENGTH bytes. Not NUL terminated. Returns the
+   length. */
+#define JSONP_MAX_INTEGER_LENGTH 24
+int jsonp_inttostr(char *buffer, json_int_t value);
+
 /* Wrappers for custom memory functions */
 void *jsonp_malloc(size_t size) JANSSON_ATTRS((warn_unused_result));
 void *jsonp_realloc(void *ptr, size_t originalSize, size_t newSize)
@@ -90,11 +148,24 @@ void *jsonp_realloc(void *ptr, size_t originalSize, size_t newSize)
 void jsonp_free(void *ptr);
 char *jsonp_strndup(const char *str, size_t len) JANSSON_ATTRS((warn_unused_result));
 
-/* Circular reference check*/
-/* Space for "0x", double the sizeof a pointer for the hex and a terminator. */
-#define LOOP_KEY_LEN (2 + (sizeof(json_t *) * 2) + 1)
-int jsonp_loop_check(hashtable_t *parents, const json_t *json, char *key, size_t key_size,
-                     size_t *key_len_out);
+/* Circular reference check. The containers that are being visited
+   are kept in a stack, most documents are shallow enough for the
+   initial space. */
+#define LOOP_STACK_INITIAL_SIZE 32
+typedef struct {
+    const json_t **stack;
+    size_t depth;
+    size_t size;
+    const json_t *initial[LOOP_STACK_INITIAL_SIZE];
+} loop_check_t;
+
+void jsonp_loop_init(loop_check_t *parents);
+void jsonp_loop_close(loop_check_t *parents);
+int jsonp_loop_check(loop_check_t *parents, const json_t *json);
+#define jsonp_loop_leave(parents) ((parents)->depth--)
+
+/* Number of online processors, or 1 if it can't be found out */
+size_t jsonp_cpu_count(void);
 
 /* Windows compatibility */
 #if defined(_WIN32) || defined(WIN32)
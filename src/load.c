@@ -20,8 +20,24 @@
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
 #endif
+#ifdef HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
+
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H) && defined(HAVE_SYS_STAT_H) &&         \
+    defined(HAVE_UNISTD_H) && defined(HAVE_FCNTL_H)
+#define LOAD_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#endif
+
+#ifdef HAVE_PTHREAD
+#define LOAD_THREADS 1
+#include <pthread.h>
+#endif
 
 #include "jansson.h"
+#include "scan.h"
 #include "strbuffer.h"
 #include "utf.h"
 
@@ -45,32 +61,54 @@
 #define l_isdigit(c) ('0' <= (c) && (c) <= '9')
 #define l_isxdigit(c)                                                                    \
     (l_isdigit(c) || ('A' <= (c) && (c) <= 'F') || ('a' <= (c) && (c) <= 'f'))
+#define l_isspace(c) ((c) == ' ' || (c) == '\t' || (c) == '\n' || (c) == '\r')
+
+/* Read at most size bytes of input to buffer. Return the number of
+   bytes read, or 0 on end of input. (size_t)-1 is treated like end of
+   input. */
+typedef size_t (*fill_func)(char *buffer, size_t size, void *data);
 
-/* Read one byte from stream, convert to unsigned char, then int, and
-   return. return EOF on end of file. This corresponds to the
-   behaviour of fgetc(). */
-typedef int (*get_func)(void *data);
+#ifndef LOAD_BUFFER_SIZE
+#define LOAD_BUFFER_SIZE 4096
+#endif
 
+/* The stream is a window [start, end) over the input. For input that
+   is in memory as a whole, the window covers all of it and fill is
+   NULL. Otherwise the window is in an internal buffer that is
+   refilled with the fill function. The buffer always holds the
+   current token and the previous byte, so that it can be ungot. */
 typedef struct {
-    get_func get;
+    fill_func fill;
     void *data;
-    char buffer[5];
-    size_t buffer_pos;
+    char *buffer;
+    size_t buffer_size;
+    const char *start;
+    const char *pos;
+    const char *end;
+    const char *checked; /* end of the last validated UTF-8 sequence */
+    const char *token;   /* start of the current token, or NULL */
+    const char *mark;    /* line, column and position are counted up to here */
+    const char *block;   /* start of the classified block, or NULL */
+    uint64_t space;      /* whitespace mask of the block */
+    size_t lookahead;    /* max bytes to read ahead of pos, or 0 for no limit */
+    int partial;         /* more input may be appended to the window */
     int state;
     int line;
-    int column, last_column;
+    int column;
     size_t position;
 } stream_t;
 
 typedef struct {
     stream_t stream;
-    strbuffer_t saved_text;
+    strbuffer_t scratch;
     size_t flags;
     size_t depth;
     int token;
     union {
+        /* points to the input or to scratch, valid until the next
+           token is scanned, and not NUL terminated */
         struct {
-            char *val;
+            const char *val;
             size_t len;
         } string;
         json_int_t integer;
@@ -80,6 +118,9 @@ typedef struct {
 
 #define stream_to_lex(stream) container_of(stream, lex_t, stream)
 
+static void stream_location(const stream_t *stream, int *line, int *column,
+                            size_t *position);
+
 /*** error reporting ***/
 
 static void error_set(json_error_t *error, const lex_t *lex, enum json_error_code code,
@@ -101,16 +142,15 @@ static void error_set(json_error_t *error, const lex_t *lex, enum json_error_cod
     va_end(ap);
 
     if (lex) {
-        const char *saved_text = strbuffer_value(&lex->saved_text);
+        const char *saved_text = lex->stream.token;
+        size_t saved_length = saved_text ? (size_t)(lex->stream.pos - saved_text) : 0;
 
-        line = lex->stream.line;
-        col = lex->stream.column;
-        pos = lex->stream.position;
+        stream_location(&lex->stream, &line, &col, &pos);
 
-        if (saved_text && saved_text[0]) {
-            if (lex->saved_text.length <= 20) {
-                snprintf(msg_with_context, JSON_ERROR_TEXT_LENGTH, "%s near '%s'",
-                         msg_text, saved_text);
+        if (saved_length && saved_text[0]) {
+            if (saved_length <= 20) {
+                snprintf(msg_with_context, JSON_ERROR_TEXT_LENGTH, "%s near '%.*s'",
+                         msg_text, (int)saved_length, saved_text);
                 msg_with_context[JSON_ERROR_TEXT_LENGTH - 1] = '\0';
                 result = msg_with_context;
             }
@@ -136,68 +176,212 @@ static void error_set(json_error_t *error, const lex_t *lex, enum json_error_cod
 
 /*** lexical analyzer ***/
 
-static void stream_init(stream_t *stream, get_func get, void *data) {
-    stream->get = get;
+static int stream_init(stream_t *stream, fill_func fill, void *data) {
+    stream->buffer = jsonp_malloc(LOAD_BUFFER_SIZE);
+    if (!stream->buffer)
+        return -1;
+
+    stream->fill = fill;
     stream->data = data;
-    stream->buffer[0] = '\0';
-    stream->buffer_pos = 0;
+    stream->buffer_size = LOAD_BUFFER_SIZE;
+    stream->lookahead = 0;
+    stream->partial = 0;
+    stream->start = stream->pos = stream->end = stream->buffer;
+    stream->checked = stream->token = stream->block = NULL;
+    stream->mark = stream->start;
 
     stream->state = STREAM_STATE_OK;
     stream->line = 1;
     stream->column = 0;
     stream->position = 0;
+    return 0;
 }
 
-static int stream_get(stream_t *stream, json_error_t *error) {
-    int c;
+static void stream_init_memory(stream_t *stream, const char *input, size_t length) {
+    stream->fill = NULL;
+    stream->data = NULL;
+    stream->buffer = NULL;
+    stream->buffer_size = 0;
+    stream->lookahead = 0;
+    stream->partial = 0;
+    stream->start = stream->pos = input;
+    stream->end = input + length;
+    stream->checked = stream->token = stream->block = NULL;
+    stream->mark = stream->start;
 
-    if (stream->state != STREAM_STATE_OK)
-        return stream->state;
+    stream->state = STREAM_STATE_OK;
+    stream->line = 1;
+    stream->column = 0;
+    stream->position = 0;
+}
+
+static void stream_close(stream_t *stream) {
+    jsonp_free(stream->buffer);
+    stream->buffer = NULL;
+}
+
+/* Line and column numbers are not tracked while reading but counted
+   from the input when they're needed. Only the first byte of each
+   UTF-8 sequence increments the column. */
+static void count_lines(const char *p, const char *end, int *line, int *column) {
+    for (; p < end; p++) {
+        if (*p == '\n') {
+            (*line)++;
+            *column = 0;
+        } else if (((unsigned char)*p & 0xC0) != 0x80)
+            (*column)++;
+    }
+}
+
+static void stream_location(const stream_t *stream, int *line, int *column,
+                            size_t *position) {
+    *line = stream->line;
+    *column = stream->column;
+    *position = stream->position + (size_t)(stream->pos - stream->mark);
+    count_lines(stream->mark, stream->pos, line, column);
+}
+
+static size_t stream_position(const stream_t *stream) {
+    return stream->position + (size_t)(stream->pos - stream->mark);
+}
+
+/* Make room for at least size bytes after the end of the window.
+   Everything before the current token, except the byte that may be
+   ungot, is dropped, and the buffer is grown if that's not enough. */
+static int stream_make_room(stream_t *stream, size_t size) {
+    const char *keep = stream->token ? stream->token : stream->pos;
+    size_t offset, length;
+
+    if (stream->buffer_size - (size_t)(stream->end - stream->buffer) >= size)
+        return 0;
 
-    if (!stream->buffer[stream->buffer_pos]) {
-        c = stream->get(stream->data);
-        if (c == EOF) {
-            stream->state = STREAM_STATE_EOF;
-            return STREAM_STATE_EOF;
+    if (keep == stream->pos && keep > stream->start)
+        keep--;
+
+    count_lines(stream->mark, keep, &stream->line, &stream->column);
+    stream->position += (size_t)(keep - stream->mark);
+
+    offset = (size_t)(keep - stream->buffer);
+    length = (size_t)(stream->end - keep);
+    memmove(stream->buffer, keep, length);
+
+    stream->mark = stream->buffer;
+    stream->block = NULL;
+    stream->pos -= offset;
+    stream->end -= offset;
+    if (stream->token)
+        stream->token -= offset;
+    if (stream->checked)
+        stream->checked =
+            stream->checked > keep ? stream->checked - offset : stream->buffer;
+
+    if (stream->buffer_size - length < size) {
+        size_t new_size = stream->buffer_size;
+        char *new_buffer;
+
+        while (new_size - length < size) {
+            if (new_size > (size_t)-1 / 2)
+                return -1;
+            new_size *= 2;
         }
 
-        stream->buffer[0] = c;
-        stream->buffer_pos = 0;
+        new_buffer = jsonp_realloc(stream->buffer, stream->buffer_size, new_size);
+        if (!new_buffer)
+            return -1;
+
+        stream->pos = new_buffer + (stream->pos - stream->buffer);
+        stream->end = new_buffer + (stream->end - stream->buffer);
+        if (stream->token)
+            stream->token = new_buffer + (stream->token - stream->buffer);
+        if (stream->checked)
+            stream->checked = new_buffer + (stream->checked - stream->buffer);
+        stream->buffer = new_buffer;
+        stream->buffer_size = new_size;
+        stream->start = stream->mark = new_buffer;
+    }
+
+    return 0;
+}
+
+/* Make at least need bytes available at the current position, if
+   possible. Returns the number of bytes available. */
+static size_t stream_fill(stream_t *stream, size_t need) {
+    while ((size_t)(stream->end - stream->pos) < need && stream->fill) {
+        size_t space, filled;
+
+        if (stream->end == stream->buffer + stream->buffer_size) {
+            /* The buffer is full. Keep at least half of it free, so
+               that a long token doesn't cause many small reads. */
+            stream_make_room(stream, stream->buffer_size / 2);
+            if (stream->end == stream->buffer + stream->buffer_size)
+                break;
+        }
 
-        if (0x80 <= c && c <= 0xFF) {
-            /* multi-byte UTF-8 sequence */
-            size_t i, count;
+        space = stream->buffer_size - (size_t)(stream->end - stream->buffer);
+        if (stream->lookahead) {
+            size_t ahead = (size_t)(stream->end - stream->pos);
+            if (space > stream->lookahead - ahead)
+                space = stream->lookahead - ahead;
+        }
+
+        filled = stream->fill((char *)stream->end, space, stream->data);
+        if (filled == 0 || filled == (size_t)-1)
+            stream->fill = NULL;
+        else
+            stream->end += filled;
+    }
 
-            count = utf8_check_first(c);
-            if (!count)
-                goto out;
+    return (size_t)(stream->end - stream->pos);
+}
+
+/* Append input to a stream that has no fill function */
+static int stream_append(stream_t *stream, const char *input, size_t length) {
+    if (stream_make_room(stream, length))
+        return -1;
 
-            assert(count >= 2);
+    memcpy((char *)stream->end, input, length);
+    stream->end += length;
+    return 0;
+}
 
-            for (i = 1; i < count; i++)
-                stream->buffer[i] = stream->get(stream->data);
+static int stream_get(stream_t *stream, json_error_t *error) {
+    int c;
 
-            if (!utf8_check_full(stream->buffer, count, NULL))
-                goto out;
+    if (stream->state != STREAM_STATE_OK)
+        return stream->state;
 
-            stream->buffer[count] = '\0';
-        } else
-            stream->buffer[1] = '\0';
+    if (stream->pos == stream->end && !stream_fill(stream, 1)) {
+        stream->state = STREAM_STATE_EOF;
+        return STREAM_STATE_EOF;
     }
 
-    c = stream->buffer[stream->buffer_pos++];
+    c = (unsigned char)*stream->pos;
+    if (c >= 0x80 && stream->pos >= stream->checked) {
+        /* multi-byte UTF-8 sequence */
+        size_t count;
+
+        count = utf8_check_first(c);
+        if (!count)
+            goto out;
+
+        assert(count >= 2);
 
-    stream->position++;
-    if (c == '\n') {
-        stream->line++;
-        stream->last_column = stream->column;
-        stream->column = 0;
-    } else if (utf8_check_first(c)) {
-        /* track the Unicode character column, so increment only if
-           this is the first character of a UTF-8 sequence */
-        stream->column++;
+        if (stream_fill(stream, count) < count) {
+            if (stream->partial) {
+                /* the rest of the sequence is not there yet */
+                stream->state = STREAM_STATE_EOF;
+                return STREAM_STATE_EOF;
+            }
+            goto out;
+        }
+
+        if (!utf8_check_full(stream->pos, count, NULL))
+            goto out;
+
+        stream->checked = stream->pos + count;
     }
 
+    stream->pos++;
     return c;
 
 out:
@@ -207,303 +391,335 @@ out:
     return STREAM_STATE_ERROR;
 }
 
+/* Skip whitespace in the current window. Whitespace is classified
+   SCAN_BLOCK_SIZE bytes at a time, and the mask of the current block
+   is kept for the following tokens. */
+static void stream_skip_whitespace(stream_t *stream) {
+    const char *pos = stream->pos;
+
+    if (pos == stream->end || !l_isspace(*pos))
+        return;
+
+    for (;;) {
+        uint64_t rest;
+
+        if (!stream->block || pos < stream->block ||
+            pos >= stream->block + SCAN_BLOCK_SIZE) {
+            if ((size_t)(stream->end - pos) < SCAN_BLOCK_SIZE)
+                break;
+            stream->block = pos;
+            stream->space = jsonp_scan_whitespace(pos);
+        }
+
+        rest = ~stream->space >> (pos - stream->block);
+        if (rest) {
+            stream->pos = pos + jsonp_ctz64(rest);
+            return;
+        }
+        pos = stream->block + SCAN_BLOCK_SIZE;
+    }
+
+    while (pos < stream->end && l_isspace(*pos))
+        pos++;
+    stream->pos = pos;
+}
+
 static void stream_unget(stream_t *stream, int c) {
     if (c == STREAM_STATE_EOF || c == STREAM_STATE_ERROR)
         return;
 
-    stream->position--;
-    if (c == '\n') {
-        stream->line--;
-        stream->column = stream->last_column;
-    } else if (utf8_check_first(c))
-        stream->column--;
-
-    assert(stream->buffer_pos > 0);
-    stream->buffer_pos--;
-    assert(stream->buffer[stream->buffer_pos] == c);
+    assert(stream->pos > stream->start);
+    stream->pos--;
+    assert((unsigned char)*stream->pos == c);
 }
 
 static int lex_get(lex_t *lex, json_error_t *error) {
     return stream_get(&lex->stream, error);
 }
 
-static void lex_save(lex_t *lex, int c) { strbuffer_append_byte(&lex->saved_text, c); }
-
-static int lex_get_save(lex_t *lex, json_error_t *error) {
-    int c = stream_get(&lex->stream, error);
-    if (c != STREAM_STATE_EOF && c != STREAM_STATE_ERROR)
-        lex_save(lex, c);
-    return c;
-}
-
 static void lex_unget(lex_t *lex, int c) { stream_unget(&lex->stream, c); }
 
-static void lex_unget_unsave(lex_t *lex, int c) {
-    if (c != STREAM_STATE_EOF && c != STREAM_STATE_ERROR) {
-/* Since we treat warnings as errors, when assertions are turned
- * off the "d" variable would be set but never used. Which is
- * treated as an error by GCC.
- */
-#ifndef NDEBUG
-        char d;
-#endif
-        stream_unget(&lex->stream, c);
-#ifndef NDEBUG
-        d =
-#endif
-            strbuffer_pop(&lex->saved_text);
-        assert(c == d);
-    }
+/* The text of the current token, i.e. everything read since the
+   token started */
+static const char *lex_saved_text(const lex_t *lex, size_t *length) {
+    *length = (size_t)(lex->stream.pos - lex->stream.token);
+    return lex->stream.token;
 }
 
 static void lex_save_cached(lex_t *lex) {
-    while (lex->stream.buffer[lex->stream.buffer_pos] != '\0') {
-        lex_save(lex, lex->stream.buffer[lex->stream.buffer_pos]);
-        lex->stream.buffer_pos++;
-        lex->stream.position++;
-    }
+    /* the rest of an already validated UTF-8 sequence */
+    if (lex->stream.checked > lex->stream.pos)
+        lex->stream.pos = lex->stream.checked;
 }
 
-static void lex_free_string(lex_t *lex) {
-    jsonp_free(lex->value.string.val);
-    lex->value.string.val = NULL;
-    lex->value.string.len = 0;
+static int32_t hex_value(int c) {
+    if (l_isdigit(c))
+        return c - '0';
+    else if (l_islower(c))
+        return c - 'a' + 10;
+    else
+        return c - 'A' + 10;
 }
 
-/* assumes that str points to 'u' plus at least 4 valid hex digits */
-static int32_t decode_unicode_escape(const char *str) {
-    int i;
+/* Read the 4 hex digits of a \uXXXX escape, the "\u" has already been
+   read. Returns -1 on error. */
+static int32_t lex_scan_unicode_escape(lex_t *lex, json_error_t *error) {
     int32_t value = 0;
+    int i;
 
-    assert(str[0] == 'u');
-
-    for (i = 1; i <= 4; i++) {
-        char c = str[i];
-        value <<= 4;
-        if (l_isdigit(c))
-            value += c - '0';
-        else if (l_islower(c))
-            value += c - 'a' + 10;
-        else if (l_isupper(c))
-            value += c - 'A' + 10;
-        else
+    for (i = 0; i < 4; i++) {
+        int c = lex_get(lex, error);
+        if (!l_isxdigit(c)) {
+            error_set(error, lex, json_error_invalid_syntax, "invalid escape");
             return -1;
+        }
+        value = (value << 4) + hex_value(c);
     }
 
     return value;
 }
 
+/* Append the bytes in [token + *run, end) to the scratch buffer. The
+   offset is used instead of a pointer because refilling the stream
+   may move the token. */
+static int lex_flush_run(lex_t *lex, const char *end, size_t *run) {
+    const char *start = lex->stream.token + *run;
+
+    if (end > start && strbuffer_append_bytes(&lex->scratch, start, end - start))
+        return -1;
+
+    *run = (size_t)(lex->stream.pos - lex->stream.token);
+    return 0;
+}
+
 static void lex_scan_string(lex_t *lex, json_error_t *error) {
-    int c;
-    const char *p;
-    char *t;
-    int i;
+    stream_t *stream = &lex->stream;
+    size_t run = 1; /* start of the bytes not yet in output, relative to token */
+    int escaped = 0;
+    int32_t invalid = -1, invalid2 = -1; /* first invalid \u escape(s) */
 
     lex->value.string.val = NULL;
     lex->token = TOKEN_INVALID;
+    strbuffer_clear(&lex->scratch);
 
-    c = lex_get_save(lex, error);
+    while (1) {
+        int c;
 
-    while (c != '"') {
-        if (c == STREAM_STATE_ERROR)
-            goto out;
+        /* Runs of plain ASCII go to the output as they are, without
+           looking at each byte separately */
+        stream->pos = jsonp_scan_string(stream->pos, stream->end);
+
+        c = lex_get(lex, error);
+        if (c == '"')
+            break;
+
+        else if (c == STREAM_STATE_ERROR)
+            return;
 
         else if (c == STREAM_STATE_EOF) {
             error_set(error, lex, json_error_premature_end_of_input,
                       "premature end of input");
-            goto out;
+            return;
         }
 
         else if (0 <= c && c <= 0x1F) {
             /* control character */
-            lex_unget_unsave(lex, c);
+            lex_unget(lex, c);
             if (c == '\n')
                 error_set(error, lex, json_error_invalid_syntax, "unexpected newline");
             else
                 error_set(error, lex, json_error_invalid_syntax, "control character 0x%x",
                           c);
-            goto out;
+            return;
+        }
+
+        else if (c >= 0x80) {
+            /* the rest of the validated UTF-8 sequence */
+            lex_save_cached(lex);
         }
 
         else if (c == '\\') {
-            c = lex_get_save(lex, error);
-            if (c == 'u') {
-                c = lex_get_save(lex, error);
-                for (i = 0; i < 4; i++) {
-                    if (!l_isxdigit(c)) {
-                        error_set(error, lex, json_error_invalid_syntax,
-                                  "invalid escape");
-                        goto out;
+            char buffer[4];
+            size_t count = 1;
+
+            if (lex_flush_run(lex, stream->pos - 1, &run))
+                return;
+            escaped = 1;
+
+            c = lex_get(lex, error);
+            switch (c) {
+                case '"':
+                case '\\':
+                case '/':
+                    buffer[0] = (char)c;
+                    break;
+                case 'b':
+                    buffer[0] = '\b';
+                    break;
+                case 'f':
+                    buffer[0] = '\f';
+                    break;
+                case 'n':
+                    buffer[0] = '\n';
+                    break;
+                case 'r':
+                    buffer[0] = '\r';
+                    break;
+                case 't':
+                    buffer[0] = '\t';
+                    break;
+                case 'u': {
+                    int32_t codepoint = lex_scan_unicode_escape(lex, error);
+                    if (codepoint < 0)
+                        return;
+
+                    if (0xD800 <= codepoint && codepoint <= 0xDBFF) {
+                        /* surrogate pair */
+                        if (stream_fill(stream, 1) && stream->pos[0] == '\\' &&
+                            stream_fill(stream, 2) >= 2 && stream->pos[1] == 'u') {
+                            int32_t codepoint2;
+
+                            stream->pos += 2;
+                            codepoint2 = lex_scan_unicode_escape(lex, error);
+                            if (codepoint2 < 0)
+                                return;
+
+                            if (0xDC00 <= codepoint2 && codepoint2 <= 0xDFFF) {
+                                /* valid second surrogate */
+                                codepoint = ((codepoint - 0xD800) << 10) +
+                                            (codepoint2 - 0xDC00) + 0x10000;
+                            } else if (invalid < 0) {
+                                /* invalid second surrogate */
+                                invalid = codepoint;
+                                invalid2 = codepoint2;
+                            }
+                        } else if (invalid < 0) {
+                            /* no second surrogate */
+                            invalid = codepoint;
+                        }
+                    } else if (0xDC00 <= codepoint && codepoint <= 0xDFFF) {
+                        if (invalid < 0)
+                            invalid = codepoint;
                     }
-                    c = lex_get_save(lex, error);
+
+                    if (invalid < 0 && utf8_encode(codepoint, buffer, &count))
+                        assert(0);
+                    break;
                 }
-            } else if (c == '"' || c == '\\' || c == '/' || c == 'b' || c == 'f' ||
-                       c == 'n' || c == 'r' || c == 't')
-                c = lex_get_save(lex, error);
-            else {
-                error_set(error, lex, json_error_invalid_syntax, "invalid escape");
-                goto out;
+                default:
+                    error_set(error, lex, json_error_invalid_syntax, "invalid escape");
+                    return;
             }
-        } else
-            c = lex_get_save(lex, error);
-    }
-
-    /* the actual value is at most of the same length as the source
-       string, because:
-         - shortcut escapes (e.g. "\t") (length 2) are converted to 1 byte
-         - a single \uXXXX escape (length 6) is converted to at most 3 bytes
-         - two \uXXXX escapes (length 12) forming an UTF-16 surrogate pair
-           are converted to 4 bytes
-    */
-    t = jsonp_malloc(lex->saved_text.length + 1);
-    if (!t) {
-        /* this is not very nice, since TOKEN_INVALID is returned */
-        goto out;
+
+            if (strbuffer_append_bytes(&lex->scratch, buffer, count))
+                return;
+            run = (size_t)(stream->pos - stream->token);
+        }
     }
-    lex->value.string.val = t;
 
-    /* + 1 to skip the " */
-    p = strbuffer_value(&lex->saved_text) + 1;
+    /* Invalid Unicode escapes are reported only if the string is
+       otherwise valid, and at its end */
+    if (invalid >= 0) {
+        if (invalid2 >= 0)
+            error_set(error, lex, json_error_invalid_syntax,
+                      "invalid Unicode '\\u%04X\\u%04X'", invalid, invalid2);
+        else
+            error_set(error, lex, json_error_invalid_syntax, "invalid Unicode '\\u%04X'",
+                      invalid);
+        return;
+    }
 
-    while (*p != '"') {
-        if (*p == '\\') {
-            p++;
-            if (*p == 'u') {
-                size_t length;
-                int32_t value;
+    if (escaped) {
+        if (lex_flush_run(lex, stream->pos - 1, &run))
+            return;
+        lex->value.string.val = strbuffer_value(&lex->scratch);
+        lex->value.string.len = lex->scratch.length;
+    } else {
+        lex->value.string.val = stream->token + 1;
+        lex->value.string.len = (size_t)(stream->pos - stream->token) - 2;
+    }
+    lex->token = TOKEN_STRING;
+}
 
-                value = decode_unicode_escape(p);
-                if (value < 0) {
-                    error_set(error, lex, json_error_invalid_syntax,
-                              "invalid Unicode escape '%.6s'", p - 1);
-                    goto out;
-                }
-                p += 5;
-
-                if (0xD800 <= value && value <= 0xDBFF) {
-                    /* surrogate pair */
-                    if (*p == '\\' && *(p + 1) == 'u') {
-                        int32_t value2 = decode_unicode_escape(++p);
-                        if (value2 < 0) {
-                            error_set(error, lex, json_error_invalid_syntax,
-                                      "invalid Unicode escape '%.6s'", p - 1);
-                            goto out;
-                        }
-                        p += 5;
-
-                        if (0xDC00 <= value2 && value2 <= 0xDFFF) {
-                            /* valid second surrogate */
-                            value =
-                                ((value - 0xD800) << 10) + (value2 - 0xDC00) + 0x10000;
-                        } else {
-                            /* invalid second surrogate */
-                            error_set(error, lex, json_error_invalid_syntax,
-                                      "invalid Unicode '\\u%04X\\u%04X'", value, value2);
-                            goto out;
-                        }
-                    } else {
-                        /* no second surrogate */
-                        error_set(error, lex, json_error_invalid_syntax,
-                                  "invalid Unicode '\\u%04X'", value);
-                        goto out;
-                    }
-                } else if (0xDC00 <= value && value <= 0xDFFF) {
-                    error_set(error, lex, json_error_invalid_syntax,
-                              "invalid Unicode '\\u%04X'", value);
-                    goto out;
-                }
+/* The limits of json_int_t, whichever type it is */
+#define JSON_INT_MAX                                                                     \
+    ((((json_int_t)1 << (sizeof(json_int_t) * CHAR_BIT - 2)) - 1) * 2 + 1)
+#define JSON_INT_MIN (-JSON_INT_MAX - 1)
 
-                if (utf8_encode(value, t, &length))
-                    assert(0);
-                t += length;
-            } else {
-                switch (*p) {
-                    case '"':
-                    case '\\':
-                    case '/':
-                        *t = *p;
-                        break;
-                    case 'b':
-                        *t = '\b';
-                        break;
-                    case 'f':
-                        *t = '\f';
-                        break;
-                    case 'n':
-                        *t = '\n';
-                        break;
-                    case 'r':
-                        *t = '\r';
-                        break;
-                    case 't':
-                        *t = '\t';
-                        break;
-                    default:
-                        assert(0);
-                }
-                t++;
-                p++;
-            }
-        } else
-            *(t++) = *(p++);
+/* Read the digits of an integer, the first of which is c. They are
+   accumulated to *value as a negative number, because the negative
+   range of json_int_t is larger, and *overflow is set if it doesn't
+   fit. Returns the character after the digits. */
+static int lex_scan_digits(lex_t *lex, int c, json_int_t *value, int *overflow,
+                           json_error_t *error) {
+    const json_int_t cutoff = JSON_INT_MIN / 10;
+    const int cutlim = -(int)(JSON_INT_MIN % 10);
+    stream_t *stream = &lex->stream;
+    json_int_t result = *value;
+
+    while (1) {
+        int digit = c - '0';
+
+        if (result < cutoff || (result == cutoff && digit > cutlim))
+            *overflow = 1;
+        else
+            result = result * 10 - digit;
+
+        /* Digits are ASCII, so the ones already in the buffer don't
+           need to go through lex_get() */
+        if (stream->pos < stream->end && l_isdigit(*stream->pos)) {
+            c = (unsigned char)*stream->pos++;
+            continue;
+        }
+
+        c = lex_get(lex, error);
+        if (!l_isdigit(c))
+            break;
     }
-    *t = '\0';
-    lex->value.string.len = t - lex->value.string.val;
-    lex->token = TOKEN_STRING;
-    return;
 
-out:
-    lex_free_string(lex);
+    *value = result;
+    return c;
 }
 
-#ifndef JANSSON_USING_CMAKE /* disabled if using cmake */
-#if JSON_INTEGER_IS_LONG_LONG
-#ifdef _MSC_VER /* Microsoft Visual Studio */
-#define json_strtoint _strtoi64
-#else
-#define json_strtoint strtoll
-#endif
-#else
-#define json_strtoint strtol
-#endif
-#endif
-
 static int lex_scan_number(lex_t *lex, int c, json_error_t *error) {
     const char *saved_text;
-    char *end;
+    size_t saved_length;
     double doubleval;
+    json_int_t intval = 0; /* negated while scanning */
+    int negative = 0, overflow = 0;
 
     lex->token = TOKEN_INVALID;
 
-    if (c == '-')
-        c = lex_get_save(lex, error);
+    if (c == '-') {
+        negative = 1;
+        c = lex_get(lex, error);
+    }
 
     if (c == '0') {
-        c = lex_get_save(lex, error);
+        c = lex_get(lex, error);
         if (l_isdigit(c)) {
-            lex_unget_unsave(lex, c);
+            lex_unget(lex, c);
             goto out;
         }
     } else if (l_isdigit(c)) {
-        do
-            c = lex_get_save(lex, error);
-        while (l_isdigit(c));
+        c = lex_scan_digits(lex, c, &intval, &overflow, error);
     } else {
-        lex_unget_unsave(lex, c);
+        lex_unget(lex, c);
         goto out;
     }
 
     if (!(lex->flags & JSON_DECODE_INT_AS_REAL) && c != '.' && c != 'E' && c != 'e') {
-        json_int_t intval;
-
-        lex_unget_unsave(lex, c);
+        lex_unget(lex, c);
 
-        saved_text = strbuffer_value(&lex->saved_text);
+        if (!negative) {
+            if (intval == JSON_INT_MIN)
+                overflow = 1;
+            else
+                intval = -intval;
+        }
 
-        errno = 0;
-        intval = json_strtoint(saved_text, &end, 10);
-        if (errno == ERANGE) {
-            if (intval < 0)
+        if (overflow) {
+            if (negative)
                 error_set(error, lex, json_error_numeric_overflow,
                           "too big negative integer");
             else
@@ -511,8 +727,6 @@ static int lex_scan_number(lex_t *lex, int c, json_error_t *error) {
             goto out;
         }
 
-        assert(end == saved_text + lex->saved_text.length);
-
         lex->token = TOKEN_INTEGER;
         lex->value.integer = intval;
         return 0;
@@ -524,31 +738,31 @@ static int lex_scan_number(lex_t *lex, int c, json_error_t *error) {
             lex_unget(lex, c);
             goto out;
         }
-        lex_save(lex, c);
 
         do
-            c = lex_get_save(lex, error);
+            c = lex_get(lex, error);
         while (l_isdigit(c));
     }
 
     if (c == 'E' || c == 'e') {
-        c = lex_get_save(lex, error);
+        c = lex_get(lex, error);
         if (c == '+' || c == '-')
-            c = lex_get_save(lex, error);
+            c = lex_get(lex, error);
 
         if (!l_isdigit(c)) {
-            lex_unget_unsave(lex, c);
+            lex_unget(lex, c);
             goto out;
         }
 
         do
-            c = lex_get_save(lex, error);
+            c = lex_get(lex, error);
         while (l_isdigit(c));
     }
 
-    lex_unget_unsave(lex, c);
+    lex_unget(lex, c);
 
-    if (jsonp_strtod(&lex->saved_text, &doubleval)) {
+    saved_text = lex_saved_text(lex, &saved_length);
+    if (jsonp_strtod(saved_text, saved_length, &doubleval)) {
         error_set(error, lex, json_error_numeric_overflow, "real number overflow");
         goto out;
     }
@@ -564,14 +778,14 @@ out:
 static int lex_scan(lex_t *lex, json_error_t *error) {
     int c;
 
-    strbuffer_clear(&lex->saved_text);
+    lex->stream.token = NULL;
 
-    if (lex->token == TOKEN_STRING)
-        lex_free_string(lex);
+    if (lex->stream.state == STREAM_STATE_OK)
+        stream_skip_whitespace(&lex->stream);
 
     do
         c = lex_get(lex, error);
-    while (c == ' ' || c == '\t' || c == '\n' || c == '\r');
+    while (l_isspace(c));
 
     if (c == STREAM_STATE_EOF) {
         lex->token = TOKEN_EOF;
@@ -583,7 +797,7 @@ static int lex_scan(lex_t *lex, json_error_t *error) {
         goto out;
     }
 
-    lex_save(lex, c);
+    lex->stream.token = lex->stream.pos - 1;
 
     if (c == '{' || c == '}' || c == '[' || c == ']' || c == ':' || c == ',')
         lex->token = c;
@@ -599,19 +813,20 @@ static int lex_scan(lex_t *lex, json_error_t *error) {
     else if (l_isalpha(c)) {
         /* eat up the whole identifier for clearer error messages */
         const char *saved_text;
+        size_t saved_length;
 
         do
-            c = lex_get_save(lex, error);
+            c = lex_get(lex, error);
         while (l_isalpha(c));
-        lex_unget_unsave(lex, c);
+        lex_unget(lex, c);
 
-        saved_text = strbuffer_value(&lex->saved_text);
+        saved_text = lex_saved_text(lex, &saved_length);
 
-        if (strcmp(saved_text, "true") == 0)
+        if (saved_length == 4 && memcmp(saved_text, "true", 4) == 0)
             lex->token = TOKEN_TRUE;
-        else if (strcmp(saved_text, "false") == 0)
+        else if (saved_length == 5 && memcmp(saved_text, "false", 5) == 0)
             lex->token = TOKEN_FALSE;
-        else if (strcmp(saved_text, "null") == 0)
+        else if (saved_length == 4 && memcmp(saved_text, "null", 4) == 0)
             lex->token = TOKEN_NULL;
         else
             lex->token = TOKEN_INVALID;
@@ -628,20 +843,22 @@ out:
     return lex->token;
 }
 
-static char *lex_steal_string(lex_t *lex, size_t *out_len) {
-    char *result = NULL;
-    if (lex->token == TOKEN_STRING) {
-        result = lex->value.string.val;
-        *out_len = lex->value.string.len;
-        lex->value.string.val = NULL;
-        lex->value.string.len = 0;
+static int lex_init(lex_t *lex, fill_func fill, size_t flags, void *data) {
+    if (stream_init(&lex->stream, fill, data))
+        return -1;
+    if (strbuffer_init(&lex->scratch)) {
+        stream_close(&lex->stream);
+        return -1;
     }
-    return result;
+
+    lex->flags = flags;
+    lex->token = TOKEN_INVALID;
+    return 0;
 }
 
-static int lex_init(lex_t *lex, get_func get, size_t flags, void *data) {
-    stream_init(&lex->stream, get, data);
-    if (strbuffer_init(&lex->saved_text))
+static int lex_init_memory(lex_t *lex, const char *input, size_t length, size_t flags) {
+    stream_init_memory(&lex->stream, input, length);
+    if (strbuffer_init(&lex->scratch))
         return -1;
 
     lex->flags = flags;
@@ -650,9 +867,8 @@ static int lex_init(lex_t *lex, get_func get, size_t flags, void *data) {
 }
 
 static void lex_close(lex_t *lex) {
-    if (lex->token == TOKEN_STRING)
-        lex_free_string(lex);
-    strbuffer_close(&lex->saved_text);
+    strbuffer_close(&lex->scratch);
+    stream_close(&lex->stream);
 }
 
 /*** parser ***/
@@ -669,8 +885,9 @@ static json_t *parse_object(lex_t *lex, size_t flags, json_error_t *error) {
         return object;
 
     while (1) {
-        char *key;
+        const char *key;
         size_t len;
+        json_t **slot;
         json_t *value;
 
         if (lex->token != TOKEN_STRING) {
@@ -678,11 +895,9 @@ static json_t *parse_object(lex_t *lex, size_t flags, json_error_t *error) {
             goto error;
         }
 
-        key = lex_steal_string(lex, &len);
-        if (!key)
-            return NULL;
+        key = lex->value.string.val;
+        len = lex->value.string.len;
         if (memchr(key, '\0', len)) {
-            jsonp_free(key);
             error_set(error, lex, json_error_null_byte_in_key,
                       "NUL byte in object key not supported");
             goto error;
@@ -690,32 +905,34 @@ static json_t *parse_object(lex_t *lex, size_t flags, json_error_t *error) {
 
         if (flags & JSON_REJECT_DUPLICATES) {
             if (json_object_getn(object, key, len)) {
-                jsonp_free(key);
                 error_set(error, lex, json_error_duplicate_key, "duplicate object key");
                 goto error;
             }
         }
 
+        /* The key is only valid until the next token, so it's added
+           to the object right away, and the value is filled in when
+           it has been decoded */
+        slot = hashtable_reserve(&json_to_object(object)->hashtable, key, len);
+        if (!slot)
+            goto error;
+
         lex_scan(lex, error);
         if (lex->token != ':') {
-            jsonp_free(key);
             error_set(error, lex, json_error_invalid_syntax, "':' expected");
             goto error;
         }
 
         lex_scan(lex, error);
         value = parse_value(lex, flags, error);
-        if (!value) {
-            jsonp_free(key);
-            goto error;
-        }
-
-        if (json_object_setn_new_nocheck(object, key, len, value)) {
-            jsonp_free(key);
+        if (!value)
             goto error;
-        }
 
-        jsonp_free(key);
+        if (*slot)
+            jsonp_disown(object, *slot);
+        json_decref(*slot);
+        *slot = value;
+        jsonp_adopt(object, value);
 
         lex_scan(lex, error);
         if (lex->token != ',')
@@ -795,9 +1012,7 @@ static json_t *parse_value(lex_t *lex, size_t flags, json_error_t *error) {
                 }
             }
 
-            json = jsonp_stringn_nocheck_own(value, len);
-            lex->value.string.val = NULL;
-            lex->value.string.len = 0;
+            json = json_stringn_nocheck(value, len);
             break;
         }
 
@@ -876,33 +1091,15 @@ static json_t *parse_json(lex_t *lex, size_t flags, json_error_t *error) {
 
     if (error) {
         /* Save the position even though there was no error */
-        error->position = (int)lex->stream.position;
+        error->position = (int)stream_position(&lex->stream);
     }
 
     return result;
 }
 
-typedef struct {
-    const char *data;
-    size_t pos;
-} string_data_t;
-
-static int string_get(void *data) {
-    char c;
-    string_data_t *stream = (string_data_t *)data;
-    c = stream->data[stream->pos];
-    if (c == '\0')
-        return EOF;
-    else {
-        stream->pos++;
-        return (unsigned char)c;
-    }
-}
-
 json_t *json_loads(const char *string, size_t flags, json_error_t *error) {
     lex_t lex;
     json_t *result;
-    string_data_t stream_data;
 
     jsonp_error_init(error, "<string>");
 
@@ -911,10 +1108,7 @@ json_t *json_loads(const char *string, size_t flags, json_error_t *error) {
         return NULL;
     }
 
-    stream_data.data = string;
-    stream_data.pos = 0;
-
-    if (lex_init(&lex, string_get, flags, (void *)&stream_data))
+    if (lex_init_memory(&lex, string, strlen(string), flags))
         return NULL;
 
     result = parse_json(&lex, flags, error);
@@ -923,27 +1117,9 @@ json_t *json_loads(const char *string, size_t flags, json_error_t *error) {
     return result;
 }
 
-typedef struct {
-    const char *data;
-    size_t len;
-    size_t pos;
-} buffer_data_t;
-
-static int buffer_get(void *data) {
-    char c;
-    buffer_data_t *stream = data;
-    if (stream->pos >= stream->len)
-        return EOF;
-
-    c = stream->data[stream->pos];
-    stream->pos++;
-    return (unsigned char)c;
-}
-
 json_t *json_loadb(const char *buffer, size_t buflen, size_t flags, json_error_t *error) {
     lex_t lex;
     json_t *result;
-    buffer_data_t stream_data;
 
     jsonp_error_init(error, "<buffer>");
 
@@ -952,11 +1128,7 @@ json_t *json_loadb(const char *buffer, size_t buflen, size_t flags, json_error_t
         return NULL;
     }
 
-    stream_data.data = buffer;
-    stream_data.pos = 0;
-    stream_data.len = buflen;
-
-    if (lex_init(&lex, buffer_get, flags, (void *)&stream_data))
+    if (lex_init_memory(&lex, buffer, buflen, flags))
         return NULL;
 
     result = parse_json(&lex, flags, error);
@@ -965,8 +1137,29 @@ json_t *json_loadb(const char *buffer, size_t buflen, size_t flags, json_error_t
     return result;
 }
 
+typedef struct {
+    FILE *fp;
+    int bytewise; /* read one byte at a time */
+} file_data_t;
+
+static size_t file_fill(char *buffer, size_t size, void *data) {
+    file_data_t *source = (file_data_t *)data;
+    int c;
+
+    if (!source->bytewise)
+        return fread(buffer, 1, size, source->fp);
+
+    c = fgetc(source->fp);
+    if (c == EOF)
+        return 0;
+
+    buffer[0] = (char)c;
+    return 1;
+}
+
 json_t *json_loadf(FILE *input, size_t flags, json_error_t *error) {
     lex_t lex;
+    file_data_t file_data;
     const char *source;
     json_t *result;
 
@@ -982,7 +1175,12 @@ json_t *json_loadf(FILE *input, size_t flags, json_error_t *error) {
         return NULL;
     }
 
-    if (lex_init(&lex, (get_func)fgetc, flags, input))
+    /* Without the EOF check, leave the file position right after the
+       JSON text */
+    file_data.fp = input;
+    file_data.bytewise = (flags & JSON_DISABLE_EOF_CHECK) != 0;
+
+    if (lex_init(&lex, file_fill, flags, &file_data))
         return NULL;
 
     result = parse_json(&lex, flags, error);
@@ -991,91 +1189,243 @@ json_t *json_loadf(FILE *input, size_t flags, json_error_t *error) {
     return result;
 }
 
-static int fd_get_func(int *fd) {
+typedef struct {
+    int fd;
+    int bytewise;        /* read one byte at a time */
+    const char *pending; /* input read by an earlier call */
+    size_t pending_length;
+} fd_data_t;
+
+static size_t fd_fill(char *buffer, size_t size, void *data) {
+    fd_data_t *source = (fd_data_t *)data;
+
+    if (source->pending_length) {
+        if (size > source->pending_length)
+            size = source->pending_length;
+        memcpy(buffer, source->pending, size);
+        source->pending += size;
+        source->pending_length -= size;
+        return size;
+    }
+
 #ifdef HAVE_UNISTD_H
-    uint8_t c;
-    if (read(*fd, &c, 1) == 1)
-        return c;
+    {
+        ssize_t count;
+
+        if (source->bytewise)
+            size = 1;
+
+        do
+            count = read(source->fd, buffer, size);
+        while (count < 0 && errno == EINTR);
+
+        if (count > 0)
+            return (size_t)count;
+    }
+#else
+    (void)buffer;
 #endif
-    return EOF;
+    return 0;
 }
 
-json_t *json_loadfd(int input, size_t flags, json_error_t *error) {
-    lex_t lex;
-    const char *source;
-    json_t *result;
+/* Whether input read past the end of the JSON text can be given back
+   by seeking backwards */
+static int fd_is_seekable(int fd) {
+#if defined(HAVE_UNISTD_H) && defined(HAVE_SYS_STAT_H)
+    struct stat st;
 
+    return fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+           lseek(fd, 0, SEEK_CUR) != (off_t)-1;
+#else
+    (void)fd;
+    return 0;
+#endif
+}
+
+static const char *fd_source(int input) {
 #ifdef HAVE_UNISTD_H
     if (input == STDIN_FILENO)
-        source = "<stdin>";
-    else
+        return "<stdin>";
+#else
+    (void)input;
 #endif
-        source = "<stream>";
+    return "<stream>";
+}
 
-    jsonp_error_init(error, source);
+json_t *json_loadfd(int input, size_t flags, json_error_t *error) {
+    lex_t lex;
+    fd_data_t fd_data;
+    int seekable = 0;
+    json_t *result;
+
+    jsonp_error_init(error, fd_source(input));
 
     if (input < 0) {
         error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
         return NULL;
     }
 
-    if (lex_init(&lex, (get_func)fd_get_func, flags, &input))
+    /* Without the EOF check, the file position has to be left right
+       after the JSON text. Read ahead only if the input that was not
+       decoded can be given back. */
+    if (flags & JSON_DISABLE_EOF_CHECK)
+        seekable = fd_is_seekable(input);
+
+    fd_data.fd = input;
+    fd_data.bytewise = (flags & JSON_DISABLE_EOF_CHECK) && !seekable;
+    fd_data.pending = NULL;
+    fd_data.pending_length = 0;
+
+    if (lex_init(&lex, fd_fill, flags, &fd_data))
         return NULL;
 
     result = parse_json(&lex, flags, error);
 
+#ifdef HAVE_UNISTD_H
+    /* Also on error, so that the position is left at the error */
+    if (seekable && lex.stream.end > lex.stream.pos)
+        lseek(input, -(off_t)(lex.stream.end - lex.stream.pos), SEEK_CUR);
+#endif
+
     lex_close(&lex);
     return result;
 }
 
-json_t *json_load_file(const char *path, size_t flags, json_error_t *error) {
+json_t *json_loadfd_buffered(int input, size_t flags, char *buffer, size_t size,
+                             size_t *length, json_error_t *error) {
+    lex_t lex;
+    fd_data_t fd_data;
+    size_t unread;
     json_t *result;
-    FILE *fp;
 
-    jsonp_error_init(error, path);
+    jsonp_error_init(error, fd_source(input));
 
-    if (path == NULL) {
+    if (input < 0 || !buffer || !length || size < 4 || *length > size) {
         error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
         return NULL;
     }
 
-    fp = fopen(path, "rb");
-    if (!fp) {
-        error_set(error, NULL, json_error_cannot_open_file, "unable to open %s: %s", path,
-                  strerror(errno));
+    fd_data.fd = input;
+    fd_data.bytewise = 0;
+    fd_data.pending = buffer;
+    fd_data.pending_length = *length;
+
+    if (lex_init(&lex, fd_fill, flags, &fd_data))
         return NULL;
-    }
 
-    result = json_loadf(fp, flags, error);
+    /* Never have more unread input than fits in buffer */
+    lex.stream.lookahead = size;
 
-    fclose(fp);
+    result = parse_json(&lex, flags, error);
+
+    /* Give back the input that was read but not decoded */
+    unread = (size_t)(lex.stream.end - lex.stream.pos);
+    memmove(buffer + unread, fd_data.pending, fd_data.pending_length);
+    memcpy(buffer, lex.stream.pos, unread);
+    *length = unread + fd_data.pending_length;
+
+    lex_close(&lex);
     return result;
 }
 
-#define MAX_BUF_LEN 1024
+#ifdef LOAD_MMAP
+/* Decode a regular file by mapping it to memory. Returns -1 if the
+   file can't be mapped. */
+static int load_mapped(int fd, size_t flags, json_error_t *error, json_t **result) {
+    lex_t lex;
+    struct stat st;
+    size_t size;
+    void *data;
 
-typedef struct {
-    char data[MAX_BUF_LEN];
-    size_t len;
-    size_t pos;
+    if (fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_size <= 0 ||
+        (off_t)(size_t)st.st_size != st.st_size)
+        return -1;
+
+    size = (size_t)st.st_size;
+    data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+        return -1;
+
+#ifdef HAVE_MADVISE
+    madvise(data, size, MADV_SEQUENTIAL);
+#endif
+
+    *result = NULL;
+    if (!lex_init_memory(&lex, (const char *)data, size, flags)) {
+        *result = parse_json(&lex, flags, error);
+        lex_close(&lex);
+    }
+
+    munmap(data, size);
+    return 0;
+}
+#endif
+
+json_t *json_load_file(const char *path, size_t flags, json_error_t *error) {
+    json_t *result;
+#ifdef LOAD_MMAP
+    lex_t lex;
+    fd_data_t fd_data;
+    int fd;
+#else
+    FILE *fp;
+#endif
+
+    jsonp_error_init(error, path);
+
+    if (path == NULL) {
+        error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
+        return NULL;
+    }
+
+#ifdef LOAD_MMAP
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        error_set(error, NULL, json_error_cannot_open_file, "unable to open %s: %s", path,
+                  strerror(errno));
+        return NULL;
+    }
+
+    jsonp_error_init(error, "<stream>");
+
+    if (load_mapped(fd, flags, error, &result)) {
+        /* Not a regular file, read it in blocks */
+        fd_data.fd = fd;
+        fd_data.bytewise = 0;
+        fd_data.pending = NULL;
+        fd_data.pending_length = 0;
+
+        result = NULL;
+        if (!lex_init(&lex, fd_fill, flags, &fd_data)) {
+            result = parse_json(&lex, flags, error);
+            lex_close(&lex);
+        }
+    }
+
+    close(fd);
+#else
+    fp = fopen(path, "rb");
+    if (!fp) {
+        error_set(error, NULL, json_error_cannot_open_file, "unable to open %s: %s", path,
+                  strerror(errno));
+        return NULL;
+    }
+
+    result = json_loadf(fp, flags, error);
+
+    fclose(fp);
+#endif
+    return result;
+}
+
+typedef struct {
     json_load_callback_t callback;
     void *arg;
 } callback_data_t;
 
-static int callback_get(void *data) {
-    char c;
+static size_t callback_fill(char *buffer, size_t size, void *data) {
     callback_data_t *stream = data;
-
-    if (stream->pos >= stream->len) {
-        stream->pos = 0;
-        stream->len = stream->callback(stream->data, MAX_BUF_LEN, stream->arg);
-        if (stream->len == 0 || stream->len == (size_t)-1)
-            return EOF;
-    }
-
-    c = stream->data[stream->pos];
-    stream->pos++;
-    return (unsigned char)c;
+    return stream->callback(buffer, size, stream->arg);
 }
 
 json_t *json_load_callback(json_load_callback_t callback, void *arg, size_t flags,
@@ -1085,7 +1435,6 @@ json_t *json_load_callback(json_load_callback_t callback, void *arg, size_t flag
 
     callback_data_t stream_data;
 
-    memset(&stream_data, 0, sizeof(stream_data));
     stream_data.callback = callback;
     stream_data.arg = arg;
 
@@ -1096,7 +1445,7 @@ json_t *json_load_callback(json_load_callback_t callback, void *arg, size_t flag
         return NULL;
     }
 
-    if (lex_init(&lex, (get_func)callback_get, flags, &stream_data))
+    if (lex_init(&lex, callback_fill, flags, &stream_data))
         return NULL;
 
     result = parse_json(&lex, flags, error);
@@ -1104,3 +1453,1257 @@ json_t *json_load_callback(json_load_callback_t callback, void *arg, size_t flag
     lex_close(&lex);
     return result;
 }
+
+/*** multi-document reader ***/
+
+/* This is parse_json() for one value of many, with the same lexer for
+   all of them. Returns NULL with *eof set at the end of input. */
+static json_t *parse_next(lex_t *lex, json_error_t *error, int *eof) {
+    json_t *result = NULL;
+
+    lex->depth = 0;
+    *eof = 0;
+
+    lex_scan(lex, error);
+    if (lex->token == TOKEN_EOF)
+        *eof = 1;
+    else if (!(lex->flags & JSON_DECODE_ANY) && lex->token != '[' && lex->token != '{')
+        error_set(error, lex, json_error_invalid_syntax, "'[' or '{' expected");
+    else
+        result = parse_value(lex, lex->flags, error);
+
+    if ((result || *eof) && error) {
+        /* Save the position even though there was no error */
+        error->position = (int)stream_position(&lex->stream);
+    }
+    return result;
+}
+
+struct json_reader {
+    lex_t lex;
+    const char *source;
+    int state;
+    union {
+        file_data_t file;
+        fd_data_t fd;
+        callback_data_t callback;
+    } data;
+    json_error_t error; /* the error that stopped reading */
+};
+
+#define READER_OK    0
+#define READER_EOF   1
+#define READER_ERROR 2
+
+static json_reader_t *reader_new(const char *source) {
+    json_reader_t *reader = jsonp_malloc(sizeof(json_reader_t));
+    if (!reader)
+        return NULL;
+
+    reader->source = source;
+    reader->state = READER_OK;
+    jsonp_error_init(&reader->error, source);
+    return reader;
+}
+
+json_reader_t *json_reader_newb(const char *buffer, size_t buflen, size_t flags) {
+    json_reader_t *reader;
+
+    if (!buffer)
+        return NULL;
+
+    reader = reader_new("<buffer>");
+    if (!reader)
+        return NULL;
+
+    if (lex_init_memory(&reader->lex, buffer, buflen, flags)) {
+        jsonp_free(reader);
+        return NULL;
+    }
+    return reader;
+}
+
+json_reader_t *json_reader_newf(FILE *input, size_t flags) {
+    json_reader_t *reader;
+
+    if (!input)
+        return NULL;
+
+    reader = reader_new(input == stdin ? "<stdin>" : "<stream>");
+    if (!reader)
+        return NULL;
+
+    reader->data.file.fp = input;
+    reader->data.file.bytewise = 0;
+    if (lex_init(&reader->lex, file_fill, flags, &reader->data.file)) {
+        jsonp_free(reader);
+        return NULL;
+    }
+    return reader;
+}
+
+json_reader_t *json_reader_newfd(int input, size_t flags) {
+    json_reader_t *reader;
+
+    if (input < 0)
+        return NULL;
+
+    reader = reader_new(fd_source(input));
+    if (!reader)
+        return NULL;
+
+    reader->data.fd.fd = input;
+    reader->data.fd.bytewise = 0;
+    reader->data.fd.pending = NULL;
+    reader->data.fd.pending_length = 0;
+    if (lex_init(&reader->lex, fd_fill, flags, &reader->data.fd)) {
+        jsonp_free(reader);
+        return NULL;
+    }
+    return reader;
+}
+
+json_reader_t *json_reader_new_callback(json_load_callback_t callback, void *arg,
+                                        size_t flags) {
+    json_reader_t *reader;
+
+    if (!callback)
+        return NULL;
+
+    reader = reader_new("<callback>");
+    if (!reader)
+        return NULL;
+
+    reader->data.callback.callback = callback;
+    reader->data.callback.arg = arg;
+    if (lex_init(&reader->lex, callback_fill, flags, &reader->data.callback)) {
+        jsonp_free(reader);
+        return NULL;
+    }
+    return reader;
+}
+
+json_t *json_reader_next(json_reader_t *reader, json_error_t *error) {
+    json_t *result;
+    int eof;
+
+    if (!reader) {
+        jsonp_error_init(error, "<reader>");
+        error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
+        return NULL;
+    }
+
+    if (reader->state != READER_OK) {
+        if (error)
+            *error = reader->error;
+        return NULL;
+    }
+
+    jsonp_error_init(&reader->error, reader->source);
+
+    result = parse_next(&reader->lex, &reader->error, &eof);
+    if (!result)
+        reader->state = eof ? READER_EOF : READER_ERROR;
+
+    if (error)
+        *error = reader->error;
+    return result;
+}
+
+int json_reader_eof(const json_reader_t *reader) {
+    return reader && reader->state == READER_EOF;
+}
+
+void json_reader_free(json_reader_t *reader) {
+    if (!reader)
+        return;
+
+    lex_close(&reader->lex);
+    jsonp_free(reader);
+}
+
+/*** parallel JSON Lines decoding ***/
+
+/* The input is cut to chunks of about this size at newlines. The
+   chunks don't depend on the number of threads, so neither do the
+   results. */
+#ifndef LINES_CHUNK_SIZE
+#define LINES_CHUNK_SIZE (256 * 1024)
+#endif
+
+typedef struct {
+    const char *start;
+    const char *end;
+    json_t *values; /* array of the decoded values, or NULL on error */
+    json_error_t error;
+    int ready;
+} lines_chunk_t;
+
+typedef struct {
+    const char *buffer;
+    const char *end;
+    size_t flags;
+    const char *next;      /* start of the first chunk not taken yet */
+    size_t taken;          /* number of chunks taken for decoding */
+    size_t delivered;      /* number of chunks passed to the caller */
+    lines_chunk_t *chunks; /* ring of chunks taken but not delivered */
+    size_t window;         /* number of entries in chunks */
+    int stop;
+#ifdef LOAD_THREADS
+    pthread_mutex_t mutex;
+    pthread_cond_t cond; /* signaled when any of the above changes */
+#endif
+} lines_t;
+
+/* Take the next chunk for decoding. With threads, the mutex must be
+   held. */
+static lines_chunk_t *lines_take(lines_t *lines) {
+    lines_chunk_t *chunk = &lines->chunks[lines->taken % lines->window];
+    const char *end = lines->end;
+
+    if ((size_t)(end - lines->next) > LINES_CHUNK_SIZE) {
+        const char *newline = memchr(lines->next + LINES_CHUNK_SIZE, '\n',
+                                     (size_t)(end - lines->next) - LINES_CHUNK_SIZE);
+        if (newline)
+            end = newline + 1;
+    }
+
+    chunk->start = lines->next;
+    chunk->end = end;
+    chunk->values = NULL;
+    chunk->ready = 0;
+
+    lines->next = end;
+    lines->taken++;
+    return chunk;
+}
+
+static void lines_decode(lines_t *lines, lines_chunk_t *chunk) {
+    lex_t lex;
+    json_t *values, *value;
+    int eof;
+
+    jsonp_error_init(&chunk->error, "<buffer>");
+
+    values = json_array();
+    if (!values || lex_init_memory(&lex, chunk->start, (size_t)(chunk->end - chunk->start),
+                                   lines->flags)) {
+        json_decref(values);
+        error_set(&chunk->error, NULL, json_error_out_of_memory, "out of memory");
+        return;
+    }
+
+    while ((value = parse_next(&lex, &chunk->error, &eof))) {
+        if (json_array_append_new(values, value)) {
+            error_set(&chunk->error, NULL, json_error_out_of_memory, "out of memory");
+            break;
+        }
+    }
+
+    if (eof)
+        chunk->values = values;
+    else
+        json_decref(values);
+
+    lex_close(&lex);
+}
+
+/* Pass the values of a decoded chunk to callback, or append them to
+   result if there's no callback */
+static int lines_deliver(lines_t *lines, lines_chunk_t *chunk,
+                         json_lines_callback_t callback, void *data, json_t *result,
+                         json_error_t *error) {
+    size_t i;
+
+    if (!chunk->values) {
+        if (!error)
+            return -1;
+
+        *error = chunk->error;
+        if (error->line > 0) {
+            /* Positions in the chunk to positions in the whole input.
+               Chunks start at the beginning of a line. */
+            const char *p = lines->buffer;
+
+            while ((p = memchr(p, '\n', (size_t)(chunk->start - p))) != NULL) {
+                error->line++;
+                p++;
+            }
+            error->position += (int)(chunk->start - lines->buffer);
+        }
+        return -1;
+    }
+
+    if (!callback) {
+        if (json_array_extend(result, chunk->values)) {
+            error_set(error, NULL, json_error_out_of_memory, "out of memory");
+            return -1;
+        }
+        return 0;
+    }
+
+    for (i = 0; i < json_array_size(chunk->values); i++) {
+        if (callback(json_array_get(chunk->values, i), data)) {
+            error_set(error, NULL, json_error_aborted, "stopped by callback");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+#ifdef LOAD_THREADS
+static void *lines_worker(void *arg) {
+    lines_t *lines = (lines_t *)arg;
+
+    pthread_mutex_lock(&lines->mutex);
+    while (!lines->stop && lines->next < lines->end) {
+        lines_chunk_t *chunk;
+
+        if (lines->taken - lines->delivered == lines->window) {
+            /* Don't decode too far ahead of the caller */
+            pthread_cond_wait(&lines->cond, &lines->mutex);
+            continue;
+        }
+
+        chunk = lines_take(lines);
+        pthread_mutex_unlock(&lines->mutex);
+
+        lines_decode(lines, chunk);
+
+        pthread_mutex_lock(&lines->mutex);
+        chunk->ready = 1;
+        pthread_cond_broadcast(&lines->cond);
+    }
+    pthread_mutex_unlock(&lines->mutex);
+    return NULL;
+}
+#endif
+
+size_t jsonp_cpu_count(void) {
+#if defined(HAVE_UNISTD_H) && defined(_SC_NPROCESSORS_ONLN)
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? (size_t)cpus : 1;
+#else
+    return 1;
+#endif
+}
+
+static size_t lines_threads(size_t threads, size_t length) {
+    size_t chunks = length / LINES_CHUNK_SIZE + 1;
+
+    if (threads == 0)
+        threads = jsonp_cpu_count();
+
+#ifdef LOAD_THREADS
+    return threads < chunks ? threads : chunks;
+#else
+    (void)chunks;
+    return 1;
+#endif
+}
+
+static int lines_run(const char *buffer, size_t buflen, size_t flags, size_t threads,
+                     json_lines_callback_t callback, void *data, json_t *result,
+                     json_error_t *error) {
+    lines_t lines;
+    size_t i;
+    int failed = 0, rest = 0;
+#ifdef LOAD_THREADS
+    pthread_t *workers = NULL;
+    size_t started = 0;
+#endif
+
+    threads = lines_threads(threads, buflen);
+
+    lines.buffer = buffer;
+    lines.end = buffer + buflen;
+    lines.flags = flags;
+    lines.next = buffer;
+    lines.taken = 0;
+    lines.delivered = 0;
+    lines.window = threads > 1 ? 2 * threads : 1;
+    lines.stop = 0;
+
+    lines.chunks = jsonp_malloc(lines.window * sizeof(lines_chunk_t));
+    if (!lines.chunks) {
+        error_set(error, NULL, json_error_out_of_memory, "out of memory");
+        return -1;
+    }
+
+#ifdef LOAD_THREADS
+    if (threads > 1) {
+        workers = jsonp_malloc(threads * sizeof(pthread_t));
+        if (workers && pthread_mutex_init(&lines.mutex, NULL) == 0) {
+            if (pthread_cond_init(&lines.cond, NULL) == 0) {
+                while (started < threads &&
+                       pthread_create(&workers[started], NULL, lines_worker, &lines) == 0)
+                    started++;
+                if (!started)
+                    pthread_cond_destroy(&lines.cond);
+            }
+            if (!started)
+                pthread_mutex_destroy(&lines.mutex);
+        }
+    }
+#define lines_lock()   (started ? (void)pthread_mutex_lock(&lines.mutex) : (void)0)
+#define lines_unlock() (started ? (void)pthread_mutex_unlock(&lines.mutex) : (void)0)
+#define lines_wait()   (void)pthread_cond_wait(&lines.cond, &lines.mutex)
+#define lines_wake()   (started ? (void)pthread_cond_broadcast(&lines.cond) : (void)0)
+#define lines_workers  started
+#else
+#define lines_lock()   (void)0
+#define lines_unlock() (void)0
+#define lines_wait()   (void)0
+#define lines_wake()   (void)0
+#define lines_workers  0
+#endif
+
+    /* Pass the chunks to the caller in input order. Without worker
+       threads, decode them here. */
+    lines_lock();
+    while (lines.delivered < lines.taken || lines.next < lines.end) {
+        lines_chunk_t *chunk;
+
+        if (lines.delivered == lines.taken && !lines_workers) {
+            chunk = lines_take(&lines);
+            lines_decode(&lines, chunk);
+            chunk->ready = 1;
+        }
+
+        chunk = &lines.chunks[lines.delivered % lines.window];
+        if (lines.delivered == lines.taken || !chunk->ready) {
+            lines_wait();
+            continue;
+        }
+
+        if (!chunk->values && chunk->end < lines.end &&
+            json_error_code(&chunk->error) == json_error_premature_end_of_input) {
+            /* A text spans lines and was cut. Decode the rest of the
+               input in one piece, so that the result doesn't depend
+               on where the chunks end. */
+            lines.stop = 1;
+            rest = 1;
+        }
+
+        lines_unlock();
+        if (rest) {
+            chunk->end = lines.end;
+            lines_decode(&lines, chunk);
+        }
+        failed = lines_deliver(&lines, chunk, callback, data, result, error);
+        json_decref(chunk->values);
+        lines_lock();
+
+        lines.delivered++;
+        lines_wake();
+        if (failed || rest)
+            break;
+    }
+    lines.stop = 1;
+    lines_wake();
+    lines_unlock();
+
+#ifdef LOAD_THREADS
+    if (started) {
+        for (i = 0; i < started; i++)
+            pthread_join(workers[i], NULL);
+        pthread_cond_destroy(&lines.cond);
+        pthread_mutex_destroy(&lines.mutex);
+    }
+    jsonp_free(workers);
+#endif
+#undef lines_lock
+#undef lines_unlock
+#undef lines_wait
+#undef lines_wake
+#undef lines_workers
+
+    /* Chunks that were decoded after an error */
+    for (i = lines.delivered; i < lines.taken; i++)
+        json_decref(lines.chunks[i % lines.window].values);
+    jsonp_free(lines.chunks);
+
+    if (!failed && error)
+        error->position = (int)buflen;
+    return failed ? -1 : 0;
+}
+
+json_t *json_loadb_lines(const char *buffer, size_t buflen, size_t flags, size_t threads,
+                         json_error_t *error) {
+    json_t *result;
+
+    jsonp_error_init(error, "<buffer>");
+
+    if (buffer == NULL) {
+        error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
+        return NULL;
+    }
+
+    result = json_array();
+    if (!result) {
+        error_set(error, NULL, json_error_out_of_memory, "out of memory");
+        return NULL;
+    }
+
+    if (lines_run(buffer, buflen, flags, threads, NULL, NULL, result, error)) {
+        json_decref(result);
+        return NULL;
+    }
+    return result;
+}
+
+int json_loadb_lines_callback(const char *buffer, size_t buflen, size_t flags,
+                              size_t threads, json_lines_callback_t callback, void *data,
+                              json_error_t *error) {
+    jsonp_error_init(error, "<buffer>");
+
+    if (buffer == NULL || callback == NULL) {
+        error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
+        return -1;
+    }
+
+    return lines_run(buffer, buflen, flags, threads, callback, data, NULL, error);
+}
+
+/*** event parser ***/
+
+/* The same grammar as parse_value() and friends, but the values are
+   passed to callbacks instead of being built */
+
+static int sax_stop(lex_t *lex, json_error_t *error) {
+    error_set(error, lex, json_error_aborted, "stopped by callback");
+    return -1;
+}
+
+static int sax_value(lex_t *lex, const json_sax_callbacks_t *callbacks, void *data,
+                     json_error_t *error);
+
+static int sax_object(lex_t *lex, const json_sax_callbacks_t *callbacks, void *data,
+                      json_error_t *error) {
+    if (callbacks->start_object && callbacks->start_object(data))
+        return sax_stop(lex, error);
+
+    lex_scan(lex, error);
+    if (lex->token != '}') {
+        while (1) {
+            const char *key;
+            size_t len;
+
+            if (lex->token != TOKEN_STRING) {
+                error_set(error, lex, json_error_invalid_syntax,
+                          "string or '}' expected");
+                return -1;
+            }
+
+            key = lex->value.string.val;
+            len = lex->value.string.len;
+            if (memchr(key, '\0', len)) {
+                error_set(error, lex, json_error_null_byte_in_key,
+                          "NUL byte in object key not supported");
+                return -1;
+            }
+
+            if (callbacks->key && callbacks->key(key, len, data))
+                return sax_stop(lex, error);
+
+            lex_scan(lex, error);
+            if (lex->token != ':') {
+                error_set(error, lex, json_error_invalid_syntax, "':' expected");
+                return -1;
+            }
+
+            lex_scan(lex, error);
+            if (sax_value(lex, callbacks, data, error))
+                return -1;
+
+            lex_scan(lex, error);
+            if (lex->token != ',')
+                break;
+
+            lex_scan(lex, error);
+        }
+
+        if (lex->token != '}') {
+            error_set(error, lex, json_error_invalid_syntax, "'}' expected");
+            return -1;
+        }
+    }
+
+    if (callbacks->end_object && callbacks->end_object(data))
+        return sax_stop(lex, error);
+    return 0;
+}
+
+static int sax_array(lex_t *lex, const json_sax_callbacks_t *callbacks, void *data,
+                     json_error_t *error) {
+    if (callbacks->start_array && callbacks->start_array(data))
+        return sax_stop(lex, error);
+
+    lex_scan(lex, error);
+    if (lex->token != ']') {
+        while (lex->token) {
+            if (sax_value(lex, callbacks, data, error))
+                return -1;
+
+            lex_scan(lex, error);
+            if (lex->token != ',')
+                break;
+
+            lex_scan(lex, error);
+        }
+
+        if (lex->token != ']') {
+            error_set(error, lex, json_error_invalid_syntax, "']' expected");
+            return -1;
+        }
+    }
+
+    if (callbacks->end_array && callbacks->end_array(data))
+        return sax_stop(lex, error);
+    return 0;
+}
+
+static int sax_value(lex_t *lex, const json_sax_callbacks_t *callbacks, void *data,
+                     json_error_t *error) {
+    int result;
+
+    lex->depth++;
+    if (lex->depth > JSON_PARSER_MAX_DEPTH) {
+        error_set(error, lex, json_error_stack_overflow, "maximum parsing depth reached");
+        return -1;
+    }
+
+    switch (lex->token) {
+        case TOKEN_STRING: {
+            const char *value = lex->value.string.val;
+            size_t len = lex->value.string.len;
+
+            if (!(lex->flags & JSON_ALLOW_NUL)) {
+                if (memchr(value, '\0', len)) {
+                    error_set(error, lex, json_error_null_character,
+                              "\\u0000 is not allowed without JSON_ALLOW_NUL");
+                    return -1;
+                }
+            }
+
+            result = callbacks->string ? callbacks->string(value, len, data) : 0;
+            break;
+        }
+
+        case TOKEN_INTEGER:
+            result = callbacks->integer ? callbacks->integer(lex->value.integer, data) : 0;
+            break;
+
+        case TOKEN_REAL:
+            result = callbacks->real ? callbacks->real(lex->value.real, data) : 0;
+            break;
+
+        case TOKEN_TRUE:
+            result = callbacks->boolean ? callbacks->boolean(1, data) : 0;
+            break;
+
+        case TOKEN_FALSE:
+            result = callbacks->boolean ? callbacks->boolean(0, data) : 0;
+            break;
+
+        case TOKEN_NULL:
+            result = callbacks->null ? callbacks->null(data) : 0;
+            break;
+
+        case '{':
+            if (sax_object(lex, callbacks, data, error))
+                return -1;
+            result = 0;
+            break;
+
+        case '[':
+            if (sax_array(lex, callbacks, data, error))
+                return -1;
+            result = 0;
+            break;
+
+        case TOKEN_INVALID:
+            error_set(error, lex, json_error_invalid_syntax, "invalid token");
+            return -1;
+
+        default:
+            error_set(error, lex, json_error_invalid_syntax, "unexpected token");
+            return -1;
+    }
+
+    if (result)
+        return sax_stop(lex, error);
+
+    lex->depth--;
+    return 0;
+}
+
+static int sax_json(lex_t *lex, const json_sax_callbacks_t *callbacks, void *data,
+                    json_error_t *error) {
+    lex->depth = 0;
+
+    lex_scan(lex, error);
+    if (!(lex->flags & JSON_DECODE_ANY)) {
+        if (lex->token != '[' && lex->token != '{') {
+            error_set(error, lex, json_error_invalid_syntax, "'[' or '{' expected");
+            return -1;
+        }
+    }
+
+    if (sax_value(lex, callbacks, data, error))
+        return -1;
+
+    if (!(lex->flags & JSON_DISABLE_EOF_CHECK)) {
+        lex_scan(lex, error);
+        if (lex->token != TOKEN_EOF) {
+            error_set(error, lex, json_error_end_of_input_expected,
+                      "end of file expected");
+            return -1;
+        }
+    }
+
+    if (error) {
+        /* Save the position even though there was no error */
+        error->position = (int)stream_position(&lex->stream);
+    }
+
+    return 0;
+}
+
+int json_sax_loadb(const char *buffer, size_t buflen, size_t flags,
+                   const json_sax_callbacks_t *callbacks, void *data, json_error_t *error) {
+    lex_t lex;
+    int result;
+
+    jsonp_error_init(error, "<buffer>");
+
+    if (buffer == NULL || callbacks == NULL) {
+        error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
+        return -1;
+    }
+
+    if (lex_init_memory(&lex, buffer, buflen, flags)) {
+        error_set(error, NULL, json_error_out_of_memory, "out of memory");
+        return -1;
+    }
+
+    result = sax_json(&lex, callbacks, data, error);
+
+    lex_close(&lex);
+    return result;
+}
+
+int json_sax_loadf(FILE *input, size_t flags, const json_sax_callbacks_t *callbacks,
+                   void *data, json_error_t *error) {
+    lex_t lex;
+    file_data_t file_data;
+    int result;
+
+    jsonp_error_init(error, input == stdin ? "<stdin>" : "<stream>");
+
+    if (input == NULL || callbacks == NULL) {
+        error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
+        return -1;
+    }
+
+    file_data.fp = input;
+    file_data.bytewise = (flags & JSON_DISABLE_EOF_CHECK) != 0;
+
+    if (lex_init(&lex, file_fill, flags, &file_data)) {
+        error_set(error, NULL, json_error_out_of_memory, "out of memory");
+        return -1;
+    }
+
+    result = sax_json(&lex, callbacks, data, error);
+
+    lex_close(&lex);
+    return result;
+}
+
+int json_sax_load_callback(json_load_callback_t callback, void *arg, size_t flags,
+                           const json_sax_callbacks_t *callbacks, void *data,
+                           json_error_t *error) {
+    lex_t lex;
+    callback_data_t stream_data;
+    int result;
+
+    stream_data.callback = callback;
+    stream_data.arg = arg;
+
+    jsonp_error_init(error, "<callback>");
+
+    if (callback == NULL || callbacks == NULL) {
+        error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
+        return -1;
+    }
+
+    if (lex_init(&lex, callback_fill, flags, &stream_data)) {
+        error_set(error, NULL, json_error_out_of_memory, "out of memory");
+        return -1;
+    }
+
+    result = sax_json(&lex, callbacks, data, error);
+
+    lex_close(&lex);
+    return result;
+}
+
+/*** incremental parser ***/
+
+#define PARSER_START 0 /* nothing decoded yet */
+#define PARSER_VALUE 1 /* inside the value */
+#define PARSER_END   2 /* the value is complete, end of input expected */
+#define PARSER_DONE  3
+#define PARSER_ERROR 4
+
+#define FRAME_OBJECT_FIRST 0 /* after '{' */
+#define FRAME_OBJECT_KEY   1 /* after ',' */
+#define FRAME_OBJECT_COLON 2 /* after a key */
+#define FRAME_OBJECT_VALUE 3 /* after ':' */
+#define FRAME_OBJECT_NEXT  4 /* after a member */
+#define FRAME_ARRAY_FIRST  5 /* after '[' */
+#define FRAME_ARRAY_VALUE  6 /* after ',' */
+#define FRAME_ARRAY_NEXT   7 /* after an element */
+
+/* An array or object that is being decoded */
+typedef struct {
+    json_t *container;
+    json_t **slot; /* value of the member that is being decoded */
+    int state;
+} parser_frame_t;
+
+struct json_parser {
+    lex_t lex;
+    size_t flags;
+    int state;
+    parser_frame_t *stack;
+    size_t depth; /* number of frames in stack */
+    size_t stack_size;
+    json_t *value;
+    size_t scanned; /* bytes of an incomplete token that have been seen */
+    json_error_t error;
+};
+
+/* Forget the error left by an earlier partial token or call. The
+   error code is kept apart from the text, so clear it too. */
+static void parser_error_init(json_parser_t *parser) {
+    jsonp_error_init(&parser->error, "<parser>");
+    parser->error.text[JSON_ERROR_TEXT_LENGTH - 1] = json_error_unknown;
+}
+
+json_parser_t *json_parser_new(size_t flags) {
+    json_parser_t *parser = jsonp_malloc(sizeof(json_parser_t));
+    if (!parser)
+        return NULL;
+
+    if (lex_init(&parser->lex, NULL, flags, NULL)) {
+        jsonp_free(parser);
+        return NULL;
+    }
+    parser->lex.stream.partial = 1;
+
+    parser->flags = flags;
+    parser->state = PARSER_START;
+    parser->stack = NULL;
+    parser->depth = 0;
+    parser->stack_size = 0;
+    parser->value = NULL;
+    parser->scanned = 0;
+    parser_error_init(parser);
+    return parser;
+}
+
+void json_parser_free(json_parser_t *parser) {
+    if (!parser)
+        return;
+
+    while (parser->depth > 0) {
+        parser_frame_t *frame = &parser->stack[--parser->depth];
+        json_decref(frame->container);
+    }
+    jsonp_free(parser->stack);
+    json_decref(parser->value);
+    lex_close(&parser->lex);
+    jsonp_free(parser);
+}
+
+/* A value has been decoded completely, add it to the enclosing array
+   or object */
+static int parser_add_value(json_parser_t *parser, json_t *value) {
+    parser_frame_t *frame;
+
+    if (parser->depth == 0) {
+        parser->value = value;
+        parser->state = PARSER_END;
+        return 0;
+    }
+
+    frame = &parser->stack[parser->depth - 1];
+    if (json_is_object(frame->container)) {
+        if (*frame->slot)
+            jsonp_disown(frame->container, *frame->slot);
+        json_decref(*frame->slot);
+        *frame->slot = value;
+        frame->slot = NULL;
+        jsonp_adopt(frame->container, value);
+        frame->state = FRAME_OBJECT_NEXT;
+    } else {
+        if (json_array_append_new(frame->container, value))
+            return -1;
+        frame->state = FRAME_ARRAY_NEXT;
+    }
+    return 0;
+}
+
+/* The closing bracket of the innermost array or object was read */
+static int parser_pop(json_parser_t *parser) {
+    json_t *container = parser->stack[--parser->depth].container;
+    return parser_add_value(parser, container);
+}
+
+static int parser_push(json_parser_t *parser, json_t *container, int state) {
+    parser_frame_t *frame;
+
+    if (!container)
+        return -1;
+
+    if (parser->depth == parser->stack_size) {
+        size_t new_size = parser->stack_size ? parser->stack_size * 2 : 8;
+        parser_frame_t *new_stack =
+            jsonp_realloc(parser->stack, parser->stack_size * sizeof(parser_frame_t),
+                          new_size * sizeof(parser_frame_t));
+        if (!new_stack) {
+            json_decref(container);
+            return -1;
+        }
+        parser->stack = new_stack;
+        parser->stack_size = new_size;
+    }
+
+    frame = &parser->stack[parser->depth++];
+    frame->container = container;
+    frame->slot = NULL;
+    frame->state = state;
+    return 0;
+}
+
+/* The current token starts a value. This is parse_value() without
+   the recursion. */
+static int parser_value(json_parser_t *parser) {
+    lex_t *lex = &parser->lex;
+    json_error_t *error = &parser->error;
+    json_t *json;
+
+    if (parser->depth + 1 > JSON_PARSER_MAX_DEPTH) {
+        error_set(error, lex, json_error_stack_overflow, "maximum parsing depth reached");
+        return -1;
+    }
+
+    switch (lex->token) {
+        case TOKEN_STRING: {
+            const char *value = lex->value.string.val;
+            size_t len = lex->value.string.len;
+
+            if (!(parser->flags & JSON_ALLOW_NUL)) {
+                if (memchr(value, '\0', len)) {
+                    error_set(error, lex, json_error_null_character,
+                              "\\u0000 is not allowed without JSON_ALLOW_NUL");
+                    return -1;
+                }
+            }
+
+            json = json_stringn_nocheck(value, len);
+            break;
+        }
+
+        case TOKEN_INTEGER:
+            json = json_integer(lex->value.integer);
+            break;
+
+        case TOKEN_REAL:
+            json = json_real(lex->value.real);
+            break;
+
+        case TOKEN_TRUE:
+            json = json_true();
+            break;
+
+        case TOKEN_FALSE:
+            json = json_false();
+            break;
+
+        case TOKEN_NULL:
+            json = json_null();
+            break;
+
+        case '{':
+            return parser_push(parser, json_object(), FRAME_OBJECT_FIRST);
+
+        case '[':
+            return parser_push(parser, json_array(), FRAME_ARRAY_FIRST);
+
+        case TOKEN_INVALID:
+            error_set(error, lex, json_error_invalid_syntax, "invalid token");
+            return -1;
+
+        default:
+            error_set(error, lex, json_error_invalid_syntax, "unexpected token");
+            return -1;
+    }
+
+    if (!json)
+        return -1;
+
+    return parser_add_value(parser, json);
+}
+
+/* Take the current token, following the same rules and giving the
+   same errors as parse_object() and parse_array() */
+static int parser_token(json_parser_t *parser) {
+    lex_t *lex = &parser->lex;
+    json_error_t *error = &parser->error;
+    parser_frame_t *frame;
+    const char *key;
+    size_t len;
+
+    if (parser->state == PARSER_START) {
+        if (!(parser->flags & JSON_DECODE_ANY)) {
+            if (lex->token != '[' && lex->token != '{') {
+                error_set(error, lex, json_error_invalid_syntax, "'[' or '{' expected");
+                return -1;
+            }
+        }
+        parser->state = PARSER_VALUE;
+        return parser_value(parser);
+    }
+
+    if (parser->state == PARSER_END) {
+        if (lex->token != TOKEN_EOF) {
+            error_set(error, lex, json_error_end_of_input_expected,
+                      "end of file expected");
+            return -1;
+        }
+        parser->state = PARSER_DONE;
+        return 0;
+    }
+
+    frame = &parser->stack[parser->depth - 1];
+    switch (frame->state) {
+        case FRAME_OBJECT_FIRST:
+            if (lex->token == '}')
+                return parser_pop(parser);
+            /* fall through */
+
+        case FRAME_OBJECT_KEY:
+            if (lex->token != TOKEN_STRING) {
+                error_set(error, lex, json_error_invalid_syntax, "string or '}' expected");
+                return -1;
+            }
+
+            key = lex->value.string.val;
+            len = lex->value.string.len;
+            if (memchr(key, '\0', len)) {
+                error_set(error, lex, json_error_null_byte_in_key,
+                          "NUL byte in object key not supported");
+                return -1;
+            }
+
+            if (parser->flags & JSON_REJECT_DUPLICATES) {
+                if (json_object_getn(frame->container, key, len)) {
+                    error_set(error, lex, json_error_duplicate_key,
+                              "duplicate object key");
+                    return -1;
+                }
+            }
+
+            frame->slot =
+                hashtable_reserve(&json_to_object(frame->container)->hashtable, key, len);
+            if (!frame->slot)
+                return -1;
+
+            frame->state = FRAME_OBJECT_COLON;
+            return 0;
+
+        case FRAME_OBJECT_COLON:
+            if (lex->token != ':') {
+                error_set(error, lex, json_error_invalid_syntax, "':' expected");
+                return -1;
+            }
+            frame->state = FRAME_OBJECT_VALUE;
+            return 0;
+
+        case FRAME_OBJECT_VALUE:
+            return parser_value(parser);
+
+        case FRAME_OBJECT_NEXT:
+            if (lex->token == ',') {
+                frame->state = FRAME_OBJECT_KEY;
+                return 0;
+            }
+            if (lex->token != '}') {
+                error_set(error, lex, json_error_invalid_syntax, "'}' expected");
+                return -1;
+            }
+            return parser_pop(parser);
+
+        case FRAME_ARRAY_FIRST:
+            if (lex->token == ']')
+                return parser_pop(parser);
+            /* fall through */
+
+        case FRAME_ARRAY_VALUE:
+            if (lex->token == TOKEN_EOF) {
+                error_set(error, lex, json_error_invalid_syntax, "']' expected");
+                return -1;
+            }
+            return parser_value(parser);
+
+        case FRAME_ARRAY_NEXT:
+            if (lex->token == ',') {
+                frame->state = FRAME_ARRAY_VALUE;
+                return 0;
+            }
+            if (lex->token != ']') {
+                error_set(error, lex, json_error_invalid_syntax, "']' expected");
+                return -1;
+            }
+            return parser_pop(parser);
+
+        default:
+            assert(0);
+            return -1;
+    }
+}
+
+/* Whether the input in [from, end) may end the incomplete token that
+   starts at token. If not, there's no point in scanning it again. */
+static int token_may_end(const char *token, const char *from, const char *end) {
+    if (*token == '"')
+        return memchr(from, '"', (size_t)(end - from)) != NULL;
+
+    /* numbers and literals */
+    for (; from < end; from++) {
+        char c = *from;
+        if (!l_isalpha(c) && !l_isdigit(c) && c != '.' && c != '+' && c != '-')
+            return 1;
+    }
+    return 0;
+}
+
+/* Decode the tokens that are complete in the input fed so far.
+   Returns 1 if the value is complete, 0 if more input is needed, or
+   -1 on error. */
+static int parser_run(json_parser_t *parser) {
+    lex_t *lex = &parser->lex;
+    stream_t *stream = &lex->stream;
+
+    parser_error_init(parser);
+
+    while (parser->state != PARSER_DONE) {
+        if (parser->state == PARSER_END) {
+            if (parser->flags & JSON_DISABLE_EOF_CHECK) {
+                parser->state = PARSER_DONE;
+                break;
+            }
+        }
+
+        if (parser->scanned && stream->partial &&
+            !token_may_end(stream->pos, stream->pos + parser->scanned, stream->end))
+            goto incomplete;
+
+        lex_scan(lex, &parser->error);
+
+        if (stream->state == STREAM_STATE_EOF && stream->partial) {
+            /* The token may continue in input that hasn't been fed
+               yet. Skip the whitespace before it and scan it again,
+               validating its UTF-8 again too, when there's more. */
+            if (stream->token) {
+                stream->pos = stream->token;
+                parser->scanned = (size_t)(stream->end - stream->token);
+            } else
+                parser->scanned = 0;
+
+            stream->state = STREAM_STATE_OK;
+            stream->token = stream->checked = NULL;
+            lex->token = TOKEN_INVALID;
+            parser_error_init(parser);
+            goto incomplete;
+        }
+        parser->scanned = 0;
+
+        if (parser_token(parser)) {
+            parser->state = PARSER_ERROR;
+            return -1;
+        }
+    }
+
+    parser->error.position = (int)stream_position(stream);
+    return 1;
+
+incomplete:
+    return parser->state == PARSER_END ? 1 : 0;
+}
+
+static void parser_copy_error(const json_parser_t *parser, json_error_t *error) {
+    if (error)
+        *error = parser->error;
+}
+
+int json_parser_feed(json_parser_t *parser, const char *buffer, size_t buflen,
+                     json_error_t *error) {
+    int result;
+
+    if (!parser || (!buffer && buflen)) {
+        jsonp_error_init(error, "<parser>");
+        error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
+        return -1;
+    }
+
+    if (parser->state == PARSER_ERROR) {
+        parser_copy_error(parser, error);
+        return -1;
+    }
+
+    if (buflen && !parser->lex.stream.partial) {
+        error_set(&parser->error, NULL, json_error_invalid_argument,
+                  "input fed after json_parser_finish()");
+        parser->state = PARSER_ERROR;
+        parser_copy_error(parser, error);
+        return -1;
+    }
+
+    if (parser->state != PARSER_DONE && buflen) {
+        if (stream_append(&parser->lex.stream, buffer, buflen)) {
+            error_set(&parser->error, NULL, json_error_out_of_memory, "out of memory");
+            parser->state = PARSER_ERROR;
+            parser_copy_error(parser, error);
+            return -1;
+        }
+    }
+
+    result = parser_run(parser);
+    parser_copy_error(parser, error);
+    return result;
+}
+
+json_t *json_parser_finish(json_parser_t *parser, json_error_t *error) {
+    json_t *result;
+
+    if (!parser) {
+        jsonp_error_init(error, "<parser>");
+        error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
+        return NULL;
+    }
+
+    parser->lex.stream.partial = 0;
+
+    if (parser->state == PARSER_ERROR || parser_run(parser) != 1) {
+        parser_copy_error(parser, error);
+        return NULL;
+    }
+
+    parser_copy_error(parser, error);
+    result = parser->value;
+    parser->value = NULL;
+    return result;
+}
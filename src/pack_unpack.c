@@ -34,8 +34,8 @@ typedef struct {
 
 #define token(scanner) ((scanner)->token.token)
 
-static const char *const type_names[] = {"object", "array", "string", "integer",
-                                         "real",   "true",  "false",  "null"};
+static const char *const type_names[] = {"object", "array", "string", "integer", "real",
+                                         "true",   "false", "null",   "raw"};
 
 #define type_name(x) type_names[json_typeof(x)]
 
@@ -0,0 +1,184 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "scan.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define SCAN_SSE2 1
+#define SCAN_AVX2 1
+#include <immintrin.h>
+#elif defined(_MSC_VER) && defined(_M_X64)
+#define SCAN_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#define SCAN_IMPL_UNKNOWN 0
+#define SCAN_IMPL_SCALAR  1
+#define SCAN_IMPL_SSE2    2
+#define SCAN_IMPL_AVX2    3
+
+/* Selected on first use. Every thread computes the same value, so
+   racing on the initialization is harmless. */
+static volatile int scan_impl = SCAN_IMPL_UNKNOWN;
+
+static int scan_select(void) {
+    int impl = SCAN_IMPL_SCALAR;
+
+#ifdef SCAN_SSE2
+    impl = SCAN_IMPL_SSE2;
+#endif
+#ifdef SCAN_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        impl = SCAN_IMPL_AVX2;
+#endif
+
+    scan_impl = impl;
+    return impl;
+}
+
+static uint64_t scan_whitespace_scalar(const char *block) {
+    uint64_t mask = 0;
+    int i;
+
+    for (i = SCAN_BLOCK_SIZE - 1; i >= 0; i--) {
+        char c = block[i];
+        mask = (mask << 1) | (c == ' ' || c == '\t' || c == '\n' || c == '\r');
+    }
+    return mask;
+}
+
+#ifdef SCAN_SSE2
+static uint64_t scan_whitespace_sse2(const char *block) {
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i cr = _mm_set1_epi8('\r');
+    uint64_t mask = 0;
+    int i;
+
+    for (i = 0; i < SCAN_BLOCK_SIZE; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(block + i));
+        __m128i ws = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(v, tab)),
+            _mm_or_si128(_mm_cmpeq_epi8(v, newline), _mm_cmpeq_epi8(v, cr)));
+        mask |= (uint64_t)(unsigned int)_mm_movemask_epi8(ws) << i;
+    }
+    return mask;
+}
+#endif
+
+#ifdef SCAN_AVX2
+__attribute__((target("avx2"))) static uint64_t scan_whitespace_avx2(const char *block) {
+    const __m256i space = _mm256_set1_epi8(' ');
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i newline = _mm256_set1_epi8('\n');
+    const __m256i cr = _mm256_set1_epi8('\r');
+    __m256i lo = _mm256_loadu_si256((const __m256i *)block);
+    __m256i hi = _mm256_loadu_si256((const __m256i *)(block + 32));
+    __m256i ws_lo, ws_hi;
+
+    ws_lo = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(lo, space), _mm256_cmpeq_epi8(lo, tab)),
+        _mm256_or_si256(_mm256_cmpeq_epi8(lo, newline), _mm256_cmpeq_epi8(lo, cr)));
+    ws_hi = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(hi, space), _mm256_cmpeq_epi8(hi, tab)),
+        _mm256_or_si256(_mm256_cmpeq_epi8(hi, newline), _mm256_cmpeq_epi8(hi, cr)));
+
+    return (uint64_t)(unsigned int)_mm256_movemask_epi8(ws_lo) |
+           (uint64_t)(unsigned int)_mm256_movemask_epi8(ws_hi) << 32;
+}
+#endif
+
+/* In signed comparison, bytes below 0x20 and bytes from 0x80 up are
+   both less than 0x20 */
+#define string_special(c) ((c) == '"' || (c) == '\\' || (signed char)(c) < 0x20)
+
+static const char *scan_string_scalar(const char *p, const char *end) {
+    while (p < end && !string_special(*p))
+        p++;
+    return p;
+}
+
+#ifdef SCAN_SSE2
+static const char *scan_string_sse2(const char *p, const char *end) {
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i control = _mm_set1_epi8(0x20);
+
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        __m128i special = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)),
+            _mm_cmplt_epi8(v, control));
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(special);
+        if (mask)
+            return p + jsonp_ctz64(mask);
+        p += 16;
+    }
+    return scan_string_scalar(p, end);
+}
+#endif
+
+#ifdef SCAN_AVX2
+__attribute__((target("avx2"))) static const char *scan_string_avx2(const char *p,
+                                                                     const char *end) {
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i control = _mm256_set1_epi8(0x20);
+
+    while (end - p >= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)p);
+        __m256i special = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, backslash)),
+            _mm256_cmpgt_epi8(control, v));
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(special);
+        if (mask)
+            return p + jsonp_ctz64(mask);
+        p += 32;
+    }
+    return scan_string_sse2(p, end);
+}
+#endif
+
+uint64_t jsonp_scan_whitespace(const char *block) {
+    int impl = scan_impl;
+    if (impl == SCAN_IMPL_UNKNOWN)
+        impl = scan_select();
+
+    switch (impl) {
+#ifdef SCAN_AVX2
+        case SCAN_IMPL_AVX2:
+            return scan_whitespace_avx2(block);
+#endif
+#ifdef SCAN_SSE2
+        case SCAN_IMPL_SSE2:
+            return scan_whitespace_sse2(block);
+#endif
+        default:
+            return scan_whitespace_scalar(block);
+    }
+}
+
+const char *jsonp_scan_string(const char *p, const char *end) {
+    int impl = scan_impl;
+    if (impl == SCAN_IMPL_UNKNOWN)
+        impl = scan_select();
+
+    switch (impl) {
+#ifdef SCAN_AVX2
+        case SCAN_IMPL_AVX2:
+            return scan_string_avx2(p, end);
+#endif
+#ifdef SCAN_SSE2
+        case SCAN_IMPL_SSE2:
+            return scan_string_sse2(p, end);
+#endif
+        default:
+            return scan_string_scalar(p, end);
+    }
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef SCAN_H
+#define SCAN_H
+
+#ifdef HAVE_CONFIG_H
+#include <jansson_private_config.h>
+#endif
+
+#include <stddef.h>
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#include "jansson.h"
+
+/* Number of input bytes classified by one call */
+#define SCAN_BLOCK_SIZE 64
+
+/* Classify the SCAN_BLOCK_SIZE bytes at block. Bit i of the result is
+   set if block[i] is JSON whitespace (space, tab, newline or carriage
+   return). Uses SIMD instructions if the CPU supports them. */
+uint64_t jsonp_scan_whitespace(const char *block);
+
+/* Return a pointer to the first byte in [p, end) that can't be copied
+   as is from a string literal: a quote, a backslash, a control
+   character or a non-ASCII byte. Returns end if there is none. */
+const char *jsonp_scan_string(const char *p, const char *end);
+
+/* Index of the lowest set bit, mask must not be zero */
+static JSON_INLINE unsigned int jsonp_ctz64(uint64_t mask) {
+#if defined(__GNUC__)
+    return (unsigned int)__builtin_ctzll(mask);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    unsigned long n;
+    _BitScanForward64(&n, mask);
+    return (unsigned int)n;
+#else
+    unsigned int n = 0;
+    while (!(mask & 1)) {
+        mask >>= 1;
+        n++;
+    }
+    return n;
+#endif
+}
+
+#endif
@@ -2,6 +2,7 @@
 #include "strbuffer.h"
 #include <assert.h>
 #include <errno.h>
+#include <float.h>
 #include <math.h>
 #include <stdio.h>
 #include <string.h>
@@ -11,78 +12,761 @@
 #include <jansson_private_config.h>
 #endif
 
-/*
-  - This code assumes that the decimal separator is exactly one
-    character.
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
 
-  - If setlocale() is called by another thread between the call to
-    get_decimal_point() and the call to sprintf() or strtod(), the
-    result may be wrong. setlocale() is not thread-safe and should
-    not be used this way. Multi-threaded programs should use
-    uselocale() instead.
-*/
-static char get_decimal_point() {
-    char buf[3];
-    sprintf(buf, "%#.0f", 1.0); // "1." in the current locale
-    return buf[1];
+#include "pow10.h"
+
+/*** decimal to double conversion ***/
+
+/* Numbers are converted without strtod(), so that the result doesn't
+   depend on the locale, and the input doesn't need to be NUL
+   terminated. The input is a valid JSON number.
+
+   Most numbers have at most 19 significant digits, which fit in a
+   uint64_t. If the digits and the power of ten are small enough,
+   the conversion is exact in double arithmetic. Otherwise the
+   Eisel-Lemire algorithm multiplies the digits by a 128-bit
+   approximation of the power of ten, which gives the correctly
+   rounded result unless the approximation is too close to halfway
+   between two doubles. Those cases, and subnormal and infinite
+   results, are handled with an arbitrary precision decimal. This
+   follows the implementation in Go's strconv package. */
+
+#define MANTISSA_DIGITS 19
+
+/* Digits and exponents beyond these only matter for numbers that are
+   zero or infinite anyway, and keep the arithmetic from overflowing */
+#define MAX_DIGIT_COUNT 100000000
+#define MAX_EXPONENT    100000000
+
+#define DECIMAL_DIGITS    800 /* enough to decide any halfway case */
+#define DECIMAL_MAX_SHIFT 60
+
+#define is_digit(c) ('0' <= (c) && (c) <= '9')
+
+typedef struct {
+    unsigned char digits[DECIMAL_DIGITS]; /* 0-9, most significant first */
+    int count;
+    int point;     /* position of the decimal point in digits */
+    int truncated; /* nonzero digits were dropped after the last one */
+} decimal_t;
+
+static double bits_to_double(uint64_t bits) {
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
 }
 
-static void to_locale(strbuffer_t *strbuffer) {
-    char point;
-    char *pos;
+/* Returns the high 64 bits of a * b, and stores the low 64 bits */
+static uint64_t mul_64x64(uint64_t a, uint64_t b, uint64_t *low) {
+#ifdef __SIZEOF_INT128__
+    unsigned __int128 product = (unsigned __int128)a * b;
+    *low = (uint64_t)product;
+    return (uint64_t)(product >> 64);
+#else
+    uint64_t a_lo = a & 0xFFFFFFFF, a_hi = a >> 32;
+    uint64_t b_lo = b & 0xFFFFFFFF, b_hi = b >> 32;
+    uint64_t lo_lo = a_lo * b_lo, hi_lo = a_hi * b_lo;
+    uint64_t lo_hi = a_lo * b_hi, hi_hi = a_hi * b_hi;
+    uint64_t cross = (lo_lo >> 32) + (hi_lo & 0xFFFFFFFF) + lo_hi;
+
+    *low = (cross << 32) | (lo_lo & 0xFFFFFFFF);
+    return (hi_lo >> 32) + (cross >> 32) + hi_hi;
+#endif
+}
 
-    point = get_decimal_point();
-    if (point == '.') {
-        /* No conversion needed */
+static int clz64(uint64_t value) {
+#ifdef __GNUC__
+    return __builtin_clzll(value);
+#else
+    int count = 0;
+    while (!(value & ((uint64_t)1 << 63))) {
+        value <<= 1;
+        count++;
+    }
+    return count;
+#endif
+}
+
+/* Converts mantissa * 10^exp10 to a double. mantissa must not be
+   zero. Returns -1 if the result can't be decided this way. */
+static int eisel_lemire(uint64_t mantissa, int exp10, int negative, double *out) {
+    const uint64_t *power;
+    uint64_t x_hi, x_lo, bits, exp2;
+    int clz, msb;
+
+    if (exp10 < POW10_MIN_EXP10 || exp10 > POW10_MAX_EXP10)
+        return -1;
+    power = pow10_table[exp10 - POW10_MIN_EXP10];
+
+    clz = clz64(mantissa);
+    mantissa <<= clz;
+    /* (217706 * exp10) >> 16 is floor(log2(10^exp10)) */
+    exp2 = (uint64_t)(((217706 * exp10) >> 16) + 64 + 1023) - (uint64_t)clz;
+
+    x_hi = mul_64x64(mantissa, power[1], &x_lo);
+
+    /* The low bits of the high half may be off because the low half of
+       the power was left out, take it into account */
+    if ((x_hi & 0x1FF) == 0x1FF && x_lo + mantissa < mantissa) {
+        uint64_t y_hi, y_lo, merged_hi = x_hi, merged_lo;
+
+        y_hi = mul_64x64(mantissa, power[0], &y_lo);
+        merged_lo = x_lo + y_hi;
+        if (merged_lo < x_lo)
+            merged_hi++;
+
+        if ((merged_hi & 0x1FF) == 0x1FF && merged_lo + 1 == 0 &&
+            y_lo + mantissa < mantissa)
+            return -1;
+
+        x_hi = merged_hi;
+        x_lo = merged_lo;
+    }
+
+    /* keep 54 bits */
+    msb = (int)(x_hi >> 63);
+    bits = x_hi >> (msb + 9);
+    exp2 -= 1 ^ msb;
+
+    /* too close to halfway */
+    if (x_lo == 0 && (x_hi & 0x1FF) == 0 && (bits & 3) == 1)
+        return -1;
+
+    /* round to 53 bits */
+    bits += bits & 1;
+    bits >>= 1;
+    if (bits >> 53) {
+        bits >>= 1;
+        exp2++;
+    }
+
+    /* subnormal or infinite */
+    if (exp2 - 1 >= 0x7FF - 1)
+        return -1;
+
+    bits = (exp2 << 52) | (bits & 0x000FFFFFFFFFFFFF);
+    if (negative)
+        bits |= (uint64_t)1 << 63;
+
+    *out = bits_to_double(bits);
+    return 0;
+}
+
+static void decimal_trim(decimal_t *d) {
+    while (d->count > 0 && d->digits[d->count - 1] == 0)
+        d->count--;
+    if (d->count == 0)
+        d->point = 0;
+}
+
+static void decimal_init(decimal_t *d, const char *str, const char *end) {
+    const char *pos = str;
+    int digits = 0, point_seen = 0, exp = 0, exp_negative = 0;
+
+    d->count = 0;
+    d->point = 0;
+    d->truncated = 0;
+
+    if (*pos == '-')
+        pos++;
+
+    for (; pos < end; pos++) {
+        if (*pos == '.') {
+            point_seen = 1;
+            d->point = digits;
+            continue;
+        }
+        if (!is_digit(*pos))
+            break;
+
+        if (*pos == '0' && digits == 0) {
+            /* leading zero */
+            if (d->point > -MAX_DIGIT_COUNT)
+                d->point--;
+            continue;
+        }
+
+        if (d->count < DECIMAL_DIGITS)
+            d->digits[d->count++] = (unsigned char)(*pos - '0');
+        else if (*pos != '0')
+            d->truncated = 1;
+
+        if (digits < MAX_DIGIT_COUNT)
+            digits++;
+    }
+    if (!point_seen)
+        d->point = digits;
+
+    if (pos < end) {
+        /* exponent */
+        pos++;
+        if (*pos == '+' || *pos == '-')
+            exp_negative = *pos++ == '-';
+
+        for (; pos < end; pos++) {
+            if (exp < MAX_EXPONENT)
+                exp = exp * 10 + (*pos - '0');
+        }
+        d->point += exp_negative ? -exp : exp;
+    }
+
+    decimal_trim(d);
+}
+
+/* Multiply by 2^shift */
+static void decimal_left_shift(decimal_t *d, int shift) {
+    unsigned char buffer[DECIMAL_DIGITS + 20];
+    int read = d->count, write = (int)sizeof(buffer), count, i;
+    uint64_t n = 0;
+
+    while (read > 0) {
+        n += (uint64_t)d->digits[--read] << shift;
+        buffer[--write] = (unsigned char)(n % 10);
+        n /= 10;
+    }
+    while (n > 0) {
+        buffer[--write] = (unsigned char)(n % 10);
+        n /= 10;
+    }
+
+    count = (int)sizeof(buffer) - write;
+    d->point += count - d->count;
+    if (count > DECIMAL_DIGITS) {
+        for (i = write + DECIMAL_DIGITS; i < (int)sizeof(buffer); i++) {
+            if (buffer[i])
+                d->truncated = 1;
+        }
+        count = DECIMAL_DIGITS;
+    }
+
+    memcpy(d->digits, buffer + write, (size_t)count);
+    d->count = count;
+    decimal_trim(d);
+}
+
+/* Divide by 2^shift */
+static void decimal_right_shift(decimal_t *d, int shift) {
+    int read = 0, write = 0;
+    uint64_t n = 0, mask = ((uint64_t)1 << shift) - 1;
+
+    /* pick up enough leading digits to cover the first shift */
+    for (; (n >> shift) == 0; read++) {
+        if (read >= d->count) {
+            if (n == 0) {
+                d->count = 0;
+                return;
+            }
+            while ((n >> shift) == 0) {
+                n *= 10;
+                read++;
+            }
+            break;
+        }
+        n = n * 10 + d->digits[read];
+    }
+    d->point -= read - 1;
+
+    /* pick up a digit, put down a digit */
+    for (; read < d->count; read++) {
+        d->digits[write++] = (unsigned char)(n >> shift);
+        n = (n & mask) * 10 + d->digits[read];
+    }
+
+    /* put down the extra digits */
+    while (n > 0) {
+        unsigned char digit = (unsigned char)(n >> shift);
+
+        n &= mask;
+        if (write < DECIMAL_DIGITS)
+            d->digits[write++] = digit;
+        else if (digit > 0)
+            d->truncated = 1;
+        n *= 10;
+    }
+
+    d->count = write;
+    decimal_trim(d);
+}
+
+static void decimal_shift(decimal_t *d, int shift) {
+    if (d->count == 0)
         return;
+
+    if (shift > 0) {
+        while (shift > DECIMAL_MAX_SHIFT) {
+            decimal_left_shift(d, DECIMAL_MAX_SHIFT);
+            shift -= DECIMAL_MAX_SHIFT;
+        }
+        decimal_left_shift(d, shift);
+    } else if (shift < 0) {
+        while (shift < -DECIMAL_MAX_SHIFT) {
+            decimal_right_shift(d, DECIMAL_MAX_SHIFT);
+            shift += DECIMAL_MAX_SHIFT;
+        }
+        decimal_right_shift(d, -shift);
     }
+}
 
-    pos = strchr(strbuffer->value, '.');
-    if (pos)
-        *pos = point;
+/* Whether the digits from index onwards round the integer part up */
+static int decimal_round_up(const decimal_t *d, int index) {
+    if (index < 0 || index >= d->count)
+        return 0;
+
+    if (d->digits[index] == 5 && index + 1 == d->count) {
+        /* exactly halfway, unless digits were dropped: round to even */
+        if (d->truncated)
+            return 1;
+        return index > 0 && d->digits[index - 1] % 2 == 1;
+    }
+    return d->digits[index] >= 5;
 }
 
-int jsonp_strtod(strbuffer_t *strbuffer, double *out) {
-    double value;
-    char *end;
+static uint64_t decimal_rounded_integer(const decimal_t *d) {
+    uint64_t n = 0;
+    int i;
+
+    for (i = 0; i < d->point && i < d->count; i++)
+        n = n * 10 + d->digits[i];
+    for (; i < d->point; i++)
+        n *= 10;
 
-    to_locale(strbuffer);
+    if (decimal_round_up(d, d->point))
+        n++;
+    return n;
+}
+
+/* Stores the bits of the nearest double, without the sign. Returns -1
+   if the number is too big. */
+static int decimal_to_bits(decimal_t *d, uint64_t *out) {
+    /* shifts that keep the decimal point moving in the right direction */
+    static const int powers[] = {1, 3, 6, 9, 13, 16, 19, 23, 26};
+    const int num_powers = (int)(sizeof(powers) / sizeof(powers[0]));
+    uint64_t mantissa;
+    int exp = 0;
+
+    if (d->count == 0 || d->point < -330) {
+        *out = 0;
+        return 0;
+    }
+    if (d->point > 310)
+        return -1;
+
+    /* scale to [0.5, 1) */
+    while (d->point > 0) {
+        int shift = d->point >= num_powers ? 27 : powers[d->point];
+        decimal_shift(d, -shift);
+        exp += shift;
+    }
+    while (d->point < 0 || (d->point == 0 && d->digits[0] < 5)) {
+        int shift = -d->point >= num_powers ? 27 : powers[-d->point];
+        decimal_shift(d, shift);
+        exp -= shift;
+    }
 
-    errno = 0;
-    value = strtod(strbuffer->value, &end);
-    assert(end == strbuffer->value + strbuffer->length);
+    /* doubles are [1, 2) * 2^exp */
+    exp--;
 
-    if ((value == HUGE_VAL || value == -HUGE_VAL) && errno == ERANGE) {
-        /* Overflow */
+    if (exp < -1022) {
+        /* subnormal */
+        decimal_shift(d, exp + 1022);
+        exp = -1022;
+    }
+    if (exp + 1023 >= 0x7FF)
         return -1;
+
+    decimal_shift(d, 53);
+    mantissa = decimal_rounded_integer(d);
+
+    /* rounding may have added a bit */
+    if (mantissa == (uint64_t)2 << 52) {
+        mantissa >>= 1;
+        exp++;
+        if (exp + 1023 >= 0x7FF)
+            return -1;
+    }
+
+    if (!(mantissa & ((uint64_t)1 << 52)))
+        exp = -1023;
+
+    *out = (mantissa & (((uint64_t)1 << 52) - 1)) | ((uint64_t)(exp + 1023) << 52);
+    return 0;
+}
+
+int jsonp_strtod(const char *str, size_t length, double *out) {
+    const char *pos = str, *end = str + length;
+    uint64_t mantissa = 0, bits;
+    int negative = 0, truncated = 0, point_seen = 0;
+    int digits = 0, mantissa_digits = 0, point = 0, exp = 0, exp_negative = 0;
+    decimal_t decimal;
+
+    if (*pos == '-') {
+        negative = 1;
+        pos++;
+    }
+
+    for (; pos < end; pos++) {
+        if (*pos == '.') {
+            point_seen = 1;
+            point = digits;
+            continue;
+        }
+        if (!is_digit(*pos))
+            break;
+
+        if (*pos == '0' && digits == 0) {
+            /* leading zero */
+            if (point > -MAX_DIGIT_COUNT)
+                point--;
+            continue;
+        }
+
+        if (mantissa_digits < MANTISSA_DIGITS) {
+            mantissa = mantissa * 10 + (uint64_t)(*pos - '0');
+            mantissa_digits++;
+        } else if (*pos != '0')
+            truncated = 1;
+
+        if (digits < MAX_DIGIT_COUNT)
+            digits++;
     }
+    if (!point_seen)
+        point = digits;
+
+    if (pos < end) {
+        /* exponent */
+        pos++;
+        if (*pos == '+' || *pos == '-')
+            exp_negative = *pos++ == '-';
+
+        for (; pos < end; pos++) {
+            if (exp < MAX_EXPONENT)
+                exp = exp * 10 + (*pos - '0');
+        }
+    }
+    exp = point - mantissa_digits + (exp_negative ? -exp : exp);
+
+    if (mantissa == 0) {
+        *out = negative ? -0.0 : 0.0;
+        return 0;
+    }
+
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0
+    if (!truncated && mantissa <= (uint64_t)1 << 53 && -22 <= exp && exp <= 22) {
+        /* both are exact, so the result is correctly rounded */
+        static const double exact[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+                                       1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+                                       1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+        double value = (double)mantissa;
+
+        if (exp < 0)
+            value /= exact[-exp];
+        else
+            value *= exact[exp];
+        *out = negative ? -value : value;
+        return 0;
+    }
+#endif
+
+    if (!truncated) {
+        if (eisel_lemire(mantissa, exp, negative, out) == 0)
+            return 0;
+    } else {
+        /* the dropped digits are somewhere between mantissa and
+           mantissa + 1 */
+        double lower, upper;
+        if (eisel_lemire(mantissa, exp, negative, &lower) == 0 &&
+            eisel_lemire(mantissa + 1, exp, negative, &upper) == 0 && lower == upper) {
+            *out = lower;
+            return 0;
+        }
+    }
+
+    decimal_init(&decimal, str, end);
+    if (decimal_to_bits(&decimal, &bits))
+        return -1;
 
-    *out = value;
+    if (negative)
+        bits |= (uint64_t)1 << 63;
+    *out = bits_to_double(bits);
     return 0;
 }
 
+/*** integer to decimal conversion ***/
+
+static const char digit_pairs[] = "00010203040506070809101112131415161718192021222324"
+                                  "25262728293031323334353637383940414243444546474849"
+                                  "50515253545556575859606162636465666768697071727374"
+                                  "75767778798081828384858687888990919293949596979899";
+
+/* Writes the digits of n so that they end at end, two digits at a
+   time. Returns the start of the digits. */
+static char *write_digits(char *end, uint64_t n) {
+    while (n >= 100) {
+        end -= 2;
+        memcpy(end, &digit_pairs[(n % 100) * 2], 2);
+        n /= 100;
+    }
+    if (n >= 10) {
+        end -= 2;
+        memcpy(end, &digit_pairs[n * 2], 2);
+    } else
+        *--end = (char)('0' + n);
+    return end;
+}
+
+int jsonp_inttostr(char *buffer, json_int_t value) {
+    char digits[JSONP_MAX_INTEGER_LENGTH];
+    char *end = digits + sizeof(digits), *pos;
+    uint64_t n = (uint64_t)value;
+    size_t length;
+
+    /* negate in unsigned arithmetic, which also works for the
+       smallest value */
+    if (value < 0)
+        n = 0 - n;
+
+    pos = write_digits(end, n);
+    if (value < 0)
+        *--pos = '-';
+
+    length = (size_t)(end - pos);
+    memcpy(buffer, pos, length);
+    return (int)length;
+}
+
 #if DTOA_ENABLED
-/* see dtoa.c */
-char *dtoa_r(double dd, int mode, int ndigits, int *decpt, int *sign, char **rve,
-             char *buf, size_t blen);
+/*** double to decimal conversion ***/
+
+/* The shortest digits that convert back to the same double are found
+   with the Schubfach algorithm by Raffaello Giulietti, using the same
+   table of powers of ten as the decoder. It needs no big integer
+   arithmetic. If there are several shortest candidates, the one
+   nearest to the exact value is chosen, like dtoa() does.
+
+   With a precision, the exact value is rounded to that many digits
+   with the arbitrary precision decimal of the decoder. */
+
+#define MAX_DIGITS 24
+
+static uint64_t double_to_bits(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+/* The high 64 bits of g * cp / 2^64, where g is the 128-bit table
+   entry plus one, with the lowest bit set if the rest is not zero */
+static uint64_t round_to_odd(const uint64_t *power, uint64_t cp) {
+    uint64_t g_lo = power[0] + 1, g_hi = power[1] + (power[0] + 1 == 0);
+    uint64_t x_hi, x_lo, y_hi, y_lo, y0;
+
+    x_hi = mul_64x64(g_lo, cp, &x_lo);
+    y_hi = mul_64x64(g_hi, cp, &y_lo);
+    y0 = y_lo + x_hi;
+    y_hi += y0 < x_hi;
+    return y_hi | (y0 > 1);
+}
+
+/* Finds the shortest digits * 10^exp10 that converts back to the
+   positive double with the given bits */
+static uint64_t schubfach(uint64_t bits, int *exp10) {
+    uint64_t fraction = bits & (((uint64_t)1 << 52) - 1);
+    int biased_exp = (int)(bits >> 52);
+    uint64_t c, cbl, cb, cbr, vbl, vb, vbr, lower, upper, s;
+    const uint64_t *power;
+    int q, k, h, even, lower_closer;
+
+    if (biased_exp != 0) {
+        c = fraction | ((uint64_t)1 << 52);
+        q = biased_exp - 1075;
+
+        /* small integers */
+        if (-52 <= q && q <= 0 && (c & (((uint64_t)1 << -q) - 1)) == 0) {
+            *exp10 = 0;
+            return c >> -q;
+        }
+    } else {
+        /* subnormal */
+        c = fraction;
+        q = -1074;
+    }
+
+    even = (c % 2) == 0;
+    lower_closer = fraction == 0 && biased_exp > 1;
+
+    cbl = 4 * c - 2 + (uint64_t)lower_closer;
+    cb = 4 * c;
+    cbr = 4 * c + 2;
+
+    /* floor(log10(2^q)), or floor(log10(3/4 * 2^q)) if the lower
+       boundary is closer */
+    k = (q * 1262611 - (lower_closer ? 524031 : 0)) >> 22;
+    /* q + floor(log2(10^-k)) + 1 */
+    h = q + ((-k * 1741647) >> 19) + 1;
+
+    power = pow10_table[-k - POW10_MIN_EXP10];
+    vbl = round_to_odd(power, cbl << h);
+    vb = round_to_odd(power, cb << h);
+    vbr = round_to_odd(power, cbr << h);
+
+    lower = vbl + !even;
+    upper = vbr - !even;
+
+    s = vb / 4;
+    if (s >= 10) {
+        /* one digit less, if only one of the candidates is inside */
+        uint64_t sp = s / 10;
+        int up_inside = lower <= 40 * sp;
+        int wp_inside = 40 * sp + 40 <= upper;
+
+        if (up_inside != wp_inside) {
+            *exp10 = k + 1;
+            return sp + (uint64_t)wp_inside;
+        }
+    }
+
+    {
+        int u_inside = lower <= 4 * s;
+        int w_inside = 4 * s + 4 <= upper;
+        uint64_t mid = 4 * s + 2;
+
+        *exp10 = k;
+        if (u_inside != w_inside)
+            return s + (uint64_t)w_inside;
+
+        /* the nearest one, ties to even */
+        return s + (uint64_t)(vb > mid || (vb == mid && (s & 1) != 0));
+    }
+}
+
+/* Writes the shortest digits of a positive double, without trailing
+   zeros. Returns the number of digits. */
+static int dtoa_shortest(uint64_t bits, char *digits, int *decpt) {
+    char buffer[20];
+    char *end = buffer + sizeof(buffer), *pos;
+    int exp10, length;
+
+    pos = write_digits(end, schubfach(bits, &exp10));
+    length = (int)(end - pos);
+    *decpt = length + exp10;
+
+    while (length > 1 && pos[length - 1] == '0')
+        length--;
+    memcpy(digits, pos, (size_t)length);
+    return length;
+}
+
+/* Writes the digits of a positive double, correctly rounded to
+   precision digits, without trailing zeros. Returns the number of
+   digits. */
+static int dtoa_precision(uint64_t bits, int precision, char *digits, int *decpt) {
+    uint64_t fraction = bits & (((uint64_t)1 << 52) - 1);
+    int biased_exp = (int)(bits >> 52);
+    char shortest[MAX_DIGITS];
+    decimal_t d;
+    int length, i;
+
+    /* The shortest digits of a normal double are within half an ulp
+       of the exact value. If there are at most 15 of them, no rounding
+       boundary of up to 15 digits can be between the two. If there are
+       at least two more than the precision, a boundary between them
+       would have been a shorter candidate. Either way they round the
+       same. */
+    length = biased_exp != 0 ? dtoa_shortest(bits, shortest, decpt) : 0;
+    if (length && length <= precision && precision <= 15) {
+        memcpy(digits, shortest, (size_t)length);
+        return length;
+    }
+    if (length && length >= precision + 2) {
+        memcpy(digits, shortest, (size_t)precision);
+        length = precision;
+        if (shortest[precision] >= '5') {
+            while (length > 0 && digits[length - 1] == '9')
+                length--;
+            if (length == 0) {
+                digits[length++] = '1';
+                (*decpt)++;
+            } else
+                digits[length - 1]++;
+        }
+        while (digits[length - 1] == '0')
+            length--;
+        return length;
+    }
+
+    /* the exact value c * 2^q */
+    if (biased_exp != 0)
+        fraction |= (uint64_t)1 << 52;
+    d.count = 0;
+    d.truncated = 0;
+    while (fraction > 0) {
+        d.digits[d.count++] = (unsigned char)(fraction % 10);
+        fraction /= 10;
+    }
+    for (i = 0; i < d.count / 2; i++) {
+        unsigned char digit = d.digits[i];
+        d.digits[i] = d.digits[d.count - 1 - i];
+        d.digits[d.count - 1 - i] = digit;
+    }
+    d.point = d.count;
+    decimal_trim(&d);
+    decimal_shift(&d, (biased_exp ? biased_exp : 1) - 1075);
+
+    if (d.count > precision) {
+        int round_up = decimal_round_up(&d, precision);
+
+        d.count = precision;
+        if (round_up) {
+            i = precision - 1;
+            while (i >= 0 && d.digits[i] == 9)
+                i--;
+            if (i < 0) {
+                d.digits[0] = 1;
+                d.count = 1;
+                d.point++;
+            } else {
+                d.digits[i]++;
+                d.count = i + 1;
+            }
+        }
+        decimal_trim(&d);
+    }
+
+    for (i = 0; i < d.count; i++)
+        digits[i] = (char)('0' + d.digits[i]);
+    *decpt = d.point;
+    return d.count;
+}
 
 int jsonp_dtostr(char *buffer, size_t size, double value, int precision) {
     /* adapted from `format_float_short()` in
      * https://github.com/python/cpython/blob/2cf18a44303b6d84faa8ecffaecc427b53ae121e/Python/pystrtod.c#L969
      */
-    char digits[25];
-    char *digits_end;
-    int mode = precision == 0 ? 0 : 2;
+    char digits[MAX_DIGITS];
+    uint64_t bits = double_to_bits(value);
     int decpt, sign, exp_len, exp = 0, use_exp = 0;
     int digits_len, vdigits_start, vdigits_end;
     char *p;
 
-    if (dtoa_r(value, mode, precision, &decpt, &sign, &digits_end, digits, 25) == NULL) {
-        // digits is too short => should not happen
+    sign = (int)(bits >> 63);
+    bits &= ~((uint64_t)1 << 63);
+
+    if (bits == 0) {
+        digits[0] = '0';
+        digits_len = 1;
+        decpt = 1;
+    } else if (precision == 0) {
+        digits_len = dtoa_shortest(bits, digits, &decpt);
+    } else if (precision <= MAX_DIGITS) {
+        digits_len = dtoa_precision(bits, precision, digits, &decpt);
+    } else {
+        /* digits is too short */
         return -1;
     }
 
-    digits_len = digits_end - digits;
     if (decpt <= -4 || decpt > 16) {
         use_exp = 1;
         exp = decpt - 1;
@@ -167,6 +851,21 @@ int jsonp_dtostr(char *buffer, size_t size, double value, int precision) {
     return (int)(p - buffer);
 }
 #else /* DTOA_ENABLED == 0 */
+/*
+  - This code assumes that the decimal separator is exactly one
+    character.
+
+  - If setlocale() is called by another thread between the call to
+    get_decimal_point() and the call to sprintf(), the result may be
+    wrong. setlocale() is not thread-safe and should not be used this
+    way. Multi-threaded programs should use uselocale() instead.
+*/
+static char get_decimal_point() {
+    char buf[3];
+    sprintf(buf, "%#.0f", 1.0); // "1." in the current locale
+    return buf[1];
+}
+
 static void from_locale(char *buffer) {
     char point;
     char *pos;
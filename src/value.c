@@ -38,24 +38,203 @@ static JSON_INLINE int isinf(double x) { return !isnan(x) && isnan(x - x); }
 #endif
 
 static int do_equal(const json_t *json1, const json_t *json2, int depth);
-json_t *do_deep_copy(const json_t *json, hashtable_t *parents, int depth);
+json_t *do_deep_copy(const json_t *json, loop_check_t *parents, int depth);
 
 static JSON_INLINE void json_init(json_t *json, json_type type) {
     json->type = type;
     json->refcount = 1;
 }
 
-int jsonp_loop_check(hashtable_t *parents, const json_t *json, char *key, size_t key_size,
-                     size_t *key_len_out) {
-    size_t key_len = snprintf(key, key_size, "%p", json);
+void jsonp_loop_init(loop_check_t *parents) {
+    parents->stack = parents->initial;
+    parents->depth = 0;
+    parents->size = LOOP_STACK_INITIAL_SIZE;
+}
 
-    if (key_len_out)
-        *key_len_out = key_len;
+void jsonp_loop_close(loop_check_t *parents) {
+    if (parents->stack != parents->initial)
+        jsonp_free(parents->stack);
+}
 
-    if (hashtable_get(parents, key, key_len))
-        return -1;
+/* Start visiting the container json. Returns -1 if it's already being
+   visited, i.e. there's a cycle, or on out of memory. Every successful
+   call must be paired with jsonp_loop_leave(). */
+int jsonp_loop_check(loop_check_t *parents, const json_t *json) {
+    size_t i;
+
+    for (i = 0; i < parents->depth; i++) {
+        if (parents->stack[i] == json)
+            return -1;
+    }
+
+    if (parents->depth == parents->size) {
+        size_t new_size = parents->size * 2;
+        const json_t **new_stack = jsonp_malloc(new_size * sizeof(json_t *));
+        if (!new_stack)
+            return -1;
+
+        memcpy(new_stack, parents->stack, parents->depth * sizeof(json_t *));
+        jsonp_loop_close(parents);
+        parents->stack = new_stack;
+        parents->size = new_size;
+    }
+
+    parents->stack[parents->depth++] = json;
+    return 0;
+}
+
+/*** change tracking ***/
+
+/* The parent of containers that are in several places or in a loop */
+static json_t shared_parent;
+#define SHARED (&shared_parent)
 
-    return hashtable_set(parents, key, key_len, json_null());
+volatile size_t jsonp_value_epoch = 0;
+volatile size_t jsonp_dump_caches = 0;
+
+static void tracking_init(jsonp_tracking_t *tracking) {
+    tracking->parent = NULL;
+    tracking->places = 0;
+    tracking->holders[0] = tracking->holders[1] = NULL;
+    tracking->untracked = 0;
+    tracking->cache = NULL;
+}
+
+/* Discard the cached output of container and the containers above it.
+   Returns 1 if value is one of them. */
+static int changed(json_t *container, const json_t *value) {
+    int found = 0;
+
+    while (container && container != SHARED) {
+        jsonp_tracking_t *tracking = jsonp_tracking(container);
+
+        /* The containers above an untracked one are untracked too, and
+           they have no cached output. Only a search for value has to
+           go on. */
+        if (!value && tracking->untracked)
+            break;
+        if (container == value)
+            found = 1;
+        if (tracking->cache)
+            jsonp_dump_cache_clear(tracking->cache);
+        container = tracking->parent;
+    }
+    return found;
+}
+
+/* Discard the cached output above container, if there is any */
+static void contents_changed(json_t *container) {
+    if (jsonp_dump_caches)
+        changed(container, NULL);
+}
+
+/* Whether value may be above another array or object */
+static int has_children(const json_t *value) {
+    return json_array_size(value) || json_object_size(value);
+}
+
+/* Whether value is container or one of the containers above it */
+static int is_above(const json_t *value, json_t *container) {
+    while (container && container != SHARED) {
+        if (container == value)
+            return 1;
+        container = jsonp_tracking(container)->parent;
+    }
+    return 0;
+}
+
+/* Whether the containers a value is in don't see all of its changes */
+static int untracks(const jsonp_tracking_t *tracking) {
+    return tracking->parent == SHARED || tracking->untracked;
+}
+
+/* Count one more or one less value in container that untracks it, and
+   pass it on up while that makes a container untracked or tracked */
+static void add_untracked(json_t *container, int add) {
+    while (container && container != SHARED) {
+        jsonp_tracking_t *tracking = jsonp_tracking(container);
+
+        if (add > 0 ? tracking->untracked++ : --tracking->untracked)
+            break;
+
+        /* No more changes below it reach this cached output */
+        if (tracking->cache)
+            jsonp_dump_cache_clear(tracking->cache);
+        container = tracking->parent;
+    }
+}
+
+/* A string, integer or real was changed in place */
+static void value_changed(void) {
+#if defined(HAVE_ATOMIC_BUILTINS)
+    __atomic_add_fetch(&jsonp_value_epoch, 1, __ATOMIC_SEQ_CST);
+#elif defined(HAVE_SYNC_BUILTINS)
+    __sync_add_and_fetch(&jsonp_value_epoch, 1);
+#else
+    jsonp_value_epoch++;
+#endif
+}
+
+void jsonp_adopt(json_t *container, json_t *value) {
+    jsonp_tracking_t *tracking = jsonp_tracking(value);
+    int in_loop = 0;
+
+    /* Without caches, the parent chain is only walked to find a loop,
+       which value can only make if it's not anywhere yet and isn't
+       empty */
+    if (jsonp_dump_caches || (tracking && !tracking->places && has_children(value)))
+        in_loop = changed(container, value);
+
+    if (!tracking)
+        return;
+
+    if (tracking->places < 2)
+        tracking->holders[tracking->places] = container;
+    else
+        tracking->holders[0] = tracking->holders[1] = NULL;
+
+    if (!tracking->places++ && !in_loop) {
+        tracking->parent = container;
+    } else if (tracking->parent != SHARED) {
+        /* The old place of value doesn't see its changes anymore */
+        if (!tracking->untracked)
+            add_untracked(tracking->parent, 1);
+        tracking->parent = SHARED;
+    }
+
+    if (untracks(tracking))
+        add_untracked(container, 1);
+}
+
+void jsonp_disown(json_t *container, json_t *value) {
+    jsonp_tracking_t *tracking = jsonp_tracking(value);
+    json_t *other;
+
+    if (!tracking)
+        return;
+
+    if (untracks(tracking))
+        add_untracked(container, -1);
+
+    if (!--tracking->places) {
+        tracking->parent = NULL;
+        tracking->holders[0] = tracking->holders[1] = NULL;
+        return;
+    }
+    if (tracking->places > 1 || !tracking->holders[0])
+        return;
+
+    /* Left in one place that is known. Unless that makes a loop, the
+       place sees all changes of value again. */
+    other = tracking->holders[0] == container ? tracking->holders[1] : tracking->holders[0];
+    tracking->holders[0] = other;
+    tracking->holders[1] = NULL;
+
+    if (!is_above(value, other)) {
+        tracking->parent = other;
+        if (!tracking->untracked)
+            add_untracked(other, -1);
+    }
 }
 
 /*** object ***/
@@ -73,6 +252,7 @@ json_t *json_object(void) {
     }
 
     json_init(&object->json, JSON_OBJECT);
+    tracking_init(&object->tracking);
 
     if (hashtable_init(&object->hashtable)) {
         jsonp_free(object);
@@ -83,6 +263,13 @@ json_t *json_object(void) {
 }
 
 static void json_delete_object(json_object_t *object) {
+    void *iter;
+
+    for (iter = hashtable_iter(&object->hashtable); iter;
+         iter = hashtable_iter_next(&object->hashtable, iter))
+        jsonp_disown(&object->json, hashtable_iter_value(iter));
+
+    jsonp_dump_cache_free(object->tracking.cache);
     hashtable_close(&object->hashtable);
     jsonp_free(object);
 }
@@ -125,6 +312,7 @@ int json_object_set_new_nocheck(json_t *json, const char *key, json_t *value) {
 int json_object_setn_new_nocheck(json_t *json, const char *key, size_t key_len,
                                  json_t *value) {
     json_object_t *object;
+    json_t **slot;
 
     if (!value)
         return -1;
@@ -135,11 +323,18 @@ int json_object_setn_new_nocheck(json_t *json, const char *key, size_t key_len,
     }
     object = json_to_object(json);
 
-    if (hashtable_set(&object->hashtable, key, key_len, value)) {
+    slot = hashtable_reserve(&object->hashtable, key, key_len);
+    if (!slot) {
         json_decref(value);
         return -1;
     }
 
+    if (*slot)
+        jsonp_disown(json, *slot);
+    json_decref(*slot);
+    *slot = value;
+    jsonp_adopt(json, value);
+
     return 0;
 }
 
@@ -170,21 +365,34 @@ int json_object_del(json_t *json, const char *key) {
 
 int json_object_deln(json_t *json, const char *key, size_t key_len) {
     json_object_t *object;
+    json_t *value;
 
     if (!key || !json_is_object(json))
         return -1;
 
     object = json_to_object(json);
+    value = hashtable_get(&object->hashtable, key, key_len);
+    if (!value)
+        return -1;
+
+    jsonp_disown(json, value);
+    contents_changed(json);
     return hashtable_del(&object->hashtable, key, key_len);
 }
 
 int json_object_clear(json_t *json) {
     json_object_t *object;
+    void *iter;
 
     if (!json_is_object(json))
         return -1;
 
     object = json_to_object(json);
+    for (iter = hashtable_iter(&object->hashtable); iter;
+         iter = hashtable_iter_next(&object->hashtable, iter))
+        jsonp_disown(json, hashtable_iter_value(iter));
+
+    contents_changed(json);
     hashtable_clear(&object->hashtable);
 
     return 0;
@@ -238,18 +446,16 @@ int json_object_update_missing(json_t *object, json_t *other) {
     return 0;
 }
 
-int do_object_update_recursive(json_t *object, json_t *other, hashtable_t *parents) {
+int do_object_update_recursive(json_t *object, json_t *other, loop_check_t *parents) {
     const char *key;
     size_t key_len;
     json_t *value;
-    char loop_key[LOOP_KEY_LEN];
     int res = 0;
-    size_t loop_key_len;
 
     if (!json_is_object(object) || !json_is_object(other))
         return -1;
 
-    if (jsonp_loop_check(parents, other, loop_key, sizeof(loop_key), &loop_key_len))
+    if (jsonp_loop_check(parents, other))
         return -1;
 
     json_object_keylen_foreach(other, key, key_len, value) {
@@ -268,19 +474,18 @@ int do_object_update_recursive(json_t *object, json_t *other, hashtable_t *paren
         }
     }
 
-    hashtable_del(parents, loop_key, loop_key_len);
+    jsonp_loop_leave(parents);
 
     return res;
 }
 
 int json_object_update_recursive(json_t *object, json_t *other) {
     int res;
-    hashtable_t parents_set;
+    loop_check_t parents;
 
-    if (hashtable_init(&parents_set))
-        return -1;
-    res = do_object_update_recursive(object, other, &parents_set);
-    hashtable_close(&parents_set);
+    jsonp_loop_init(&parents);
+    res = do_object_update_recursive(object, other, &parents);
+    jsonp_loop_close(&parents);
 
     return res;
 }
@@ -342,7 +547,9 @@ int json_object_iter_set_new(json_t *json, void *iter, json_t *value) {
         return -1;
     }
 
+    jsonp_disown(json, hashtable_iter_value(iter));
     hashtable_iter_set(iter, value);
+    jsonp_adopt(json, value);
     return 0;
 }
 
@@ -388,14 +595,12 @@ static json_t *json_object_copy(json_t *object) {
     return result;
 }
 
-static json_t *json_object_deep_copy(const json_t *object, hashtable_t *parents,
+static json_t *json_object_deep_copy(const json_t *object, loop_check_t *parents,
                                      int depth) {
     json_t *result;
     void *iter;
-    char loop_key[LOOP_KEY_LEN];
-    size_t loop_key_len;
 
-    if (jsonp_loop_check(parents, object, loop_key, sizeof(loop_key), &loop_key_len))
+    if (jsonp_loop_check(parents, object))
         return NULL;
 
     result = json_object();
@@ -423,7 +628,7 @@ static json_t *json_object_deep_copy(const json_t *object, hashtable_t *parents,
     }
 
 out:
-    hashtable_del(parents, loop_key, loop_key_len);
+    jsonp_loop_leave(parents);
 
     return result;
 }
@@ -435,6 +640,7 @@ json_t *json_array(void) {
     if (!array)
         return NULL;
     json_init(&array->json, JSON_ARRAY);
+    tracking_init(&array->tracking);
 
     array->entries = 0;
     array->size = 8;
@@ -451,9 +657,12 @@ json_t *json_array(void) {
 static void json_delete_array(json_array_t *array) {
     size_t i;
 
-    for (i = 0; i < array->entries; i++)
+    for (i = 0; i < array->entries; i++) {
+        jsonp_disown(&array->json, array->table[i]);
         json_decref(array->table[i]);
+    }
 
+    jsonp_dump_cache_free(array->tracking.cache);
     jsonp_free(array->table);
     jsonp_free(array);
 }
@@ -494,8 +703,10 @@ int json_array_set_new(json_t *json, size_t index, json_t *value) {
         return -1;
     }
 
+    jsonp_disown(json, array->table[index]);
     json_decref(array->table[index]);
     array->table[index] = value;
+    jsonp_adopt(json, value);
 
     return 0;
 }
@@ -549,6 +760,7 @@ int json_array_append_new(json_t *json, json_t *value) {
 
     array->table[array->entries] = value;
     array->entries++;
+    jsonp_adopt(json, value);
 
     return 0;
 }
@@ -579,6 +791,7 @@ int json_array_insert_new(json_t *json, size_t index, json_t *value) {
 
     array->table[index] = value;
     array->entries++;
+    jsonp_adopt(json, value);
 
     return 0;
 }
@@ -593,6 +806,8 @@ int json_array_remove(json_t *json, size_t index) {
     if (index >= array->entries)
         return -1;
 
+    jsonp_disown(json, array->table[index]);
+    contents_changed(json);
     json_decref(array->table[index]);
 
     /* If we're removing the last element, nothing has to be moved */
@@ -612,10 +827,13 @@ int json_array_clear(json_t *json) {
         return -1;
     array = json_to_array(json);
 
-    for (i = 0; i < array->entries; i++)
+    for (i = 0; i < array->entries; i++) {
+        jsonp_disown(json, array->table[i]);
         json_decref(array->table[i]);
+    }
 
     array->entries = 0;
+    contents_changed(json);
     return 0;
 }
 
@@ -636,6 +854,9 @@ int json_array_extend(json_t *json, json_t *other_json) {
 
     array_copy(array->table, array->entries, other->table, 0, other->entries);
 
+    for (i = 0; i < other->entries; i++)
+        jsonp_adopt(json, other->table[i]);
+
     array->entries += other->entries;
     return 0;
 }
@@ -674,14 +895,12 @@ static json_t *json_array_copy(json_t *array) {
     return result;
 }
 
-static json_t *json_array_deep_copy(const json_t *array, hashtable_t *parents,
+static json_t *json_array_deep_copy(const json_t *array, loop_check_t *parents,
                                     int depth) {
     json_t *result;
     size_t i;
-    char loop_key[LOOP_KEY_LEN];
-    size_t loop_key_len;
 
-    if (jsonp_loop_check(parents, array, loop_key, sizeof(loop_key), &loop_key_len))
+    if (jsonp_loop_check(parents, array))
         return NULL;
 
     result = json_array();
@@ -698,7 +917,7 @@ static json_t *json_array_deep_copy(const json_t *array, hashtable_t *parents,
     }
 
 out:
-    hashtable_del(parents, loop_key, loop_key_len);
+    jsonp_loop_leave(parents);
 
     return result;
 }
@@ -798,6 +1017,7 @@ int json_string_setn_nocheck(json_t *json, const char *value, size_t len) {
     jsonp_free(string->value);
     string->value = dup;
     string->length = len;
+    value_changed();
 
     return 0;
 }
@@ -903,6 +1123,7 @@ int json_integer_set(json_t *json, json_int_t value) {
         return -1;
 
     json_to_integer(json)->value = value;
+    value_changed();
 
     return 0;
 }
@@ -946,6 +1167,7 @@ int json_real_set(json_t *json, double value) {
         return -1;
 
     json_to_real(json)->value = value;
+    value_changed();
 
     return 0;
 }
@@ -971,6 +1193,94 @@ double json_number_value(const json_t *json) {
         return 0.0;
 }
 
+/*** raw ***/
+
+json_t *json_raw(const char *text) {
+    if (!text)
+        return NULL;
+
+    return json_rawn(text, strlen(text));
+}
+
+json_t *json_rawn(const char *text, size_t len) {
+    json_t *value;
+
+    if (!text)
+        return NULL;
+
+    /* the text must decode to exactly one value */
+    value = json_loadb(text, len, JSON_DECODE_ANY | JSON_ALLOW_NUL, NULL);
+    if (!value)
+        return NULL;
+    json_decref(value);
+
+    return json_rawn_nocheck(text, len);
+}
+
+json_t *json_raw_nocheck(const char *text) {
+    if (!text)
+        return NULL;
+
+    return json_rawn_nocheck(text, strlen(text));
+}
+
+json_t *json_rawn_nocheck(const char *text, size_t len) {
+    json_raw_t *raw;
+    char *v;
+
+    if (!text)
+        return NULL;
+
+    v = jsonp_strndup(text, len);
+    if (!v)
+        return NULL;
+
+    raw = jsonp_malloc(sizeof(json_raw_t));
+    if (!raw) {
+        jsonp_free(v);
+        return NULL;
+    }
+    json_init(&raw->json, JSON_RAW);
+    raw->value = v;
+    raw->length = len;
+
+    return &raw->json;
+}
+
+const char *json_raw_value(const json_t *json) {
+    if (!json_is_raw(json))
+        return NULL;
+
+    return json_to_raw(json)->value;
+}
+
+size_t json_raw_length(const json_t *json) {
+    if (!json_is_raw(json))
+        return 0;
+
+    return json_to_raw(json)->length;
+}
+
+static void json_delete_raw(json_raw_t *raw) {
+    jsonp_free(raw->value);
+    jsonp_free(raw);
+}
+
+static int json_raw_equal(const json_t *raw1, const json_t *raw2) {
+    json_raw_t *r1, *r2;
+
+    r1 = json_to_raw(raw1);
+    r2 = json_to_raw(raw2);
+    return r1->length == r2->length && !memcmp(r1->value, r2->value, r1->length);
+}
+
+static json_t *json_raw_copy(const json_t *raw) {
+    json_raw_t *r;
+
+    r = json_to_raw(raw);
+    return json_rawn_nocheck(r->value, r->length);
+}
+
 /*** simple values ***/
 
 json_t *json_true(void) {
@@ -1010,6 +1320,9 @@ void json_delete(json_t *json) {
         case JSON_REAL:
             json_delete_real(json_to_real(json));
             break;
+        case JSON_RAW:
+            json_delete_raw(json_to_raw(json));
+            break;
         default:
             return;
     }
@@ -1048,6 +1361,8 @@ static int do_equal(const json_t *json1, const json_t *json2, int depth) {
             return json_integer_equal(json1, json2);
         case JSON_REAL:
             return json_real_equal(json1, json2);
+        case JSON_RAW:
+            return json_raw_equal(json1, json2);
         default:
             return 0;
     }
@@ -1070,6 +1385,8 @@ json_t *json_copy(json_t *json) {
             return json_integer_copy(json);
         case JSON_REAL:
             return json_real_copy(json);
+        case JSON_RAW:
+            return json_raw_copy(json);
         case JSON_TRUE:
         case JSON_FALSE:
         case JSON_NULL:
@@ -1081,17 +1398,16 @@ json_t *json_copy(json_t *json) {
 
 json_t *json_deep_copy(const json_t *json) {
     json_t *res;
-    hashtable_t parents_set;
+    loop_check_t parents;
 
-    if (hashtable_init(&parents_set))
-        return NULL;
-    res = do_deep_copy(json, &parents_set, 0);
-    hashtable_close(&parents_set);
+    jsonp_loop_init(&parents);
+    res = do_deep_copy(json, &parents, 0);
+    jsonp_loop_close(&parents);
 
     return res;
 }
 
-json_t *do_deep_copy(const json_t *json, hashtable_t *parents, int depth) {
+json_t *do_deep_copy(const json_t *json, loop_check_t *parents, int depth) {
     if (!json)
         return NULL;
 
@@ -1111,6 +1427,8 @@ json_t *do_deep_copy(const json_t *json, hashtable_t *parents, int depth) {
             return json_integer_copy(json);
         case JSON_REAL:
             return json_real_copy(json);
+        case JSON_RAW:
+            return json_raw_copy(json);
         case JSON_TRUE:
         case JSON_FALSE:
         case JSON_NULL:
@@ -8,6 +8,8 @@
 #include "jansson_private_config.h"
 
 #include <jansson.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
@@ -130,6 +132,45 @@ static void circular_references() {
     json_decref(json);
 }
 
+static void deep_circular_references() {
+    /* A reference back to the middle of a deep chain of arrays, and a
+       value that appears several times without being circular */
+    json_t *json, *middle = NULL, *innermost, *shared;
+    char *result;
+    int i;
+
+    json = innermost = json_array();
+    for (i = 0; i < 1000; i++) {
+        json_t *next = json_array();
+        json_array_append_new(innermost, next);
+        innermost = next;
+        if (i == 500)
+            middle = next;
+    }
+
+    shared = json_object();
+    json_array_append(innermost, shared);
+    json_array_append(innermost, shared);
+    json_array_append_new(innermost, shared);
+
+    result = json_dumps(json, JSON_COMPACT);
+    if (!result || !strstr(result, "[{},{},{}]"))
+        fail("json_dumps failed to encode a value that appears several times");
+    free(result);
+
+    json_array_append(innermost, middle);
+    if (json_dumps(json, 0))
+        fail("json_dumps encoded a deep circular reference!");
+
+    json_array_remove(innermost, 3);
+    result = json_dumps(json, 0);
+    if (!result)
+        fail("json_dumps failed after removing a deep circular reference");
+    free(result);
+
+    json_decref(json);
+}
+
 static void encode_other_than_array_or_object() {
     /* Encoding anything other than array or object should only
      * succeed if the JSON_ENCODE_ANY flag is used */
@@ -205,6 +246,40 @@ static void encode_nul_byte() {
     json_decref(json);
 }
 
+static void escape_long_strings() {
+    /* Characters to escape after and between runs that are longer
+       than a SIMD block */
+    const char str[] = "0123456789abcdefghijklmnopqrstuvwxyz/\"\\\n\x01\xc3\xa5"
+                       "0123456789abcdefghijklmnopqrstuvwxyz\xf0\x9d\x84\x9e/";
+    json_t *json;
+    char *result;
+
+    json = json_string(str);
+    result = json_dumps(json, JSON_ENCODE_ANY);
+    if (!result || strcmp(result, "\"0123456789abcdefghijklmnopqrstuvwxyz/\\\"\\\\\\n"
+                                  "\\u0001\xc3\xa5"
+                                  "0123456789abcdefghijklmnopqrstuvwxyz"
+                                  "\xf0\x9d\x84\x9e/\""))
+        fail("json_dumps failed to escape a long string");
+    free(result);
+
+    result = json_dumps(json, JSON_ENCODE_ANY | JSON_ENSURE_ASCII | JSON_ESCAPE_SLASH);
+    if (!result || strcmp(result, "\"0123456789abcdefghijklmnopqrstuvwxyz\\/\\\"\\\\"
+                                  "\\n\\u0001\\u00E5"
+                                  "0123456789abcdefghijklmnopqrstuvwxyz"
+                                  "\\uD834\\uDD1E\\/\""))
+        fail("json_dumps failed to escape a long string with JSON_ENSURE_ASCII");
+    free(result);
+    json_decref(json);
+
+    /* invalid UTF-8 that doesn't need escaping is still caught */
+    json = json_stringn_nocheck("0123456789abcdefghijklmnopqrstuvwxyz\xc3", 37);
+    result = json_dumps(json, JSON_ENCODE_ANY);
+    if (result)
+        fail("json_dumps didn't fail on invalid UTF-8");
+    json_decref(json);
+}
+
 static void dump_file() {
     json_t *json;
     int result;
@@ -243,6 +318,51 @@ static void dumpb() {
     json_decref(obj);
 }
 
+static void dump_size() {
+    static const size_t flags[] = {0,
+                                   JSON_COMPACT,
+                                   JSON_INDENT(3) | JSON_SORT_KEYS,
+                                   JSON_INDENT(2) | JSON_COMPACT | JSON_EMBED,
+                                   JSON_ENSURE_ASCII | JSON_ESCAPE_SLASH,
+                                   JSON_REAL_PRECISION(4) | JSON_EMBED};
+    json_t *json;
+    size_t i;
+
+    json = json_pack("{s:[i, I, f, f, b, n, [], {}], s:s, s:{s:[s, s]}}", "numbers", 0,
+                     (json_int_t)-1234567890, 1.5, -0.000123456789, 1, "string",
+                     "a/b\"c\\d\n\x01\xc3\xa5 \xf0\x9d\x84\x9e", "nested", "",
+                     "x", "\xe2\x82\xac");
+    if (!json)
+        fail("json_pack failed");
+
+    for (i = 0; i < sizeof(flags) / sizeof(flags[0]); i++) {
+        char *result = json_dumps(json, flags[i]);
+        if (!result)
+            fail("json_dumps failed");
+        if (json_dump_size(json, flags[i]) != strlen(result))
+            fail("json_dump_size returned a wrong size");
+        if (json_dumpb(json, NULL, 0, flags[i]) != strlen(result))
+            fail("json_dumpb returned a wrong size");
+        free(result);
+    }
+    json_decref(json);
+
+    json = json_integer(5);
+    if (json_dump_size(json, 0) != 0)
+        fail("json_dump_size should fail without JSON_ENCODE_ANY");
+    if (json_dump_size(json, JSON_ENCODE_ANY) != 1)
+        fail("json_dump_size failed with JSON_ENCODE_ANY");
+    json_decref(json);
+
+    json = json_stringn_nocheck("\xff", 1);
+    if (json_dump_size(json, JSON_ENCODE_ANY) != 0)
+        fail("json_dump_size should fail on invalid UTF-8");
+    json_decref(json);
+
+    if (json_dump_size(NULL, JSON_ENCODE_ANY) != 0)
+        fail("json_dump_size should fail on NULL");
+}
+
 static void dumpfd() {
 #ifdef HAVE_UNISTD_H
     int fds[2] = {-1, -1};
@@ -270,6 +390,52 @@ static void dumpfd() {
 #endif
 }
 
+static void dumpfd_long_strings() {
+#ifdef HAVE_UNISTD_H
+    FILE *file = tmpfile();
+    json_t *json = json_array();
+    char *expected, *str, *result;
+    size_t length, i;
+
+    if (!file || !json)
+        fail("tmpfile() failed");
+
+    /* strings around the lengths that are written without copying,
+       more of them than writev() takes at a time */
+    str = malloc(70000);
+    if (!str)
+        fail("malloc failed");
+    for (i = 0; i < 70000; i++)
+        str[i] = i % 1000 == 999 ? '"' : 'a' + i % 26;
+    for (i = 0; i < 200; i++) {
+        size_t len = i % 3 == 0 ? 10 : i % 3 == 1 ? 1000 + i : 2000 + 331 * i;
+        json_array_append_new(json, json_stringn(str, len));
+    }
+    json_array_append_new(json, json_stringn(str, 70000));
+
+    expected = json_dumps(json, JSON_INDENT(2));
+    if (!expected)
+        fail("json_dumps failed");
+    length = strlen(expected);
+
+    if (json_dumpfd(json, fileno(file), JSON_INDENT(2)))
+        fail("json_dumpfd failed");
+
+    result = malloc(length + 1);
+    if (!result)
+        fail("malloc failed");
+    rewind(file);
+    if (fread(result, 1, length + 1, file) != length || memcmp(result, expected, length))
+        fail("json_dumpfd and json_dumps did not produce identical output");
+
+    fclose(file);
+    free(result);
+    free(expected);
+    free(str);
+    json_decref(json);
+#endif
+}
+
 static void embed() {
     static const char *plains[] = {"{\"bar\":[],\"foo\":{}}", "[[],{}]", "{}", "[]",
                                    NULL};
@@ -330,16 +496,110 @@ static void max_depth() {
     json_decref(json);
 }
 
+static void integers() {
+    json_t *json = json_array();
+    char *result, *expected, *pos;
+    int i;
+
+    /* long enough to be dumped in several pieces */
+    expected = malloc(64 * 1000);
+    if (!json || !expected)
+        fail("allocation failed");
+
+    pos = expected;
+    *pos++ = '[';
+    for (i = 0; i < 1000; i++) {
+        json_int_t value = (json_int_t)i * i * i * (i % 2 ? -1 : 1);
+        json_array_append_new(json, json_integer(value));
+        pos += sprintf(pos, i ? ",%" JSON_INTEGER_FORMAT : "%" JSON_INTEGER_FORMAT,
+                       value);
+    }
+    strcpy(pos, "]");
+
+    result = json_dumps(json, JSON_COMPACT);
+    if (!result || strcmp(result, expected) != 0)
+        fail("json_dumps failed for an array of integers");
+    free(result);
+    free(expected);
+    json_decref(json);
+
+    json = json_pack("[s, i, {}, i, i]", "x", 0, -1, 10);
+#if JSON_INTEGER_IS_LONG_LONG
+    json_array_insert_new(json, 0, json_integer(-9223372036854775807ll - 1));
+    json_array_insert_new(json, 1, json_integer(9223372036854775807ll));
+    result = json_dumps(json, 0);
+    if (!result || strcmp(result, "[-9223372036854775808, 9223372036854775807, \"x\", "
+                                  "0, {}, -1, 10]") != 0)
+        fail("json_dumps failed for a mixed array");
+    free(result);
+#endif
+
+    result = json_dumps(json, JSON_INDENT(2));
+    if (!result || strstr(result, "\"x\",\n  0,\n  {},\n  -1,\n  10\n]") == NULL)
+        fail("json_dumps failed for an indented array of integers");
+    free(result);
+    json_decref(json);
+}
+
+static void check_sorted(json_t *json, const char *expected) {
+    char *result = json_dumps(json, JSON_COMPACT | JSON_SORT_KEYS);
+    if (!result || strcmp(result, expected) != 0)
+        fail("json_dumps failed to sort keys");
+    free(result);
+}
+
+static void sort_keys() {
+    json_t *json = json_object();
+    char key[8];
+    int i;
+
+    json_object_set_new(json, "b", json_integer(1));
+    json_object_set_new(json, "a", json_integer(2));
+    json_object_setn_new(json, "a\0", 2, json_integer(3));
+    json_object_set_new(json, "", json_integer(4));
+    check_sorted(json, "{\"\":4,\"a\":2,\"a\\u0000\":3,\"b\":1}");
+
+    /* the sorted order follows changes to the object */
+    json_object_set_new(json, "a", json_integer(5));
+    json_object_set_new(json, "c", json_integer(6));
+    json_object_del(json, "");
+    check_sorted(json, "{\"a\":5,\"a\\u0000\":3,\"b\":1,\"c\":6}");
+    json_object_iter_set_new(json, json_object_iter_at(json, "b"), json_null());
+    check_sorted(json, "{\"a\":5,\"a\\u0000\":3,\"b\":null,\"c\":6}");
+    json_object_clear(json);
+    check_sorted(json, "{}");
+
+    /* enough keys for a radix sort, sharing a long prefix */
+    for (i = 299; i >= 0; i--) {
+        sprintf(key, "k%03d", i);
+        json_object_set_new(json, key, json_integer(i));
+    }
+    for (i = 0; i < 2; i++) {
+        char *result = json_dumps(json, JSON_COMPACT | JSON_SORT_KEYS);
+        if (!result || strncmp(result, "{\"k000\":0,\"k001\":1,\"k002\":2,", 28) != 0 ||
+            strcmp(result + strlen(result) - 11, "\"k299\":299}") != 0)
+            fail("json_dumps failed to sort many keys");
+        free(result);
+    }
+    json_decref(json);
+}
+
 static void run_tests() {
     encode_null();
     encode_twice();
     circular_references();
+    deep_circular_references();
     encode_other_than_array_or_object();
     escape_slashes();
     encode_nul_byte();
+    escape_long_strings();
     dump_file();
     dumpb();
+    dump_size();
     dumpfd();
+    dumpfd_long_strings();
     embed();
     max_depth();
+    integers();
+    sort_keys();
 }
@@ -0,0 +1,467 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "jansson_private_config.h"
+
+#include "util.h"
+#include <jansson.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Dump json, whose containers may have caching enabled, and compare
+   the output to that of a copy without caches */
+static void check_dump(json_t *json, size_t flags) {
+    json_t *copy = json_deep_copy(json);
+    char *expected, *output;
+
+    if (!copy)
+        fail("json_deep_copy failed");
+
+    expected = json_dumps(copy, flags);
+    output = json_dumps(json, flags);
+    if (!expected || !output)
+        fail("json_dumps failed");
+    if (strcmp(expected, output) != 0)
+        fail("cached output differs from the output of an uncached copy");
+
+    free(expected);
+    free(output);
+    json_decref(copy);
+}
+
+static void check_all(json_t *json) {
+    check_dump(json, 0);
+    check_dump(json, JSON_COMPACT | JSON_SORT_KEYS);
+    check_dump(json, JSON_INDENT(2));
+    check_dump(json, JSON_INDENT(2) | JSON_EMBED);
+}
+
+static void enable_all(json_t *json) {
+    const char *key;
+    json_t *value;
+    size_t i;
+
+    if (json_dump_cache_enable(json))
+        return;
+
+    if (json_is_object(json)) {
+        json_object_foreach(json, key, value) { enable_all(value); }
+    } else {
+        json_array_foreach(json, i, value) { enable_all(value); }
+    }
+}
+
+static void changes() {
+    json_t *json, *nested, *list, *inner, *arrays;
+
+    json = json_pack("{s:{s:[i, s, {s:f}], s:b}, s:[[i, i], {s:n}], s:s}", "nested",
+                     "list", 1, "two", "three", 3.0, "flag", 1, "arrays", 1, 2, "x",
+                     "string", "value");
+    if (!json)
+        fail("json_pack failed");
+
+    enable_all(json);
+    check_all(json);
+
+    nested = json_object_get(json, "nested");
+    list = json_object_get(nested, "list");
+    inner = json_array_get(list, 2);
+
+    json_object_set_new(inner, "three", json_integer(3));
+    check_all(json);
+
+    json_array_append_new(list, json_string("four"));
+    check_all(json);
+
+    json_array_insert_new(list, 0, json_integer(0));
+    check_all(json);
+
+    json_array_set_new(list, 1, json_pack("[s]", "one"));
+    check_all(json);
+
+    json_array_remove(list, 0);
+    check_all(json);
+
+    json_object_del(nested, "flag");
+    check_all(json);
+
+    json_object_iter_set_new(inner, json_object_iter(inner), json_pack("{s:i}", "a", 1));
+    check_all(json);
+
+    arrays = json_object_get(json, "arrays");
+    json_array_extend(json_array_get(arrays, 0), list);
+    check_all(json);
+
+    json_object_update_new(inner, json_pack("{s:i}", "b", 2));
+    check_all(json);
+
+    /* in place changes */
+    arrays = json_object_get(json, "arrays");
+    json_integer_set(json_array_get(json_array_get(arrays, 0), 0), 100);
+    check_all(json);
+
+    json_string_set(json_array_get(list, 2), "FOUR");
+    check_all(json);
+
+    json_object_set_new(json, "real", json_real(1.5));
+    check_all(json);
+    json_real_set(json_object_get(json, "real"), 2.5);
+    check_all(json);
+
+    json_array_clear(list);
+    check_all(json);
+
+    json_object_clear(inner);
+    check_all(json);
+
+    json_decref(json);
+}
+
+static void shared() {
+    json_t *json, *first, *second, *shared;
+
+    json = json_pack("{s:[], s:[]}", "first", "second");
+    first = json_object_get(json, "first");
+    second = json_object_get(json, "second");
+    shared = json_pack("{s:i}", "value", 1);
+
+    json_array_append_new(first, shared);
+    json_array_append(second, shared);
+    enable_all(json);
+    check_all(json);
+
+    /* changes to a value that is in several places reach all of them */
+    json_object_set_new(shared, "value", json_integer(2));
+    check_all(json);
+
+    /* the same value twice in one array */
+    json_array_append(first, shared);
+    check_all(json);
+    json_array_remove(first, 0);
+    check_all(json);
+    json_object_set_new(shared, "value", json_integer(3));
+    check_all(json);
+
+    /* moving a value to another container */
+    json_incref(shared);
+    json_array_clear(first);
+    json_array_clear(second);
+    json_array_append_new(second, shared);
+    check_all(json);
+    json_object_set_new(shared, "value", json_integer(4));
+    check_all(json);
+
+    json_decref(json);
+
+    /* a container that outlives the one it was in */
+    json = json_pack("[{s:i}]", "a", 1);
+    shared = json_incref(json_array_get(json, 0));
+    json_decref(json);
+    json_dump_cache_enable(shared);
+    json_object_set_new(shared, "a", json_integer(2));
+    check_all(shared);
+    json_decref(shared);
+}
+
+/* Whether json, which contains string, is encoded from cached output.
+   The string is changed behind the library's back for a moment,
+   which only shows in new output. */
+static int uses_cache(json_t *json, json_t *string) {
+    char *value = (char *)json_string_value(string);
+    char *before, *after;
+    int cached;
+
+    before = json_dumps(json, JSON_COMPACT);
+    value[0] = value[0] == 'x' ? 'y' : 'x';
+    after = json_dumps(json, JSON_COMPACT);
+    value[0] = value[0] == 'x' ? 'y' : 'x';
+    if (!before || !after)
+        fail("json_dumps failed");
+
+    cached = strcmp(before, after) == 0;
+    free(before);
+    free(after);
+    return cached;
+}
+
+/* Caching is off only while a container has a shared value in it */
+static void sharing_undone() {
+    json_t *src, *dst, *value, *string;
+
+    src = json_pack("{s:{s:{s:s}}}", "a", "k", "s", "abc");
+    dst = json_pack("{s:{}}", "b");
+    value = json_object_get(json_object_get(src, "a"), "k");
+    string = json_object_get(value, "s");
+    enable_all(src);
+    enable_all(dst);
+    json_dump_cache_disable(value);
+    if (!uses_cache(src, string))
+        fail("cached output was not used");
+
+    /* a temporary reference in another place */
+    json_object_set(json_object_get(dst, "b"), "k", value);
+    if (uses_cache(src, string) || uses_cache(dst, string))
+        fail("cached output was used for a value in two places");
+    json_object_del(json_object_get(dst, "b"), "k");
+    if (!uses_cache(src, string))
+        fail("caching was not enabled again after a value was left in one place");
+    check_all(src);
+
+    /* in three places, it's not known which one is left */
+    json_object_set(dst, "c", value);
+    json_object_set(dst, "d", value);
+    json_object_del(dst, "c");
+    json_object_del(dst, "d");
+    if (uses_cache(src, string))
+        fail("cached output was used for a value that was in several places");
+    json_incref(value);
+    json_object_del(json_object_get(src, "a"), "k");
+    json_object_set_new(json_object_get(src, "a"), "k", value);
+    if (!uses_cache(src, string))
+        fail("caching was not enabled again after a value was moved");
+
+    /* the same value twice in one container */
+    json_object_set(json_object_get(src, "a"), "l", value);
+    if (uses_cache(src, string))
+        fail("cached output was used for a value in two places");
+    json_object_del(json_object_get(src, "a"), "l");
+    if (!uses_cache(src, string))
+        fail("caching was not enabled again after a value was left in one place");
+    check_all(src);
+    check_all(dst);
+
+    json_decref(src);
+    json_decref(dst);
+}
+
+static void loops() {
+    json_t *json, *inner;
+    char *result;
+
+    json = json_array();
+    inner = json_array();
+    json_array_append_new(json, inner);
+    enable_all(json);
+    check_all(json);
+
+    json_array_append(inner, json);
+    result = json_dumps(json, 0);
+    if (result)
+        fail("json_dumps encoded a circular reference with caching enabled");
+
+    json_array_clear(inner);
+    check_all(json);
+    json_decref(json);
+}
+
+static void flags_and_depth() {
+    json_t *json, *inner;
+    char *result;
+
+    json = json_pack("{s:{s:[i, i]}}", "a", "b", 1, 2);
+    inner = json_object_get(json, "a");
+    json_dump_cache_enable(inner);
+
+    /* the cached output of inner is for its depth in json */
+    check_all(json);
+    result = json_dumps(inner, JSON_INDENT(2));
+    if (!result || strcmp(result, "{\n  \"b\": [\n    1,\n    2\n  ]\n}") != 0)
+        fail("json_dumps used cached output for another depth");
+    free(result);
+    check_all(json);
+
+    json_dump_cache_disable(inner);
+    check_all(json);
+    json_dump_cache_disable(inner);
+    json_decref(json);
+
+    json = json_integer(1);
+    if (json_dump_cache_enable(json) != -1)
+        fail("json_dump_cache_enable should require an array or object");
+    json_dump_cache_disable(json);
+    json_decref(json);
+
+    if (json_dump_cache_enable(NULL) != -1)
+        fail("json_dump_cache_enable should fail on NULL");
+    json_dump_cache_disable(NULL);
+}
+
+/* Values shared and loops made before any container has caching
+   enabled are still known when it's enabled */
+static void enabled_later() {
+    json_t *json, *shared, *inner;
+
+    json = json_pack("{s:[], s:{s:[i]}}", "list", "object", "inner", 1);
+    shared = json_object_get(json_object_get(json, "object"), "inner");
+    json_array_append(json_object_get(json, "list"), shared);
+
+    enable_all(json);
+    check_dump(json, JSON_COMPACT);
+    json_array_append_new(shared, json_integer(2));
+    check_dump(json, JSON_COMPACT);
+    json_decref(json);
+
+    json = json_pack("[[i]]", 1);
+    inner = json_array_get(json, 0);
+    json_array_append(inner, json);
+
+    json_dump_cache_enable(inner);
+    json_array_append_new(inner, json_integer(2));
+    if (json_dumps(json, 0))
+        fail("json_dumps encoded a circular reference with caching enabled");
+    json_array_remove(inner, 1);
+    json_dump_cache_enable(json);
+    check_dump(json, JSON_COMPACT);
+    json_array_append_new(inner, json_integer(3));
+    check_dump(json, JSON_COMPACT);
+    json_decref(json);
+}
+
+/* Random changes to a document with caching enabled. Containers may
+   be replaced and changed after that. */
+static void random_changes() {
+    json_t *json, *containers[64];
+    size_t count = 1, i;
+
+    srand(1);
+    json = json_object();
+    containers[0] = json;
+    json_dump_cache_enable(json);
+
+    for (i = 0; i < 2000; i++) {
+        json_t *container = containers[rand() % count];
+        json_t *value;
+        char key[8];
+
+        switch (rand() % 3) {
+            case 0:
+                value = json_integer(rand() % 100);
+                break;
+            case 1:
+                value = json_string("s");
+                break;
+            default:
+                if (count == 64) {
+                    value = json_null();
+                    break;
+                }
+                value = rand() % 2 ? json_array() : json_object();
+                json_dump_cache_enable(value);
+                containers[count++] = json_incref(value);
+                break;
+        }
+
+        if (json_is_object(container)) {
+            sprintf(key, "k%d", rand() % 8);
+            json_object_set_new(container, key, value);
+        } else if (json_array_size(container) > 0 && rand() % 2) {
+            json_array_set_new(container, rand() % json_array_size(container), value);
+        } else {
+            json_array_append_new(container, value);
+        }
+
+        if (i % 10 == 0)
+            check_dump(json, JSON_COMPACT);
+        if (i % 50 == 0)
+            json_integer_set(json_object_get(json, "k0"), i);
+    }
+    check_all(json);
+
+    for (i = 0; i < count; i++)
+        json_decref(containers[i]);
+}
+
+#ifdef HAVE_UNISTD_H
+/* Like check_dump(), but with json_dumpfd() */
+static void check_dumpfd(json_t *json, size_t flags) {
+    FILE *file = tmpfile();
+    json_t *copy = json_deep_copy(json);
+    char *expected, *result;
+    size_t length;
+
+    if (!file || !copy)
+        fail("tmpfile() or json_deep_copy failed");
+
+    expected = json_dumps(copy, flags);
+    if (!expected)
+        fail("json_dumps failed");
+    length = strlen(expected);
+
+    if (json_dumpfd(json, fileno(file), flags))
+        fail("json_dumpfd failed");
+
+    result = malloc(length + 1);
+    if (!result)
+        fail("malloc failed");
+    rewind(file);
+    if (fread(result, 1, length + 1, file) != length || memcmp(result, expected, length))
+        fail("json_dumpfd output differs from the output of an uncached copy");
+
+    fclose(file);
+    free(result);
+    free(expected);
+    json_decref(copy);
+}
+#endif
+
+/* json_dumpfd() writes long pieces of output some time after they're
+   passed to it, and cached output may be gone by then */
+static void dumpfd() {
+#ifdef HAVE_UNISTD_H
+    static const size_t lengths[] = {10, 1000, 2000, 5000, 70000};
+    json_t *json, *tracked, *untracked, *shared;
+    char *str;
+    size_t i, j;
+
+    str = malloc(70000);
+    if (!str)
+        fail("malloc failed");
+    for (i = 0; i < 70000; i++)
+        str[i] = 'a' + i % 26;
+
+    json = json_pack("{s:[], s:[]}", "tracked", "untracked");
+    tracked = json_object_get(json, "tracked");
+    untracked = json_object_get(json, "untracked");
+    json_dump_cache_enable(json);
+    json_dump_cache_enable(tracked);
+    json_dump_cache_enable(untracked);
+
+    /* new and cached output, more of it than is written at a time */
+    for (i = 0; i < 3; i++) {
+        for (j = 0; j < sizeof(lengths) / sizeof(lengths[0]); j++) {
+            json_array_append_new(tracked, json_pack("[s#]", str, lengths[j]));
+            json_dump_cache_enable(json_array_get(tracked, json_array_size(tracked) - 1));
+
+            /* in two places, so below an untracked container */
+            shared = json_pack("{s:s#}", "s", str, lengths[j]);
+            json_dump_cache_enable(shared);
+            json_array_append_new(untracked, shared);
+            json_array_append(untracked, shared);
+        }
+        check_dumpfd(json, JSON_COMPACT);
+        check_dumpfd(json, JSON_COMPACT);
+        check_dumpfd(json, JSON_INDENT(2));
+        check_dumpfd(tracked, JSON_INDENT(2));
+        check_dumpfd(untracked, JSON_COMPACT);
+    }
+
+    free(str);
+    json_decref(json);
+#endif
+}
+
+static void run_tests() {
+    changes();
+    shared();
+    sharing_undone();
+    loops();
+    flags_and_depth();
+    enabled_later();
+    random_changes();
+    dumpfd();
+}
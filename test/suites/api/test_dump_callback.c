@@ -7,6 +7,7 @@
 
 #include "util.h"
 #include <jansson.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -26,6 +27,133 @@ static int my_writer(const char *buffer, size_t len, void *data) {
     return 0;
 }
 
+struct counting_sink {
+    struct my_sink sink;
+    size_t calls;
+};
+
+static int counting_writer(const char *buffer, size_t len, void *data) {
+    struct counting_sink *s = data;
+    s->calls++;
+    return my_writer(buffer, len, &s->sink);
+}
+
+static int discard(const char *buffer, size_t len, void *data) {
+    (void)buffer;
+    (void)len;
+    (void)data;
+    return 0;
+}
+
+static void chunks() {
+    struct counting_sink s;
+    json_t *json = json_array();
+    char *dumped_to_string, *long_string;
+    size_t i;
+
+    long_string = malloc(100000);
+    if (!json || !long_string)
+        fail("allocation failed");
+    memset(long_string, 'x', 100000);
+
+    for (i = 0; i < 10000; i++)
+        json_array_append_new(json, json_pack("{s:[b, n]}", "key", 1));
+    json_array_append_new(json, json_stringn(long_string, 100000));
+
+    dumped_to_string = json_dumps(json, JSON_INDENT(2));
+    if (!dumped_to_string)
+        fail("json_dumps failed");
+
+    s.sink.off = 0;
+    s.sink.cap = strlen(dumped_to_string);
+    s.sink.buf = malloc(s.sink.cap);
+    s.calls = 0;
+    if (!s.sink.buf)
+        fail("malloc failed");
+
+    if (json_dump_callback(json, counting_writer, &s, JSON_INDENT(2)) == -1)
+        fail("json_dump_callback failed");
+    if (s.sink.off != s.sink.cap || memcmp(dumped_to_string, s.sink.buf, s.sink.off) != 0)
+        fail("json_dump_callback and json_dumps did not produce identical "
+             "output");
+
+    /* the output is passed on in large chunks, not token by token */
+    if (s.calls > 1000)
+        fail("json_dump_callback called the callback too many times");
+
+    json_decref(json);
+    free(dumped_to_string);
+    free(long_string);
+    free(s.sink.buf);
+}
+
+static void check_parallel(json_t *json, size_t flags, size_t threads) {
+    struct my_sink s;
+    char *expected = json_dumps(json, flags);
+
+    if (!expected)
+        fail("json_dumps failed");
+
+    s.off = 0;
+    s.cap = strlen(expected);
+    s.buf = malloc(s.cap + 1);
+    if (!s.buf)
+        fail("malloc failed");
+
+    if (json_dump_callback_parallel(json, my_writer, &s, flags, threads))
+        fail("json_dump_callback_parallel failed");
+    if (s.off != s.cap || memcmp(expected, s.buf, s.off) != 0)
+        fail("json_dump_callback_parallel and json_dumps did not produce identical "
+             "output");
+
+    /* a callback error stops the dump */
+    s.off = 1;
+    if (json_dump_callback_parallel(json, my_writer, &s, flags, threads) != -1)
+        fail("json_dump_callback_parallel succeeded when the callback failed");
+
+    free(s.buf);
+    free(expected);
+}
+
+static void parallel() {
+    static const size_t flags[] = {0,
+                                   JSON_COMPACT,
+                                   JSON_INDENT(2) | JSON_SORT_KEYS,
+                                   JSON_INDENT(1) | JSON_EMBED,
+                                   JSON_SORT_KEYS | JSON_EMBED};
+    static const size_t threads[] = {0, 1, 2, 5};
+    json_t *array = json_array(), *object = json_object(), *inner;
+    size_t i, j;
+
+    for (i = 0; i < 5000; i++) {
+        char key[16];
+
+        sprintf(key, "%u", (unsigned)((i * 7919) % 5000));
+        json_array_append_new(array,
+                              json_pack("{s:[i, s], s:{}}", "a", (int)i, key, "b"));
+        json_object_set_new(object, key,
+                            json_pack("[f, {s:n, s:b}]", i / 4.0, "y", "x", 1));
+    }
+
+    for (i = 0; i < sizeof(flags) / sizeof(flags[0]); i++) {
+        for (j = 0; j < sizeof(threads) / sizeof(threads[0]); j++) {
+            check_parallel(array, flags[i], threads[j]);
+            check_parallel(object, flags[i], threads[j]);
+        }
+    }
+
+    /* a circular reference in one of the chunks */
+    inner = json_array();
+    json_array_append(inner, array);
+    json_array_set_new(array, 4321, inner);
+    if (json_dump_callback_parallel(array, discard, NULL, 0, 4) != -1)
+        fail("json_dump_callback_parallel encoded a circular reference!");
+    json_array_clear(inner);
+
+    json_decref(array);
+    json_decref(object);
+}
+
 static void run_tests() {
     struct my_sink s;
     json_t *json;
@@ -79,4 +207,7 @@ static void run_tests() {
     json_decref(json);
     free(dumped_to_string);
     free(s.buf);
+
+    chunks();
+    parallel();
 }
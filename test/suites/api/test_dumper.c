@@ -0,0 +1,177 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "util.h"
+#include <jansson.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Dump json with a dumper in chunks of chunk_size bytes, and compare
+   the result to json_dumps() */
+static void check_chunks(json_t *json, size_t flags, size_t chunk_size) {
+    json_dumper_t *dumper;
+    char *expected, *output;
+    size_t length, used = 0;
+
+    expected = json_dumps(json, flags);
+    if (!expected)
+        fail("json_dumps failed");
+    length = strlen(expected);
+
+    output = malloc(length + chunk_size);
+    if (!output)
+        fail("malloc failed");
+
+    dumper = json_dumper_new(json, flags);
+    if (!dumper)
+        fail("json_dumper_new failed");
+
+    while (1) {
+        size_t size = json_dumper_next(dumper, output + used, chunk_size);
+        if (size == (size_t)-1)
+            fail("json_dumper_next failed");
+        if (size > chunk_size)
+            fail("json_dumper_next wrote too much");
+        if (size == 0)
+            break;
+        if (size < chunk_size && used + size != length)
+            fail("json_dumper_next didn't fill the buffer");
+        used += size;
+        if (used > length)
+            fail("json_dumper_next wrote too much");
+    }
+
+    if (used != length || memcmp(output, expected, length) != 0)
+        fail("json_dumper_next and json_dumps did not produce identical output");
+    if (json_dumper_next(dumper, output, chunk_size) != 0)
+        fail("json_dumper_next should stay at the end of output");
+
+    json_dumper_free(dumper);
+    free(output);
+    free(expected);
+}
+
+static void chunks() {
+    static const size_t flags[] = {0,
+                                   JSON_COMPACT,
+                                   JSON_INDENT(2),
+                                   JSON_INDENT(31) | JSON_SORT_KEYS,
+                                   JSON_INDENT(1) | JSON_COMPACT | JSON_EMBED,
+                                   JSON_ENSURE_ASCII | JSON_ESCAPE_SLASH | JSON_SORT_KEYS,
+                                   JSON_REAL_PRECISION(4) | JSON_EMBED};
+    static const size_t chunk_sizes[] = {1, 2, 3, 7, 100, 100000};
+    json_t *json, *nested;
+    size_t i, j;
+
+    json = json_pack("{s:[i, I, f, b, n, [], {}], s:s, s:{s:[s, s]}, s:[]}", "numbers",
+                     0, (json_int_t)-1234567890, 1.5, 1, "string",
+                     "a/b\"c\\d\n\x01\xc3\xa5 \xf0\x9d\x84\x9e", "nested", "", "x",
+                     "\xe2\x82\xac", "z");
+    if (!json)
+        fail("json_pack failed");
+
+    /* deeper than the dumper's initial stack */
+    nested = json_object_get(json, "z");
+    for (i = 0; i < 40; i++) {
+        json_t *next = json_array();
+        json_array_append_new(nested, next);
+        nested = next;
+    }
+    json_array_append_new(nested, json_string("bottom"));
+
+    for (i = 0; i < sizeof(flags) / sizeof(flags[0]); i++) {
+        for (j = 0; j < sizeof(chunk_sizes) / sizeof(chunk_sizes[0]); j++)
+            check_chunks(json, flags[i], chunk_sizes[j]);
+    }
+    json_decref(json);
+
+    json = json_string("long enough to need several chunks");
+    check_chunks(json, JSON_ENCODE_ANY, 4);
+    json_decref(json);
+
+    json = json_array();
+    check_chunks(json, JSON_EMBED, 1);
+    json_decref(json);
+}
+
+static void reference() {
+    json_t *json = json_pack("[s]", "value");
+    json_dumper_t *dumper = json_dumper_new(json, JSON_COMPACT);
+    char buffer[16];
+
+    /* the dumper keeps json alive */
+    json_decref(json);
+
+    if (json_dumper_next(dumper, buffer, sizeof(buffer)) != 9 ||
+        memcmp(buffer, "[\"value\"]", 9) != 0)
+        fail("json_dumper_next failed");
+
+    json_dumper_free(dumper);
+}
+
+static void errors() {
+    json_t *json, *inner;
+    json_dumper_t *dumper;
+    char buffer[64];
+    size_t size;
+
+    json = json_integer(1);
+    if (json_dumper_new(json, 0))
+        fail("json_dumper_new should require an array or object");
+    dumper = json_dumper_new(json, JSON_ENCODE_ANY);
+    if (!dumper)
+        fail("json_dumper_new failed with JSON_ENCODE_ANY");
+    if (json_dumper_next(dumper, buffer, 0) != (size_t)-1)
+        fail("json_dumper_next should fail on empty buffer");
+    if (json_dumper_next(dumper, buffer, sizeof(buffer)) != 1 || buffer[0] != '1')
+        fail("json_dumper_next failed with JSON_ENCODE_ANY");
+    json_dumper_free(dumper);
+    json_decref(json);
+
+    /* circular reference */
+    json = json_array();
+    inner = json_array();
+    json_array_append_new(json, inner);
+    json_array_append(inner, json);
+
+    dumper = json_dumper_new(json, 0);
+    if (json_dumper_next(dumper, buffer, sizeof(buffer)) != (size_t)-1)
+        fail("json_dumper_next encoded a circular reference!");
+    if (json_dumper_next(dumper, buffer, sizeof(buffer)) != (size_t)-1)
+        fail("json_dumper_next should keep failing after an error");
+    json_dumper_free(dumper);
+
+    json_array_clear(inner);
+    json_decref(json);
+
+    /* invalid UTF-8 */
+    json = json_array();
+    json_array_append_new(json, json_integer(123456789));
+    json_array_append_new(json, json_stringn_nocheck("0123456789\xff", 11));
+
+    dumper = json_dumper_new(json, 0);
+    do {
+        size = json_dumper_next(dumper, buffer, 4);
+    } while (size != 0 && size != (size_t)-1);
+    if (size != (size_t)-1)
+        fail("json_dumper_next encoded invalid UTF-8");
+    json_dumper_free(dumper);
+    json_decref(json);
+
+    if (json_dumper_new(NULL, JSON_ENCODE_ANY))
+        fail("json_dumper_new should fail on NULL");
+    if (json_dumper_next(NULL, buffer, sizeof(buffer)) != (size_t)-1)
+        fail("json_dumper_next should fail on NULL dumper");
+    json_dumper_free(NULL);
+}
+
+static void run_tests() {
+    chunks();
+    reference();
+    errors();
+}
@@ -0,0 +1,199 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "util.h"
+#include <jansson.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Big enough to be decoded in several chunks */
+#define NUM_LINES 40000
+
+static char *make_lines(size_t *length, int bad_line) {
+    char *buffer = malloc(NUM_LINES * 64);
+    size_t offset = 0;
+    int i;
+
+    if (!buffer)
+        fail("malloc failed");
+
+    for (i = 1; i <= NUM_LINES; i++) {
+        if (i == bad_line)
+            offset += sprintf(buffer + offset, "{\"i\": %d, \"s\": \"abc\",}\n", i);
+        else
+            offset += sprintf(buffer + offset, "{\"i\": %d, \"s\": \"abcdefghijklmnop\"}\n", i);
+    }
+    *length = offset;
+    return buffer;
+}
+
+static void array_result() {
+    static const size_t threads[] = {1, 4, 0};
+    json_error_t error;
+    size_t length, i;
+    char *buffer = make_lines(&length, 0);
+
+    for (i = 0; i < sizeof(threads) / sizeof(threads[0]); i++) {
+        json_t *json = json_loadb_lines(buffer, length, 0, threads[i], &error);
+        size_t j;
+
+        if (!json)
+            fail("json_loadb_lines failed");
+        if (json_array_size(json) != NUM_LINES)
+            fail("json_loadb_lines returned a wrong number of values");
+
+        for (j = 0; j < NUM_LINES; j++) {
+            json_t *value = json_object_get(json_array_get(json, j), "i");
+            if (json_integer_value(value) != (json_int_t)j + 1)
+                fail("json_loadb_lines returned the values in a wrong order");
+        }
+        if (error.position != (int)length)
+            fail("json_loadb_lines set a wrong position");
+
+        json_decref(json);
+    }
+
+    free(buffer);
+}
+
+struct counter {
+    json_int_t next;
+    json_int_t stop_at;
+};
+
+static int count_value(json_t *value, void *data) {
+    struct counter *counter = data;
+
+    if (json_integer_value(json_object_get(value, "i")) != ++counter->next)
+        fail("json_loadb_lines_callback passed the values in a wrong order");
+    return counter->next == counter->stop_at;
+}
+
+static void callback_result() {
+    struct counter counter;
+    json_error_t error;
+    size_t length;
+    char *buffer = make_lines(&length, 0);
+
+    counter.next = 0;
+    counter.stop_at = -1;
+    if (json_loadb_lines_callback(buffer, length, 0, 4, count_value, &counter, &error))
+        fail("json_loadb_lines_callback failed");
+    if (counter.next != NUM_LINES)
+        fail("json_loadb_lines_callback passed a wrong number of values");
+
+    counter.next = 0;
+    counter.stop_at = 12345;
+    if (json_loadb_lines_callback(buffer, length, 0, 4, count_value, &counter, &error) !=
+        -1)
+        fail("json_loadb_lines_callback should have been stopped by the callback");
+    if (json_error_code(&error) != json_error_aborted || counter.next != 12345)
+        fail("json_loadb_lines_callback didn't stop correctly");
+
+    free(buffer);
+}
+
+static void errors() {
+    static const size_t threads[] = {1, 3, 8};
+    json_reader_t *reader;
+    json_error_t error, expected;
+    json_t *json;
+    size_t length, i;
+    char *buffer = make_lines(&length, 31000);
+
+    /* The error is the one that decoding the whole input in order
+       gives */
+    reader = json_reader_newb(buffer, length, 0);
+    while ((json = json_reader_next(reader, &expected)))
+        json_decref(json);
+    json_reader_free(reader);
+
+    if (expected.line != 31000)
+        fail("the error is on a wrong line");
+
+    for (i = 0; i < sizeof(threads) / sizeof(threads[0]); i++) {
+        json = json_loadb_lines(buffer, length, 0, threads[i], &error);
+        if (json)
+            fail("json_loadb_lines should have failed");
+        if (strcmp(error.text, expected.text) != 0 || error.line != expected.line ||
+            error.column != expected.column || error.position != expected.position)
+            fail("json_loadb_lines returned an invalid error");
+    }
+
+    free(buffer);
+
+    json = json_loadb_lines("1\n2\n", 4, 0, 1, &error);
+    if (json || strcmp(error.text, "'[' or '{' expected near '1'") != 0)
+        fail("json_loadb_lines should require arrays or objects");
+
+    json = json_loadb_lines("1\n2\n", 4, JSON_DECODE_ANY, 1, &error);
+    if (json_array_size(json) != 2)
+        fail("json_loadb_lines failed with JSON_DECODE_ANY");
+    json_decref(json);
+
+    json = json_loadb_lines("", 0, 0, 0, &error);
+    if (!json || json_array_size(json) != 0)
+        fail("json_loadb_lines failed on empty input");
+    json_decref(json);
+
+    if (json_loadb_lines(NULL, 0, 0, 0, &error) ||
+        strcmp(error.text, "wrong arguments") != 0)
+        fail("json_loadb_lines should fail on NULL buffer");
+    if (json_loadb_lines_callback("[]", 2, 0, 0, NULL, NULL, &error) != -1 ||
+        strcmp(error.text, "wrong arguments") != 0)
+        fail("json_loadb_lines_callback should fail on NULL callback");
+}
+
+/* Texts that span lines are cut between chunks, but still decoded.
+   Most of the newlines are inside the texts. */
+static void multiline_texts() {
+    static const size_t threads[] = {1, 4};
+    char *buffer = malloc(NUM_LINES * 64);
+    json_error_t error;
+    size_t length = 0, i;
+
+    if (!buffer)
+        fail("malloc failed");
+
+    for (i = 1; i <= NUM_LINES; i++)
+        length += sprintf(buffer + length,
+                          "{\"s\": \"abcdefghijklmnopqrstuvwxyz\",\n \"i\": %d}\n", (int)i);
+
+    for (i = 0; i < sizeof(threads) / sizeof(threads[0]); i++) {
+        json_t *json = json_loadb_lines(buffer, length, 0, threads[i], &error);
+        size_t j;
+
+        if (!json || json_array_size(json) != NUM_LINES)
+            fail("json_loadb_lines failed on texts that span lines");
+        for (j = 0; j < NUM_LINES; j++) {
+            json_t *value = json_object_get(json_array_get(json, j), "i");
+            if (json_integer_value(value) != (json_int_t)j + 1)
+                fail("json_loadb_lines returned the values in a wrong order");
+        }
+        json_decref(json);
+    }
+
+    /* an error after the texts that span lines */
+    length -= 2;
+    for (i = 0; i < sizeof(threads) / sizeof(threads[0]); i++) {
+        if (json_loadb_lines(buffer, length, 0, threads[i], &error))
+            fail("json_loadb_lines should have failed on a truncated text");
+        if (json_error_code(&error) != json_error_premature_end_of_input ||
+            error.line != 2 * NUM_LINES || error.position != (int)length)
+            fail("json_loadb_lines returned an invalid error");
+    }
+
+    free(buffer);
+}
+
+static void run_tests() {
+    array_result();
+    callback_result();
+    errors();
+    multiline_texts();
+}
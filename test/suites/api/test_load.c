@@ -5,9 +5,19 @@
  * it under the terms of the MIT license. See LICENSE for details.
  */
 
+#include "jansson_private_config.h"
+
 #include "util.h"
 #include <jansson.h>
+#include <stdio.h>
 #include <string.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef __MINGW32__
+#include <fcntl.h>
+#define pipe(fds) _pipe(fds, 1024, _O_BINARY)
+#endif
 
 static void file_not_found() {
     json_t *json;
@@ -145,6 +155,68 @@ static void decode_int_as_real() {
     json_decref(json);
 }
 
+static void integer_limits() {
+#if JSON_INTEGER_IS_LONG_LONG
+    json_t *json;
+    json_error_t error;
+
+    json = json_loads("[9223372036854775807, -9223372036854775808, -0]", 0, &error);
+    if (!json || json_integer_value(json_array_get(json, 0)) != 9223372036854775807ll ||
+        json_integer_value(json_array_get(json, 1)) != -9223372036854775807ll - 1 ||
+        json_integer_value(json_array_get(json, 2)) != 0)
+        fail("json_loads failed on the limits of json_int_t");
+    json_decref(json);
+
+    json = json_loads("9223372036854775808", JSON_DECODE_ANY, &error);
+    if (json || strcmp(error.text, "too big integer near '9223372036854775808'") != 0 ||
+        json_error_code(&error) != json_error_numeric_overflow)
+        fail("json_loads should have failed on a too big integer");
+
+    json = json_loads("-9223372036854775809", JSON_DECODE_ANY, &error);
+    if (json ||
+        strcmp(error.text, "too big negative integer near '-9223372036854775809'") != 0)
+        fail("json_loads should have failed on a too big negative integer");
+
+    json = json_loads("92233720368547758070", JSON_DECODE_ANY, &error);
+    if (json || strcmp(error.text, "too big integer near '92233720368547758070'") != 0)
+        fail("json_loads should have failed on a too long integer");
+#endif
+}
+
+static void real_rounding() {
+    /* Numbers that are hard to round correctly, and the doubles
+       nearest to them */
+    static const struct {
+        const char *text;
+        double value;
+    } reals[] = {
+        {"1e23", 1e23},
+        {"0.30000000000000004", 0.30000000000000004},
+        {"2.2250738585072011e-308", 2.2250738585072011e-308},
+        {"4.9406564584124654e-324", 4.9406564584124654e-324},
+        {"1.7976931348623157e308", 1.7976931348623157e308},
+        {"9007199254740993.0", 9007199254740992.0},
+        {"1.00000000000000011102230246251565404236316680908203125", 1.0},
+        {"1.00000000000000011102230246251565404236316680908203126",
+         1.0000000000000002},
+        {"123456789012345678901234567890e-10", 12345678901234567890.0},
+        {"1e-400", 0.0},
+    };
+    json_error_t error;
+    size_t i;
+
+    for (i = 0; i < sizeof(reals) / sizeof(reals[0]); i++) {
+        json_t *json = json_loads(reals[i].text, JSON_DECODE_ANY, &error);
+        if (!json_is_real(json) || json_real_value(json) != reals[i].value)
+            fail("json_loads rounded a real incorrectly");
+        json_decref(json);
+    }
+
+    if (json_loads("1.8e308", JSON_DECODE_ANY, &error) ||
+        strcmp(error.text, "real number overflow near '1.8e308'") != 0)
+        fail("json_loads should have failed on a too big real");
+}
+
 static void allow_nul() {
     const char *text = "\"nul byte \\u0000 in string\"";
     const char *expected = "nul byte \0 in string";
@@ -184,6 +256,10 @@ static void load_wrong_args() {
     if (json)
         fail("json_loadfd should return NULL if the first argument is < 0");
 
+    json = json_loadfd_buffered(0, 0, NULL, 0, NULL, &error);
+    if (json)
+        fail("json_loadfd_buffered should return NULL if the buffer is NULL");
+
     json = json_load_file(NULL, 0, &error);
     if (json)
         fail("json_load_file should return NULL if the first argument is NULL");
@@ -205,6 +281,121 @@ static void position() {
     json_decref(json);
 }
 
+static void loadfd_consecutive() {
+#ifdef HAVE_UNISTD_H
+    static const char text[] = "[1] {\"foo\": \"bar\"}\n[\"\xc3\xa4\xc3\xa4\xc3\xa4\"]";
+    size_t flags = JSON_DISABLE_EOF_CHECK;
+    json_error_t error;
+    json_t *json;
+    FILE *file;
+    int fd;
+    int fds[2];
+    char buffer[8];
+    size_t length = 0;
+
+    /* A regular file is read in blocks, the position is left after
+       each JSON text */
+    file = tmpfile();
+    if (!file)
+        fail("tmpfile() failed");
+    fd = fileno(file);
+    if (write(fd, text, sizeof(text) - 1) != (int)sizeof(text) - 1 ||
+        lseek(fd, 0, SEEK_SET) != 0)
+        fail("unable to write the test input");
+
+    json = json_loadfd(fd, flags, &error);
+    if (!json || json_integer_value(json_array_get(json, 0)) != 1)
+        fail("json_loadfd failed on the first text");
+    json_decref(json);
+    if (lseek(fd, 0, SEEK_CUR) != 3)
+        fail("json_loadfd left the file position after the first text");
+
+    json = json_loadfd(fd, flags, &error);
+    if (!json || strcmp(json_string_value(json_object_get(json, "foo")), "bar"))
+        fail("json_loadfd failed on the second text");
+    json_decref(json);
+    if (lseek(fd, 0, SEEK_CUR) != 18)
+        fail("json_loadfd left the file position after the second text");
+    fclose(file);
+
+    /* On error, the position is left at the error instead of a block
+       past it */
+    file = tmpfile();
+    if (!file || fputs("[1, 2, x, 3] [4]", file) == EOF || fflush(file))
+        fail("unable to write the test input");
+    fd = fileno(file);
+    if (lseek(fd, 0, SEEK_SET) != 0 || json_loadfd(fd, flags, &error))
+        fail("json_loadfd should have failed on an invalid token");
+    if (error.position != 8 || lseek(fd, 0, SEEK_CUR) != 8)
+        fail("json_loadfd left the file position past the error");
+    fclose(file);
+
+    /* A pipe can't be read in blocks with json_loadfd(), but
+       json_loadfd_buffered() keeps what it read too much */
+    if (pipe(fds))
+        fail("pipe() failed");
+    if (write(fds[1], text, sizeof(text) - 1) != (int)sizeof(text) - 1)
+        fail("unable to write the test input");
+    close(fds[1]);
+
+    json = json_loadfd_buffered(fds[0], flags, buffer, sizeof(buffer), &length, &error);
+    if (!json || json_integer_value(json_array_get(json, 0)) != 1)
+        fail("json_loadfd_buffered failed on the first text");
+    json_decref(json);
+    if (length == 0 || length > sizeof(buffer) || buffer[0] != ' ')
+        fail("json_loadfd_buffered returned a wrong unread input");
+
+    json = json_loadfd_buffered(fds[0], flags, buffer, sizeof(buffer), &length, &error);
+    if (!json || strcmp(json_string_value(json_object_get(json, "foo")), "bar"))
+        fail("json_loadfd_buffered failed on the second text");
+    json_decref(json);
+
+    json = json_loadfd_buffered(fds[0], flags, buffer, sizeof(buffer), &length, &error);
+    if (!json || strcmp(json_string_value(json_array_get(json, 0)),
+                        "\xc3\xa4\xc3\xa4\xc3\xa4"))
+        fail("json_loadfd_buffered failed on the third text");
+    json_decref(json);
+
+    json = json_loadfd_buffered(fds[0], flags, buffer, sizeof(buffer), &length, &error);
+    if (json || length != 0)
+        fail("json_loadfd_buffered should have failed at the end of input");
+    if (json_error_code(&error) != json_error_premature_end_of_input)
+        fail("json_loadfd_buffered returned a wrong error code at the end of input");
+    close(fds[0]);
+#endif
+}
+
+static void load_file() {
+    const char *path = "test_load_file.json";
+    json_error_t error;
+    json_t *json, *result;
+    FILE *file;
+
+    json = json_pack("{s:[i,s,b]}", "foo", 42, "\xc3\xa4", 1);
+    if (json_dump_file(json, path, JSON_INDENT(2)))
+        fail("json_dump_file failed");
+
+    result = json_load_file(path, 0, &error);
+    if (!result || !json_equal(json, result))
+        fail("json_load_file returned a wrong value");
+    if (error.position != 45)
+        fail("json_load_file returned a wrong position");
+    json_decref(result);
+    json_decref(json);
+
+    file = fopen(path, "wb");
+    if (!file || fputs("[1,\n 2,", file) == EOF || fclose(file))
+        fail("unable to write the test input");
+
+    result = json_load_file(path, 0, &error);
+    if (result)
+        fail("json_load_file should have failed on an incomplete array");
+    check_error(json_error_premature_end_of_input, "']' expected near end of file",
+                "<stream>", 2, 3, 7);
+
+    remove(path);
+}
+
 static void error_code() {
     json_error_t error;
     json_t *json = json_loads("[123] garbage", 0, &error);
@@ -231,8 +422,12 @@ static void run_tests() {
     disable_eof_check();
     decode_any();
     decode_int_as_real();
+    integer_limits();
+    real_rounding();
     allow_nul();
     load_wrong_args();
     position();
+    loadfd_consecutive();
+    load_file();
     error_code();
 }
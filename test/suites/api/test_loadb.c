@@ -34,4 +34,28 @@ static void run_tests() {
         fail("json_loadb returned an invalid error message for an unclosed "
              "top-level array");
     }
+
+    /* columns count UTF-8 characters, positions count bytes */
+    json = json_loadb("[\n  \"\xc3\xa4\xc3\xb6\", tru]", 15, 0, &error);
+    if (json) {
+        json_decref(json);
+        fail("json_loadb should have failed on an invalid literal");
+    }
+    check_error(json_error_invalid_syntax, "invalid token near 'tru'", "<buffer>", 2, 11,
+                15);
+
+    /* escapes and errors after long runs of plain characters */
+    json = json_loadb("[\"0123456789abcdefghijklmnopqrstuvwxyz\\n\xc3\xa4\\u00e4\"]", 50, 0,
+                      &error);
+    if (!json || strcmp(json_string_value(json_array_get(json, 0)),
+                        "0123456789abcdefghijklmnopqrstuvwxyz\n\xc3\xa4\xc3\xa4"))
+        fail("json_loadb decoded a long string incorrectly");
+    json_decref(json);
+
+    json = json_loadb("[\"0123456789abcdefghijklmnopqrstuvwxyz\t\"]", 41, 0, &error);
+    if (json) {
+        json_decref(json);
+        fail("json_loadb should have failed on a control character");
+    }
+    check_error(json_error_invalid_syntax, "control character 0x9", "<buffer>", 1, 38, 38);
 }
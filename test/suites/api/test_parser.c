@@ -0,0 +1,154 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "util.h"
+#include <jansson.h>
+#include <string.h>
+
+static const char my_str[] =
+    "{\"name\": \"caf\\u00e9 \\ud834\\udd1e\", \"list\": [1, -2.5e3, true, null],"
+    " \"nested\": {\"empty\": [], \"\\u00e4\": \"\xc3\xa4\"}}  ";
+
+/* Feed text to a new parser in chunks of at most chunk bytes */
+static json_t *feed_in_chunks(const char *text, size_t length, size_t chunk, size_t flags,
+                              json_error_t *error) {
+    json_parser_t *parser = json_parser_new(flags);
+    json_t *json;
+    size_t offset = 0;
+
+    if (!parser)
+        fail("json_parser_new failed");
+
+    while (offset < length) {
+        size_t n = length - offset < chunk ? length - offset : chunk;
+        if (json_parser_feed(parser, text + offset, n, error) < 0)
+            break;
+        offset += n;
+    }
+
+    json = json_parser_finish(parser, error);
+    json_parser_free(parser);
+    return json;
+}
+
+static void chunk_boundaries() {
+    json_error_t error;
+    json_t *expected, *json;
+    size_t chunk;
+
+    expected = json_loads(my_str, 0, &error);
+    if (!expected)
+        fail("json_loads failed");
+
+    for (chunk = 1; chunk <= sizeof(my_str); chunk++) {
+        json = feed_in_chunks(my_str, strlen(my_str), chunk, 0, &error);
+        if (!json)
+            fail("json_parser_finish failed");
+        if (!json_equal(json, expected))
+            fail("json_parser_finish returned a wrong value");
+        json_decref(json);
+    }
+
+    json_decref(expected);
+}
+
+static void feed_results() {
+    json_parser_t *parser;
+    json_error_t error;
+    json_t *json;
+
+    parser = json_parser_new(0);
+    if (json_parser_feed(parser, "[1, ", 4, &error) != 0)
+        fail("json_parser_feed should need more input");
+    if (json_parser_feed(parser, "2]", 2, &error) != 1)
+        fail("json_parser_feed should have completed the value");
+    if (json_parser_feed(parser, " \n", 2, &error) != 1)
+        fail("json_parser_feed should accept trailing whitespace");
+    if (json_parser_feed(parser, "]", 1, &error) != -1)
+        fail("json_parser_feed should reject trailing garbage");
+    if (strcmp(error.text, "end of file expected near ']'") != 0 ||
+        strcmp(error.source, "<parser>") != 0)
+        fail("json_parser_feed returned an invalid error");
+    if (json_parser_finish(parser, &error))
+        fail("json_parser_finish should fail after an error");
+    if (strcmp(error.text, "end of file expected near ']'") != 0)
+        fail("json_parser_finish returned an invalid error");
+    json_parser_free(parser);
+
+    /* a token cut short by the end of the input leaves no error */
+    parser = json_parser_new(0);
+    if (json_parser_feed(parser, "[\"ab", 4, &error) != 0)
+        fail("json_parser_feed should need more input for a string");
+    if (error.text[0] || error.line != -1 || error.position != 0 ||
+        json_error_code(&error) != json_error_unknown)
+        fail("json_parser_feed left an error for an incomplete string");
+    if (json_parser_feed(parser, "c\"]", 3, &error) != 1)
+        fail("json_parser_feed should have completed the value");
+    json_parser_free(parser);
+
+    /* a number isn't complete until the end of input */
+    parser = json_parser_new(JSON_DECODE_ANY);
+    if (json_parser_feed(parser, "12", 2, &error) != 0)
+        fail("json_parser_feed should need more input for a number");
+    if (json_parser_feed(parser, "34", 2, &error) != 0)
+        fail("json_parser_feed should need more input for a number");
+    json = json_parser_finish(parser, &error);
+    if (!json_is_integer(json) || json_integer_value(json) != 1234)
+        fail("json_parser_finish returned a wrong number");
+    json_decref(json);
+    if (json_parser_feed(parser, "5", 1, &error) != -1)
+        fail("json_parser_feed should fail after json_parser_finish");
+    json_parser_free(parser);
+
+    /* the rest of the input is ignored */
+    parser = json_parser_new(JSON_DISABLE_EOF_CHECK);
+    if (json_parser_feed(parser, "{\"a\": 1}{\"b\"", 12, &error) != 1)
+        fail("json_parser_feed should have completed the value");
+    json = json_parser_finish(parser, &error);
+    if (!json_is_object(json) || json_object_size(json) != 1 || error.position != 8)
+        fail("json_parser_finish returned a wrong value");
+    json_decref(json);
+    json_parser_free(parser);
+}
+
+static void errors() {
+    json_error_t error;
+    json_t *json;
+
+    json = feed_in_chunks("[1, 2", 5, 1, 0, &error);
+    if (json)
+        fail("json_parser_finish should fail on incomplete input");
+    if (strcmp(error.text, "']' expected near end of file") != 0 ||
+        error.position != 5)
+        fail("json_parser_finish returned an invalid error for incomplete input");
+
+    json = feed_in_chunks("[\"\xe2\x82\"]", 5, 2, 0, &error);
+    if (json)
+        fail("json_parser_finish should fail on invalid UTF-8");
+    if (strcmp(error.text, "unable to decode byte 0xe2 near '\"'") != 0)
+        fail("json_parser_finish returned an invalid error for invalid UTF-8");
+
+    /* the first chunk ends after a UTF-8 sequence that follows the escape */
+    json = feed_in_chunks("[\"\xc3\xa9\\udc00\xf0\x9f\x98\x80\"]", 16, 14, 0, &error);
+    if (json)
+        fail("json_parser_finish should fail on an invalid \\u escape");
+    if (strncmp(error.text, "invalid Unicode '\\uDC00'", 24) != 0)
+        fail("json_parser_finish returned an invalid error for an invalid \\u escape");
+
+    if (json_parser_feed(NULL, "[]", 2, &error) != -1)
+        fail("json_parser_feed should fail on NULL parser");
+    if (strcmp(error.text, "wrong arguments") != 0)
+        fail("json_parser_feed returned an invalid error for NULL parser");
+
+    json_parser_free(NULL);
+}
+
+static void run_tests() {
+    chunk_boundaries();
+    feed_results();
+    errors();
+}
@@ -0,0 +1,168 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "util.h"
+#include <jansson.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void construction() {
+    json_t *raw;
+
+    raw = json_raw("{\"a\": [1, 2]}");
+    if (!json_is_raw(raw))
+        fail("json_raw failed");
+    if (strcmp(json_raw_value(raw), "{\"a\": [1, 2]}") != 0 || json_raw_length(raw) != 13)
+        fail("json_raw_value or json_raw_length returned a wrong value");
+    json_decref(raw);
+
+    raw = json_rawn("[true, null]xyz", 12);
+    if (!raw || json_raw_length(raw) != 12 ||
+        memcmp(json_raw_value(raw), "[true, null]", 12) != 0)
+        fail("json_rawn failed");
+    json_decref(raw);
+
+    raw = json_raw(" \"a\\u0000b\" ");
+    if (!raw)
+        fail("json_raw failed on a string with a NUL escape");
+    json_decref(raw);
+
+    if (json_raw("{\"a\": }"))
+        fail("json_raw accepted invalid JSON");
+    if (json_raw("1 2"))
+        fail("json_raw accepted two values");
+    if (json_raw(""))
+        fail("json_raw accepted empty text");
+    if (json_raw(NULL) || json_rawn(NULL, 0))
+        fail("json_raw accepted NULL");
+
+    raw = json_raw_nocheck("{not checked");
+    if (!raw || strcmp(json_raw_value(raw), "{not checked") != 0)
+        fail("json_raw_nocheck failed");
+    json_decref(raw);
+
+    raw = json_rawn_nocheck("12345", 3);
+    if (!raw || strcmp(json_raw_value(raw), "123") != 0)
+        fail("json_rawn_nocheck failed");
+    json_decref(raw);
+
+    if (json_raw_nocheck(NULL) || json_rawn_nocheck(NULL, 0))
+        fail("json_raw_nocheck accepted NULL");
+
+    raw = json_string("[]");
+    if (json_is_raw(raw) || json_raw_value(raw) || json_raw_length(raw) != 0)
+        fail("a string is not raw");
+    json_decref(raw);
+}
+
+static void dumping() {
+    static const size_t flags[] = {0, JSON_COMPACT, JSON_INDENT(2) | JSON_SORT_KEYS,
+                                   JSON_ENSURE_ASCII};
+    json_t *json;
+    json_dumper_t *dumper;
+    char *result, buffer[64];
+    size_t i, size, used;
+
+    json = json_pack("{s:o, s:[o, i]}", "body", json_raw("{\"x\": [1,2] }"), "list",
+                     json_raw("\"\xc3\xa5\""), 3);
+    if (!json)
+        fail("json_pack failed");
+
+    /* raw text is written as is, whatever the flags */
+    result = json_dumps(json, JSON_COMPACT | JSON_SORT_KEYS | JSON_ENSURE_ASCII);
+    if (!result ||
+        strcmp(result, "{\"body\":{\"x\": [1,2] },\"list\":[\"\xc3\xa5\",3]}") != 0)
+        fail("json_dumps failed with raw values");
+    free(result);
+
+    for (i = 0; i < sizeof(flags) / sizeof(flags[0]); i++) {
+        result = json_dumps(json, flags[i] | JSON_SORT_KEYS);
+        if (!result)
+            fail("json_dumps failed");
+
+        if (json_dump_size(json, flags[i] | JSON_SORT_KEYS) != strlen(result))
+            fail("json_dump_size returned a wrong size for raw values");
+
+        dumper = json_dumper_new(json, flags[i] | JSON_SORT_KEYS);
+        used = 0;
+        while ((size = json_dumper_next(dumper, buffer, 5)) != 0) {
+            if (size == (size_t)-1 || memcmp(buffer, result + used, size) != 0)
+                fail("json_dumper_next failed with raw values");
+            used += size;
+        }
+        if (used != strlen(result))
+            fail("json_dumper_next failed with raw values");
+        json_dumper_free(dumper);
+        free(result);
+    }
+    json_decref(json);
+
+    /* at the top level, like other values that aren't arrays or
+       objects */
+    json = json_raw("[1]");
+    if (json_dumps(json, 0))
+        fail("json_dumps should require JSON_ENCODE_ANY for raw values");
+    result = json_dumps(json, JSON_ENCODE_ANY);
+    if (!result || strcmp(result, "[1]") != 0)
+        fail("json_dumps failed with JSON_ENCODE_ANY");
+    free(result);
+    json_decref(json);
+}
+
+static void equality_and_copying() {
+    json_t *raw1, *raw2, *copy;
+
+    raw1 = json_raw("[1, 2]");
+    raw2 = json_raw("[1, 2]");
+    if (!json_equal(raw1, raw2))
+        fail("json_equal failed for equal raw values");
+    json_decref(raw2);
+
+    raw2 = json_raw("[1,2]");
+    if (json_equal(raw1, raw2))
+        fail("json_equal compares raw values by their text");
+    json_decref(raw2);
+
+    raw2 = json_loads("[1, 2]", 0, NULL);
+    if (json_equal(raw1, raw2))
+        fail("a raw value is not equal to the decoded value");
+    json_decref(raw2);
+
+    copy = json_copy(raw1);
+    if (!json_is_raw(copy) || copy == raw1 || !json_equal(copy, raw1))
+        fail("json_copy failed for a raw value");
+    json_decref(copy);
+
+    copy = json_deep_copy(raw1);
+    if (!json_is_raw(copy) || copy == raw1 || !json_equal(copy, raw1))
+        fail("json_deep_copy failed for a raw value");
+    json_decref(copy);
+
+    json_decref(raw1);
+}
+
+static void unpacking() {
+    json_t *json, *value = NULL;
+    json_error_t error;
+    int i;
+
+    json = json_pack("[o]", json_raw("1"));
+    if (json_unpack(json, "[o]", &value) || !json_is_raw(value))
+        fail("json_unpack failed for a raw value");
+    if (!json_unpack_ex(json, &error, 0, "[i]", &i))
+        fail("json_unpack should not take a raw value as an integer");
+    if (strcmp(error.text, "Expected integer, got raw") != 0)
+        fail("json_unpack returned a wrong error");
+    json_decref(json);
+}
+
+static void run_tests() {
+    construction();
+    dumping();
+    equality_and_copying();
+    unpacking();
+}
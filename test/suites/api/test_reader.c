@@ -0,0 +1,159 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "util.h"
+#include <jansson.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char my_str[] = "{\"a\": 1}\n"
+                             "[2, 3]\n"
+                             "\n"
+                             "{\"b\": \"c\"}{\"d\": []}\n";
+
+static void check_values(json_reader_t *reader, const char *source) {
+    static const char *expected[] = {"{\"a\": 1}", "[2, 3]", "{\"b\": \"c\"}",
+                                     "{\"d\": []}"};
+    static const int positions[] = {8, 15, 27, 36};
+    json_error_t error;
+    json_t *json;
+    size_t i;
+
+    if (!reader)
+        fail("json_reader_new failed");
+
+    for (i = 0; i < sizeof(expected) / sizeof(expected[0]); i++) {
+        char *dumped;
+
+        json = json_reader_next(reader, &error);
+        if (!json)
+            fail("json_reader_next failed");
+        if (json_reader_eof(reader))
+            fail("json_reader_eof returned true too early");
+
+        dumped = json_dumps(json, 0);
+        if (strcmp(dumped, expected[i]) != 0)
+            fail("json_reader_next returned a wrong value");
+        if (error.position != positions[i])
+            fail("json_reader_next set a wrong position");
+        free(dumped);
+        json_decref(json);
+    }
+
+    json = json_reader_next(reader, &error);
+    if (json)
+        fail("json_reader_next should have reached the end of input");
+    if (!json_reader_eof(reader) || error.text[0] != '\0' ||
+        strcmp(error.source, source) != 0)
+        fail("json_reader_next failed at the end of input");
+
+    json = json_reader_next(reader, &error);
+    if (json || !json_reader_eof(reader))
+        fail("json_reader_next should stay at the end of input");
+
+    json_reader_free(reader);
+}
+
+static size_t greedy_reader(void *buf, size_t buflen, void *arg) {
+    const char **s = arg;
+    size_t length = strlen(*s);
+
+    if (buflen > length)
+        buflen = length;
+    memcpy(buf, *s, buflen);
+    *s += buflen;
+    return buflen;
+}
+
+static void sources() {
+    const char *input = my_str;
+    FILE *fp;
+
+    check_values(json_reader_newb(my_str, strlen(my_str), 0), "<buffer>");
+    check_values(json_reader_new_callback(greedy_reader, &input, 0), "<callback>");
+
+    fp = tmpfile();
+    if (!fp)
+        fail("tmpfile() failed");
+    fputs(my_str, fp);
+    rewind(fp);
+    check_values(json_reader_newf(fp, 0), "<stream>");
+    fclose(fp);
+}
+
+static void decode_any() {
+    json_reader_t *reader = json_reader_newb("1 \"two\"\n3.0", 11, JSON_DECODE_ANY);
+    json_error_t error;
+    json_t *json;
+
+    json = json_reader_next(reader, &error);
+    if (!json_is_integer(json) || json_integer_value(json) != 1)
+        fail("json_reader_next returned a wrong integer");
+    json_decref(json);
+
+    json = json_reader_next(reader, &error);
+    if (!json_is_string(json) || strcmp(json_string_value(json), "two") != 0)
+        fail("json_reader_next returned a wrong string");
+    json_decref(json);
+
+    json = json_reader_next(reader, &error);
+    if (!json_is_real(json) || json_real_value(json) != 3.0)
+        fail("json_reader_next returned a wrong real");
+    json_decref(json);
+
+    json = json_reader_next(reader, &error);
+    if (json || !json_reader_eof(reader))
+        fail("json_reader_next should have reached the end of input");
+
+    json_reader_free(reader);
+}
+
+static void errors() {
+    json_reader_t *reader = json_reader_newb("[1]\n[2,]\n[3]\n", 14, 0);
+    json_error_t error;
+    json_t *json;
+
+    json = json_reader_next(reader, &error);
+    if (!json)
+        fail("json_reader_next failed");
+    json_decref(json);
+
+    json = json_reader_next(reader, &error);
+    if (json || json_reader_eof(reader))
+        fail("json_reader_next should have failed");
+    if (strcmp(error.text, "unexpected token near ']'") != 0 || error.line != 2 ||
+        error.column != 4 || error.position != 8)
+        fail("json_reader_next returned an invalid error");
+
+    memset(&error, 0, sizeof(error));
+    json = json_reader_next(reader, &error);
+    if (json || strcmp(error.text, "unexpected token near ']'") != 0)
+        fail("json_reader_next should have returned the same error again");
+
+    json_reader_free(reader);
+
+    reader = json_reader_newb("1", 1, 0);
+    json = json_reader_next(reader, &error);
+    if (json || strcmp(error.text, "'[' or '{' expected near '1'") != 0)
+        fail("json_reader_next should require an array or object");
+    json_reader_free(reader);
+
+    if (json_reader_newb(NULL, 0, 0))
+        fail("json_reader_newb should fail on NULL buffer");
+    if (json_reader_next(NULL, &error) || strcmp(error.text, "wrong arguments") != 0)
+        fail("json_reader_next should fail on NULL reader");
+    if (json_reader_eof(NULL))
+        fail("json_reader_eof should return false on NULL reader");
+    json_reader_free(NULL);
+}
+
+static void run_tests() {
+    sources();
+    decode_any();
+    errors();
+}
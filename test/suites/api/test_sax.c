@@ -0,0 +1,185 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "util.h"
+#include <jansson.h>
+#include <stdio.h>
+#include <string.h>
+
+/* The events are written to a string, one character per event */
+struct events {
+    char text[256];
+    size_t length;
+    int stop_at; /* stop after this many events, or -1 */
+};
+
+static int add(struct events *events, const char *text, size_t length) {
+    if (events->length + length >= sizeof(events->text))
+        fail("too many events");
+    memcpy(events->text + events->length, text, length);
+    events->length += length;
+    events->text[events->length] = '\0';
+
+    if (events->stop_at >= 0 && --events->stop_at < 0)
+        return -1;
+    return 0;
+}
+
+static int on_start_object(void *data) { return add(data, "{", 1); }
+static int on_end_object(void *data) { return add(data, "}", 1); }
+static int on_start_array(void *data) { return add(data, "[", 1); }
+static int on_end_array(void *data) { return add(data, "]", 1); }
+static int on_null(void *data) { return add(data, "n", 1); }
+
+static int on_key(const char *key, size_t length, void *data) {
+    add(data, "k:", 2);
+    return add(data, key, length);
+}
+
+static int on_string(const char *value, size_t length, void *data) {
+    add(data, "s:", 2);
+    return add(data, value, length);
+}
+
+static int on_integer(json_int_t value, void *data) {
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "i:%" JSON_INTEGER_FORMAT, value);
+    return add(data, buffer, strlen(buffer));
+}
+
+static int on_real(double value, void *data) {
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "r:%g", value);
+    return add(data, buffer, strlen(buffer));
+}
+
+static int on_boolean(int value, void *data) { return add(data, value ? "t" : "f", 1); }
+
+static json_sax_callbacks_t all_callbacks() {
+    json_sax_callbacks_t callbacks;
+
+    callbacks.start_object = on_start_object;
+    callbacks.key = on_key;
+    callbacks.end_object = on_end_object;
+    callbacks.start_array = on_start_array;
+    callbacks.end_array = on_end_array;
+    callbacks.string = on_string;
+    callbacks.integer = on_integer;
+    callbacks.real = on_real;
+    callbacks.boolean = on_boolean;
+    callbacks.null = on_null;
+    return callbacks;
+}
+
+static const char my_str[] =
+    "{\"a\": [1, -2.5, true, false, null], \"b\\u00e4\": {\"c\": \"x\\ny\"}, \"d\": []}";
+
+static const char my_events[] = "{k:a[i:1r:-2.5tfn]k:b\xc3\xa4{k:cs:x\ny}k:d[]}";
+
+static size_t greedy_reader(void *buf, size_t buflen, void *arg) {
+    const char **s = arg;
+    size_t length = strlen(*s);
+
+    if (buflen > length)
+        buflen = length;
+    memcpy(buf, *s, buflen);
+    *s += buflen;
+    return buflen;
+}
+
+static void events() {
+    json_sax_callbacks_t callbacks = all_callbacks();
+    struct events events;
+    json_error_t error;
+    const char *input = my_str;
+
+    events.length = 0;
+    events.stop_at = -1;
+    if (json_sax_loadb(my_str, strlen(my_str), 0, &callbacks, &events, &error))
+        fail("json_sax_loadb failed");
+    if (strcmp(events.text, my_events) != 0)
+        fail("json_sax_loadb produced wrong events");
+    if (error.position != (int)strlen(my_str))
+        fail("json_sax_loadb set a wrong position");
+
+    events.length = 0;
+    if (json_sax_load_callback(greedy_reader, &input, 0, &callbacks, &events, &error))
+        fail("json_sax_load_callback failed");
+    if (strcmp(events.text, my_events) != 0)
+        fail("json_sax_load_callback produced wrong events");
+
+    events.length = 0;
+    if (json_sax_loadb("\"foo\" 5", 5, JSON_DECODE_ANY, &callbacks, &events, &error) ||
+        strcmp(events.text, "s:foo") != 0)
+        fail("json_sax_loadb failed with JSON_DECODE_ANY");
+
+    events.length = 0;
+    if (json_sax_loadb("[1] [2]", 7, JSON_DISABLE_EOF_CHECK, &callbacks, &events,
+                       &error) ||
+        strcmp(events.text, "[i:1]") != 0 || error.position != 3)
+        fail("json_sax_loadb failed with JSON_DISABLE_EOF_CHECK");
+}
+
+static void null_callbacks() {
+    json_sax_callbacks_t callbacks;
+    struct events events;
+    json_error_t error;
+
+    memset(&callbacks, 0, sizeof(callbacks));
+    callbacks.integer = on_integer;
+
+    events.length = 0;
+    events.stop_at = -1;
+    if (json_sax_loadb(my_str, strlen(my_str), 0, &callbacks, &events, &error))
+        fail("json_sax_loadb failed with NULL callbacks");
+    if (strcmp(events.text, "i:1") != 0)
+        fail("json_sax_loadb called a NULL callback");
+}
+
+static void errors() {
+    json_sax_callbacks_t callbacks = all_callbacks();
+    struct events events;
+    json_error_t error;
+
+    events.length = 0;
+    events.stop_at = 3;
+    if (json_sax_loadb(my_str, strlen(my_str), 0, &callbacks, &events, &error) != -1)
+        fail("json_sax_loadb should have been stopped by a callback");
+    if (json_error_code(&error) != json_error_aborted ||
+        strcmp(events.text, "{k:a[") != 0)
+        fail("json_sax_loadb didn't stop correctly");
+
+    events.length = 0;
+    events.stop_at = -1;
+    if (json_sax_loadb("[1, 2", 5, 0, &callbacks, &events, &error) != -1)
+        fail("json_sax_loadb should fail on incomplete input");
+    if (strcmp(error.text, "']' expected near end of file") != 0 ||
+        strcmp(events.text, "[i:1i:2") != 0)
+        fail("json_sax_loadb returned an invalid error for incomplete input");
+
+    events.length = 0;
+    if (json_sax_loadb("[\"a\\u0000\"]", 11, 0, &callbacks, &events, &error) != -1)
+        fail("json_sax_loadb should fail on a NUL character");
+    if (json_error_code(&error) != json_error_null_character)
+        fail("json_sax_loadb returned an invalid error for a NUL character");
+
+    events.length = 0;
+    if (json_sax_loadb("[\"a\\u0000\"]", 11, JSON_ALLOW_NUL, &callbacks, &events,
+                       &error) ||
+        events.length != 6 || memcmp(events.text, "[s:a\0]", 6) != 0)
+        fail("json_sax_loadb failed with JSON_ALLOW_NUL");
+
+    if (json_sax_loadb(my_str, strlen(my_str), 0, NULL, NULL, &error) != -1 ||
+        strcmp(error.text, "wrong arguments") != 0)
+        fail("json_sax_loadb should fail on NULL callbacks");
+}
+
+static void run_tests() {
+    events();
+    null_callbacks();
+    errors();
+}
@@ -0,0 +1,347 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "util.h"
+#include <jansson.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Write the equivalent of
+   {"numbers": [0, -1234567890, 1.5, true, false, null, [], {}],
+    "string": "...", "nested": {"": ["x", "€"]}, "z": [<deep>]} */
+static void write_document(json_writer_t *writer) {
+    int i, res = 0;
+
+    res |= json_writer_begin_object(writer);
+    res |= json_writer_key(writer, "numbers");
+    res |= json_writer_begin_array(writer);
+    res |= json_writer_integer(writer, 0);
+    res |= json_writer_integer(writer, -1234567890);
+    res |= json_writer_real(writer, 1.5);
+    res |= json_writer_boolean(writer, 1);
+    res |= json_writer_boolean(writer, 0);
+    res |= json_writer_null(writer);
+    res |= json_writer_begin_array(writer);
+    res |= json_writer_end_array(writer);
+    res |= json_writer_begin_object(writer);
+    res |= json_writer_end_object(writer);
+    res |= json_writer_end_array(writer);
+    res |= json_writer_keyn(writer, "string_", 6);
+    res |= json_writer_stringn(writer, "a/b\"c\\d\n\x01\xc3\xa5 \xf0\x9d\x84\x9e!", 16);
+    res |= json_writer_key(writer, "nested");
+    res |= json_writer_begin_object(writer);
+    res |= json_writer_key(writer, "");
+    res |= json_writer_begin_array(writer);
+    res |= json_writer_string(writer, "x");
+    res |= json_writer_string(writer, "\xe2\x82\xac");
+    res |= json_writer_end_array(writer);
+    res |= json_writer_end_object(writer);
+    res |= json_writer_key(writer, "z");
+
+    /* deeper than the writer's initial stack */
+    for (i = 0; i < 40; i++)
+        res |= json_writer_begin_array(writer);
+    res |= json_writer_string(writer, "bottom");
+    for (i = 0; i < 40; i++)
+        res |= json_writer_end_array(writer);
+    res |= json_writer_end_object(writer);
+
+    if (res)
+        fail("writing the document failed");
+}
+
+static json_t *build_document() {
+    json_t *json, *nested;
+    int i;
+
+    json = json_pack("{s:[i, I, f, b, b, n, [], {}], s:s, s:{s:[s, s]}, s:[]}",
+                     "numbers", 0, (json_int_t)-1234567890, 1.5, 1, 0, "string",
+                     "a/b\"c\\d\n\x01\xc3\xa5 \xf0\x9d\x84\x9e", "nested", "", "x",
+                     "\xe2\x82\xac", "z");
+    if (!json)
+        fail("json_pack failed");
+
+    nested = json_object_get(json, "z");
+    for (i = 0; i < 39; i++) {
+        json_t *next = json_array();
+        json_array_append_new(nested, next);
+        nested = next;
+    }
+    json_array_append_new(nested, json_string("bottom"));
+    return json;
+}
+
+struct sink {
+    char *data;
+    size_t used;
+    size_t calls;
+};
+
+static int sink_dump(const char *buffer, size_t size, void *data) {
+    struct sink *sink = data;
+    char *new_data = realloc(sink->data, sink->used + size + 1);
+
+    if (!new_data)
+        return -1;
+    memcpy(new_data + sink->used, buffer, size);
+    sink->data = new_data;
+    sink->used += size;
+    sink->data[sink->used] = '\0';
+    sink->calls++;
+    return 0;
+}
+
+static void matches_dump() {
+    static const size_t flags[] = {0,
+                                   JSON_COMPACT,
+                                   JSON_INDENT(2),
+                                   JSON_INDENT(31),
+                                   JSON_INDENT(1) | JSON_COMPACT,
+                                   JSON_ENSURE_ASCII | JSON_ESCAPE_SLASH,
+                                   JSON_REAL_PRECISION(4) | JSON_PRESERVE_ORDER};
+    json_t *json = build_document();
+    size_t i;
+
+    for (i = 0; i < sizeof(flags) / sizeof(flags[0]); i++) {
+        json_writer_t *writer;
+        struct sink sink = {NULL, 0, 0};
+        char *buffer, *expected = json_dumps(json, flags[i] | JSON_PRESERVE_ORDER);
+
+        if (!expected)
+            fail("json_dumps failed");
+
+        writer = json_writer_new_callback(sink_dump, &sink, flags[i]);
+        if (!writer)
+            fail("json_writer_new_callback failed");
+        write_document(writer);
+        if (json_writer_finish(writer))
+            fail("json_writer_finish failed");
+        if (!sink.data || strcmp(sink.data, expected) != 0)
+            fail("json_writer and json_dumps did not produce identical output");
+        if (json_writer_length(writer) != strlen(expected))
+            fail("json_writer_length returned a wrong length");
+        json_writer_free(writer);
+        free(sink.data);
+
+        buffer = malloc(strlen(expected));
+        if (!buffer)
+            fail("malloc failed");
+
+        writer = json_writer_newb(buffer, strlen(expected), flags[i]);
+        if (!writer)
+            fail("json_writer_newb failed");
+        write_document(writer);
+        if (json_writer_finish(writer))
+            fail("json_writer_finish failed");
+        if (json_writer_length(writer) != strlen(expected) ||
+            memcmp(buffer, expected, strlen(expected)) != 0)
+            fail("json_writer_newb and json_dumps did not produce identical output");
+        json_writer_free(writer);
+        free(buffer);
+
+        free(expected);
+    }
+
+    json_decref(json);
+}
+
+static void embed_value() {
+    struct sink sink = {NULL, 0, 0};
+    json_writer_t *writer;
+    json_t *json = json_pack("{s:i}", "b", 2);
+
+    writer = json_writer_new_callback(sink_dump, &sink, JSON_INDENT(2));
+    if (json_writer_begin_array(writer) || json_writer_integer(writer, 1) ||
+        json_writer_value(writer, json) || json_writer_value(writer, json) ||
+        json_writer_end_array(writer) || json_writer_finish(writer))
+        fail("json_writer_value failed");
+    if (strcmp(sink.data, "[\n  1,\n  {\n    \"b\": 2\n  },\n"
+                          "  {\n    \"b\": 2\n  }\n]") != 0)
+        fail("json_writer_value wrote wrong output");
+    json_writer_free(writer);
+    free(sink.data);
+    json_decref(json);
+}
+
+static void top_level() {
+    struct sink sink = {NULL, 0, 0};
+    json_writer_t *writer;
+
+    writer = json_writer_new_callback(sink_dump, &sink, 0);
+    if (json_writer_integer(writer, 1) != -1)
+        fail("json_writer should require an array or object");
+    if (json_writer_begin_array(writer) != -1)
+        fail("json_writer should keep failing after an error");
+    json_writer_free(writer);
+
+    writer = json_writer_new_callback(sink_dump, &sink, JSON_ENCODE_ANY | JSON_COMPACT);
+    if (json_writer_integer(writer, 1) || json_writer_begin_object(writer) ||
+        json_writer_end_object(writer) || json_writer_string(writer, "s") ||
+        json_writer_finish(writer))
+        fail("json_writer failed with JSON_ENCODE_ANY");
+    if (strcmp(sink.data, "1\n{}\n\"s\"") != 0)
+        fail("json_writer wrote several values wrong");
+    json_writer_free(writer);
+    free(sink.data);
+}
+
+static void flush() {
+    struct sink sink = {NULL, 0, 0};
+    json_writer_t *writer = json_writer_new_callback(sink_dump, &sink, JSON_COMPACT);
+    size_t i;
+
+    if (json_writer_begin_array(writer) || json_writer_flush(writer))
+        fail("json_writer_flush failed");
+    if (sink.calls != 1 || strcmp(sink.data, "[") != 0)
+        fail("json_writer_flush didn't pass the output to the callback");
+    if (json_writer_flush(writer) || sink.calls != 1)
+        fail("json_writer_flush called the callback without output");
+
+    /* large output is passed on in chunks */
+    for (i = 0; i < 100000; i++) {
+        if (json_writer_integer(writer, (json_int_t)i))
+            fail("json_writer_integer failed");
+    }
+    if (json_writer_end_array(writer) || json_writer_finish(writer))
+        fail("json_writer_finish failed");
+    if (sink.calls > 1000)
+        fail("json_writer called the callback too many times");
+    if (json_writer_length(writer) != sink.used)
+        fail("json_writer_length returned a wrong length");
+    json_writer_free(writer);
+    free(sink.data);
+}
+
+static void errors() {
+    static const char *prefixes[] = {"", "[", "{", "{k"};
+    char buffer[8];
+    json_writer_t *writer;
+    json_t *json, *inner;
+    size_t i;
+
+    /* nothing written, or containers left open */
+    for (i = 0; i < sizeof(prefixes) / sizeof(prefixes[0]); i++) {
+        const char *p;
+
+        writer = json_writer_newb(buffer, sizeof(buffer), 0);
+        for (p = prefixes[i]; *p; p++) {
+            if (*p == '[')
+                json_writer_begin_array(writer);
+            else if (*p == '{')
+                json_writer_begin_object(writer);
+            else
+                json_writer_key(writer, "k");
+        }
+        if (json_writer_finish(writer) != -1)
+            fail("json_writer_finish should require complete output");
+        json_writer_free(writer);
+    }
+
+    /* a value without a key */
+    writer = json_writer_newb(buffer, sizeof(buffer), 0);
+    json_writer_begin_object(writer);
+    if (json_writer_integer(writer, 1) != -1)
+        fail("json_writer should require a key before a value");
+    json_writer_free(writer);
+
+    /* a key outside an object, two keys, a key without a value */
+    writer = json_writer_newb(buffer, sizeof(buffer), 0);
+    json_writer_begin_array(writer);
+    if (json_writer_key(writer, "k") != -1)
+        fail("json_writer_key should fail outside an object");
+    json_writer_free(writer);
+
+    writer = json_writer_newb(buffer, sizeof(buffer), 0);
+    json_writer_begin_object(writer);
+    json_writer_key(writer, "k");
+    if (json_writer_key(writer, "k") != -1)
+        fail("json_writer_key should fail after a key");
+    json_writer_free(writer);
+
+    writer = json_writer_newb(buffer, sizeof(buffer), 0);
+    json_writer_begin_object(writer);
+    json_writer_key(writer, "k");
+    if (json_writer_end_object(writer) != -1)
+        fail("json_writer_end_object should fail after a key");
+    json_writer_free(writer);
+
+    /* mismatched brackets */
+    writer = json_writer_newb(buffer, sizeof(buffer), 0);
+    json_writer_begin_array(writer);
+    if (json_writer_end_object(writer) != -1)
+        fail("json_writer_end_object should fail in an array");
+    json_writer_free(writer);
+
+    writer = json_writer_newb(buffer, sizeof(buffer), 0);
+    if (json_writer_end_array(writer) != -1)
+        fail("json_writer_end_array should fail without an array");
+    json_writer_free(writer);
+
+    /* invalid values */
+    writer = json_writer_newb(buffer, sizeof(buffer), 0);
+    json_writer_begin_array(writer);
+    if (json_writer_string(writer, "\xff") != -1)
+        fail("json_writer_string should fail on invalid UTF-8");
+    json_writer_free(writer);
+
+#ifdef INFINITY
+    writer = json_writer_newb(buffer, sizeof(buffer), 0);
+    json_writer_begin_array(writer);
+    if (json_writer_real(writer, INFINITY) != -1)
+        fail("json_writer_real should fail on infinity");
+    json_writer_free(writer);
+#endif
+
+    json = json_array();
+    inner = json_array();
+    json_array_append_new(json, inner);
+    json_array_append(inner, json);
+    writer = json_writer_newb(buffer, sizeof(buffer), 0);
+    json_writer_begin_array(writer);
+    if (json_writer_value(writer, json) != -1)
+        fail("json_writer_value encoded a circular reference!");
+    json_writer_free(writer);
+    json_array_clear(inner);
+    json_decref(json);
+
+    /* too deep */
+    writer = json_writer_newb(NULL, 0, 0);
+    for (i = 0; i < JSON_PARSER_MAX_DEPTH; i++) {
+        if (json_writer_begin_array(writer))
+            fail("json_writer_begin_array failed");
+    }
+    if (json_writer_begin_array(writer) != -1)
+        fail("json_writer should limit the depth");
+    json_writer_free(writer);
+
+    /* the buffer is too small, but the length is counted */
+    writer = json_writer_newb(buffer, 4, 0);
+    if (json_writer_begin_array(writer) || json_writer_string(writer, "abcdefgh") ||
+        json_writer_end_array(writer) || json_writer_finish(writer))
+        fail("json_writer_newb should count past the end of buffer");
+    if (json_writer_length(writer) != 12)
+        fail("json_writer_newb wrote a wrong length");
+    json_writer_free(writer);
+
+    if (json_writer_new_callback(NULL, NULL, 0) || json_writer_newf(NULL, 0) ||
+        json_writer_newfd(-1, 0) || json_writer_newb(NULL, 1, 0))
+        fail("json_writer_new should fail on invalid arguments");
+    if (json_writer_begin_array(NULL) != -1 || json_writer_null(NULL) != -1 ||
+        json_writer_finish(NULL) != -1 || json_writer_length(NULL) != 0)
+        fail("json_writer should fail on NULL writer");
+    json_writer_free(NULL);
+}
+
+static void run_tests() {
+    matches_dump();
+    embed_value();
+    top_level();
+    flush();
+    errors();
+}